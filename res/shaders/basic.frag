@@ -42,7 +42,12 @@ layout (std140) uniform ObjectConstants
   mat4 M;
   mat4 normalM;
 
+  // as basic.vert declares it, or the program won't link
+#ifdef DUAL_QUATERNION
+  vec4 DQ[256];
+#else
   mat4 WB[128];
+#endif
 };
 
 uniform sampler2D tex;
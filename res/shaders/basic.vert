@@ -4,7 +4,7 @@ layout (location = 0) in vec3 posToVert;
 layout (location = 1) in vec3 normalToVert;
 layout (location = 2) in vec2 texCoordToVert;
 layout (location = 3) in vec4 weightsToVert;
-layout (location = 4) in ivec4 idxsToVert; // TODO: why isn't this working?!?!
+layout (location = 4) in uvec4 idxsToVert; // 0, weighing 0, for no bone
 
 layout (std140) uniform PassConstants
 {
@@ -33,51 +33,73 @@ layout (std140) uniform ObjectConstants
   mat4 M;
   mat4 normalM;
 
-  mat4 WB[128];
+#ifdef DUAL_QUATERNION
+  vec4 DQ[256]; // 2 * maxPaletteBones, per bone the real then dual part
+#else
+  mat4 WB[128]; // maxPaletteBones = 128
+#endif
 };
 
+#ifdef SKIN_CACHE
+// the skinning pre-pass: model space, captured by transform feedback for
+// the passes after to draw unskinned
+out vec3 skinnedPos;
+out vec3 skinnedNormal;
+#else
 out vec3 normalToFrag;
 out vec3 posToFrag;
 out vec2 texCoordToFrag;
+#endif
 
 void main()
 {
-  vec3 vPrime = vec3(0.0f);
-  vec3 normalPrime = vec3(0.0f);
-
-  /* int idxs[4]; */
-  /* idxs[0] = idxsToVert.x; */
-  /* idxs[1] = idxsToVert.y; */
-  /* idxs[2] = idxsToVert.z; */
-  /* idxs[3] = idxsToVert.w; */
-  /* float wght[4]; */
-
-  /* wght[0] = weightsToVert.x; */
-  /* wght[1] = weightsToVert.y; */
-  /* wght[2] = weightsToVert.x; */
-  /* wght[3] = weightsToVert.x; */
-
-  /* if (idxs[0] != -1) */
-  /*   { */
-  /*     for (uint i = 0; i < 4; ++i) */
-  /*       { */
-  /*         if (idxs[i] == -1) break; */
-
-  /*         vPrime += vec3(weightsToVert[i] * (WB[idxs[i]] * vec4(posToVert, 1.0f))); */
-
-  /*         // Assuming no non-uniform scaling or shearing */
-
-  /*         normalPrime += vec3(weightsToVert[i] * (WB[idxs[i]] * vec4(normalToVert, 0.0f))); */
-  /*       } */
-  /*   } */
-  /* else */
-  /*   { */
-  vPrime = posToVert;
-  normalPrime = normalToVert;
-      //}
-
+#if defined(SKINNED) && defined(DUAL_QUATERNION)
+  // dual quaternion skinning. Bones on the far side of the first one's
+  // hemisphere are flipped so the blend takes the short way around
+  ivec4 idxs = 2 * ivec4(idxsToVert);
+  vec4 r0 = DQ[idxs.x];
+  vec4 dots = vec4(1.0f,
+                   dot(r0, DQ[idxs.y]),
+                   dot(r0, DQ[idxs.z]),
+                   dot(r0, DQ[idxs.w]));
+  vec4 w = weightsToVert
+    * mix(vec4(-1.0f), vec4(1.0f), greaterThanEqual(dots, vec4(0.0f)));
+  vec4 r = w.x * r0 + w.y * DQ[idxs.y] + w.z * DQ[idxs.z] + w.w * DQ[idxs.w];
+  vec4 d = w.x * DQ[idxs.x + 1] + w.y * DQ[idxs.y + 1]
+    + w.z * DQ[idxs.z + 1] + w.w * DQ[idxs.w + 1];
+  float len = length(r);
+  r /= len;
+  d /= len;
+
+  vec3 t = 2.0f * (r.w * d.xyz - d.w * r.xyz + cross(r.xyz, d.xyz));
+  vec3 vPrime = posToVert
+    + 2.0f * cross(r.xyz, cross(r.xyz, posToVert) + r.w * posToVert) + t;
+  vec3 normalPrime = normalToVert
+    + 2.0f * cross(r.xyz, cross(r.xyz, normalToVert) + r.w * normalToVert);
+#elif defined(SKINNED)
+  // linear blend skinning. WB takes bind space to model space; unused
+  // influences read bone 0 with weight 0, for nothing
+  ivec4 idxs = ivec4(idxsToVert);
+  mat4 B = weightsToVert.x * WB[idxs.x]
+    + weightsToVert.y * WB[idxs.y]
+    + weightsToVert.z * WB[idxs.z]
+    + weightsToVert.w * WB[idxs.w];
+
+  // Assuming no non-uniform scaling or shearing
+  vec3 vPrime = vec3(B * vec4(posToVert, 1.0f));
+  vec3 normalPrime = mat3(B) * normalToVert;
+#else
+  vec3 vPrime = posToVert;
+  vec3 normalPrime = normalToVert;
+#endif
+
+#ifdef SKIN_CACHE
+  skinnedPos = vPrime;
+  skinnedNormal = normalPrime;
+#else
   gl_Position = PV * M * vec4(vPrime, 1.0f);
   normalToFrag = vec3(normalize(normalM * vec4(normalPrime, 0.0f)));
   posToFrag = vec3(M * vec4(vPrime, 1.0f));
   texCoordToFrag = texCoordToVert;
+#endif
 }
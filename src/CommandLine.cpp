@@ -4,6 +4,14 @@
 #include "Scene/Model/parsing.hpp"
 #include <iostream>
 
+static const std::string tokCrowd = "crowd";
+static const std::string tokBench = "bench";
+static const std::string tokDualQuaternion = "dqs";
+static const std::string tokCPUSkinning = "cpuskin";
+static const std::string tokResample = "resample";
+static const std::string tokCompress = "compress";
+static const std::string tokMaxBones = "maxbones";
+
 static std::string fullyQualify(const std::string & prefix,
                                 const std::string & s,
                                 const std::string & suffix)
@@ -16,7 +24,61 @@ dmp::CommandLine::CommandLine(int argc, char ** argv)
   using namespace boost;
   std::string prefix = std::string(modelDir) + "/";
 
-  if (argc < 2)
+  // "crowd N", "bench", "dqs", "cpuskin", "resample HZ", "compress
+  // TOLERANCE" and "maxbones N" can go anywhere; pull them out before the
+  // positional arguments
+  std::vector<std::string> args;
+  for (int i = 1; i < argc; ++i)
+    {
+      if (argv[i] == tokCrowd && i + 1 < argc)
+        {
+          auto size = stoi(std::string(argv[i + 1]));
+          expect("crowd size not negative", size >= 0);
+          crowdSize = (size_t) size;
+          ++i;
+        }
+      else if (argv[i] == tokBench)
+        {
+          bench = true;
+        }
+      else if (argv[i] == tokDualQuaternion)
+        {
+          dualQuaternion = true;
+        }
+      else if (argv[i] == tokCPUSkinning)
+        {
+          cpuSkinning = true;
+        }
+      else if (argv[i] == tokResample && i + 1 < argc)
+        {
+          resampleHz = stof(std::string(argv[i + 1]));
+          expect("resample rate not negative", resampleHz >= 0.0f);
+          ++i;
+        }
+      else if (argv[i] == tokCompress && i + 1 < argc)
+        {
+          compressTolerance = stof(std::string(argv[i + 1]));
+          expect("compress tolerance not negative", compressTolerance >= 0.0f);
+          ++i;
+        }
+      else if (argv[i] == tokMaxBones && i + 1 < argc)
+        {
+          auto bones = stoi(std::string(argv[i + 1]));
+          expect("max bones not negative", bones >= 0);
+          maxBones = (size_t) bones;
+          ++i;
+        }
+      else
+        {
+          args.push_back(argv[i]);
+        }
+    }
+
+  // a resampled clip plays from its table, and never from compressed keys
+  expect("resample or compress the clip, not both",
+         resampleHz == 0.0f || compressTolerance == 0.0f);
+
+  if (args.empty())
     {
       ifDebug(std::cerr << "using default asset files: wasp and waspwalk" << std::endl);
       skinPath = fullyQualify(prefix, "wasp", ".skin");
@@ -27,10 +89,10 @@ dmp::CommandLine::CommandLine(int argc, char ** argv)
     }
 
   std::string dataStr = "";
-  for (int i = 1; i < argc; ++i)
+  for (const auto & curr : args)
     {
       dataStr += " ";
-      dataStr += argv[i];
+      dataStr += curr;
     }
 
   auto sep = whitespaceSeparator;
@@ -60,9 +122,9 @@ dmp::CommandLine::CommandLine(int argc, char ** argv)
   skinPath = fullyQualify(prefix, name, ".skin");
   skelPath = fullyQualify(prefix, name, ".skel");
 
-  if (argc > 2)
+  if (args.size() > 1)
     {
-      int morphCount = stoi(std::string(argv[2]));
+      int morphCount = stoi(args[1]);
       morphPaths.reserve((size_t) morphCount);
       for (size_t i = 0; i < (size_t) morphCount; ++i)
         {
@@ -88,5 +150,11 @@ dmp::CommandLine::CommandLine(int argc, char ** argv)
             << "skin = " << skinPath << std::endl
             << "skel = " << skelPath << std::endl
             << "|morphs| = " << morphPaths.size() << std::endl
-            << "anim = " << animPath << std::endl;
+            << "anim = " << animPath << std::endl
+            << "crowd = " << crowdSize << std::endl
+            << "bench = " << bench << std::endl
+            << "dqs = " << dualQuaternion << std::endl
+            << "cpuskin = " << cpuSkinning << std::endl
+            << "resample = " << resampleHz << std::endl
+            << "compress = " << compressTolerance << std::endl;
 }
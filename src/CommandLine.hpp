@@ -13,6 +13,13 @@ namespace dmp
     std::string skelPath;
     std::vector<std::string> morphPaths;
     std::string animPath;
+    size_t crowdSize = 0;
+    bool bench = false;
+    bool dualQuaternion = false;
+    bool cpuSkinning = false;
+    float resampleHz = 0.0f; // 0 keeps the clip's exact curves
+    float compressTolerance = 0.0f; // 0 keeps every keyframe
+    size_t maxBones = 0; // per skin part, 0 for all an object holds
 
     CommandLine(int argc, char ** argv);
 
@@ -20,6 +27,10 @@ namespace dmp
     bool hasSkel() const {return skelPath != "";}
     bool hasMorphs() const {return morphPaths.size() > 0;}
     bool hasAnim() const {return animPath != "";}
+    bool hasCrowd() const {return crowdSize > 0;}
+    bool hasResample() const {return resampleHz > 0.0f;}
+    bool hasCompress() const {return compressTolerance > 0.0f;}
+    bool hasMaxBones() const {return maxBones > 0;}
   };
 }
 
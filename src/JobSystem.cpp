@@ -0,0 +1,124 @@
+#include "JobSystem.hpp"
+#include "util.hpp"
+
+dmp::JobSystem::JobSystem(size_t numWorkers)
+  : mNextChunk(0)
+{
+  initJobSystem(numWorkers);
+}
+
+void dmp::JobSystem::initJobSystem(size_t numWorkers)
+{
+  if (numWorkers == 0)
+    {
+      auto hw = (size_t) std::thread::hardware_concurrency();
+      numWorkers = (hw > 1) ? hw - 1 : 0;
+    }
+
+  mWorkers.reserve(numWorkers);
+  for (size_t i = 0; i < numWorkers; ++i)
+    {
+      mWorkers.emplace_back([this]() {workerLoop();});
+    }
+}
+
+dmp::JobSystem::~JobSystem()
+{
+  {
+    std::lock_guard<std::mutex> lock(mMutex);
+    mQuit = true;
+  }
+  mWake.notify_all();
+
+  for (auto & curr : mWorkers)
+    {
+      curr.join();
+    }
+}
+
+void dmp::JobSystem::parallelFor(size_t count,
+                                 size_t grain,
+                                 const RangeFn & fn)
+{
+  expect("grain not 0", grain > 0);
+  if (count == 0) return;
+
+  auto numChunks = (count + grain - 1) / grain;
+  if (mWorkers.empty() || numChunks == 1)
+    {
+      fn(0, count);
+      return;
+    }
+
+  {
+    std::lock_guard<std::mutex> lock(mMutex);
+    mJob = &fn;
+    mCount = count;
+    mGrain = grain;
+    mNumChunks = numChunks;
+    mNextChunk = 0;
+    mError = nullptr;
+    mBusyWorkers = mWorkers.size();
+    ++mGeneration;
+  }
+  mWake.notify_all();
+
+  runChunks();
+
+  // every worker has to check in before the job can be torn down, even the
+  // ones that found no chunks left
+  std::unique_lock<std::mutex> lock(mMutex);
+  mDone.wait(lock, [this]() {return mBusyWorkers == 0;});
+  mJob = nullptr;
+
+  if (mError)
+    {
+      auto err = mError;
+      mError = nullptr;
+      std::rethrow_exception(err);
+    }
+}
+
+void dmp::JobSystem::runChunks()
+{
+  while (true)
+    {
+      auto chunk = mNextChunk++;
+      if (chunk >= mNumChunks) return;
+
+      auto begin = chunk * mGrain;
+      auto end = std::min(begin + mGrain, mCount);
+      try
+        {
+          (*mJob)(begin, end);
+        }
+      catch (...)
+        {
+          std::lock_guard<std::mutex> lock(mMutex);
+          if (!mError) mError = std::current_exception();
+        }
+    }
+}
+
+void dmp::JobSystem::workerLoop()
+{
+  size_t seen = 0;
+  while (true)
+    {
+      {
+        std::unique_lock<std::mutex> lock(mMutex);
+        mWake.wait(lock, [this, seen]()
+                   {
+                     return mQuit || mGeneration != seen;
+                   });
+        if (mQuit) return;
+        seen = mGeneration;
+      }
+
+      runChunks();
+
+      std::lock_guard<std::mutex> lock(mMutex);
+      --mBusyWorkers;
+      if (mBusyWorkers == 0) mDone.notify_all();
+    }
+}
@@ -0,0 +1,65 @@
+#ifndef DMP_JOBSYSTEM_HPP
+#define DMP_JOBSYSTEM_HPP
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <exception>
+
+namespace dmp
+{
+  // A fixed pool of worker threads for data parallel loops. The calling
+  // thread works too, so a pool with 0 workers just runs jobs inline
+  class JobSystem
+  {
+  public:
+    JobSystem() = delete;
+    JobSystem(const JobSystem &) = delete;
+    JobSystem & operator=(const JobSystem &) = delete;
+    // workers hold this, so it can't move
+    JobSystem(JobSystem &&) = delete;
+    JobSystem & operator=(JobSystem &&) = delete;
+
+    // numWorkers = 0 picks one worker per hardware thread, less the caller's
+    JobSystem(size_t numWorkers);
+    ~JobSystem();
+
+    typedef std::function<void(size_t begin, size_t end)> RangeFn;
+
+    // Calls fn(begin, end) on chunks of at most grain indices covering
+    // [0, count), spread over the workers and the calling thread. Returns
+    // once every chunk has run. The first exception thrown by a chunk is
+    // rethrown here. Not reentrant: fn must not call parallelFor
+    void parallelFor(size_t count, size_t grain, const RangeFn & fn);
+
+    // workers + the calling thread
+    size_t askNumThreads() const {return mWorkers.size() + 1;}
+  private:
+    void initJobSystem(size_t numWorkers);
+    void workerLoop();
+    void runChunks();
+
+    std::vector<std::thread> mWorkers;
+    std::mutex mMutex;
+    std::condition_variable mWake;
+    std::condition_variable mDone;
+
+    // the current job. Only written by parallelFor while every worker is
+    // idle
+    const RangeFn * mJob = nullptr;
+    size_t mCount = 0;
+    size_t mGrain = 1;
+    size_t mNumChunks = 0;
+    std::atomic<size_t> mNextChunk;
+    std::exception_ptr mError;
+
+    size_t mGeneration = 0;
+    size_t mBusyWorkers = 0;
+    bool mQuit = false;
+  };
+}
+
+#endif
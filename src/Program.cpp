@@ -239,6 +239,29 @@ dmp::Program::Program(int width, int height,
               mRenderOptions.drawNormals = !(mRenderOptions.drawNormals);
             },
             GLFW_KEY_N);
+  Keybind o(mWindow,
+            [&](Keybind &)
+            {
+              mRenderOptions.overlayWireframe
+                = !(mRenderOptions.overlayWireframe);
+            },
+            GLFW_KEY_O);
+  Keybind g(mWindow,
+            [&](Keybind &)
+            {
+              mRenderOptions.cacheSkinning = !(mRenderOptions.cacheSkinning);
+              std::cerr << "cache skinning? " << mRenderOptions.cacheSkinning
+                        << std::endl;
+            },
+            GLFW_KEY_G);
+  Keybind m(mWindow,
+            [&](Keybind &)
+            {
+              mRenderOptions.meshLOD = !(mRenderOptions.meshLOD);
+              std::cerr << "mesh LOD? " << mRenderOptions.meshLOD
+                        << std::endl;
+            },
+            GLFW_KEY_M);
   Keybind comma(mWindow,
                 [&](Keybind &)
                 {
@@ -416,7 +439,7 @@ dmp::Program::Program(int width, int height,
                GLFW_KEY_S);
 
   mKeybinds = {esc, up, down, right, left, pageUp, pageDown,
-               w, n, l, comma, period, one, two, three, four, five,
+               w, n, o, g, m, l, comma, period, one, two, three, four, five,
                i, j, k, tab, c, f, s};
 
   mWindow.keyFn = [&mKeybinds=mKeybinds](GLFWwindow * w,
@@ -479,7 +502,7 @@ int dmp::Program::run()
         }
       else
         {
-          mScene.update(mTimer.deltaTime() * mTimeScale);
+          mScene.update(mTimer.deltaTime() * mTimeScale, mRenderer.askP());
           mRenderer.render(mScene, mTimer, mRenderOptions);
           mDOFWindow->pollEvents();
           mWindow.swapBuffer();
@@ -2,6 +2,7 @@
 #include "util.hpp"
 
 #include <iostream>
+#include <glm/gtc/constants.hpp>
 
 dmp::Quaternion::Quaternion(float theta, dmp::RotationAxis a)
 {
@@ -219,3 +220,175 @@ dmp::Quaternion dmp::catmullRom(float t,
   auto q21 = slerp(t / 2.0f, q11, q12, false);
   return slerp(t, q20, q21, false);
 }
+
+dmp::Quaternion dmp::eulerZYX(const glm::vec3 & angles)
+{
+  // qz * qy * qx, multiplied out
+  auto cx = glm::cos(0.5f * angles.x);
+  auto sx = glm::sin(0.5f * angles.x);
+  auto cy = glm::cos(0.5f * angles.y);
+  auto sy = glm::sin(0.5f * angles.y);
+  auto cz = glm::cos(0.5f * angles.z);
+  auto sz = glm::sin(0.5f * angles.z);
+
+  Quaternion q;
+  q.real = cz * cy * cx + sz * sy * sx;
+  q.imaginary = {cz * cy * sx - sz * sy * cx,
+                 cz * sy * cx + sz * cy * sx,
+                 sz * cy * cx - cz * sy * sx};
+  return q;
+}
+
+glm::vec3 dmp::toEulerZYX(const Quaternion & q)
+{
+  auto w = q.q0();
+  auto x = q.q1();
+  auto y = q.q2();
+  auto z = q.q3();
+
+  auto sinY = glm::clamp(2.0f * (w * y - x * z), -1.0f, 1.0f);
+  return {atan2f(2.0f * (w * x + y * z), 1.0f - 2.0f * (x * x + y * y)),
+          asinf(sinY),
+          atan2f(2.0f * (w * z + x * y), 1.0f - 2.0f * (y * y + z * z))};
+}
+
+glm::vec3 dmp::toEulerZYX(const Quaternion & q, const glm::vec3 & near)
+{
+  auto pi = glm::pi<float>();
+  auto turn = glm::two_pi<float>();
+
+  auto a = toEulerZYX(q);
+  glm::vec3 b = {a.x + pi, pi - a.y, a.z + pi};
+
+  auto wrap = [&](glm::vec3 e)
+    {
+      for (int i = 0; i < 3; ++i)
+        {
+          e[i] -= turn * roundf((e[i] - near[i]) / turn);
+        }
+      return e;
+    };
+  a = wrap(a);
+  b = wrap(b);
+
+  auto da = glm::dot(a - near, a - near);
+  auto db = glm::dot(b - near, b - near);
+  return (da <= db) ? a : b;
+}
+
+dmp::Quaternion dmp::conjugate(const Quaternion & q)
+{
+  Quaternion c;
+  c.real = q.real;
+  c.imaginary = -q.imaginary;
+  return c;
+}
+
+glm::vec3 dmp::rotate(const Quaternion & q, const glm::vec3 & v)
+{
+  auto t = 2.0f * glm::cross(q.imaginary, v);
+  return v + q.real * t + glm::cross(q.imaginary, t);
+}
+
+dmp::Quaternion dmp::toQuaternion(const glm::mat3 & R)
+{
+  // R[col][row]; the branch keeps s away from 0
+  Quaternion q;
+  auto trace = R[0][0] + R[1][1] + R[2][2];
+  if (trace > 0.0f)
+    {
+      auto s = 2.0f * sqrtf(trace + 1.0f);
+      q.real = 0.25f * s;
+      q.imaginary = {(R[1][2] - R[2][1]) / s,
+                     (R[2][0] - R[0][2]) / s,
+                     (R[0][1] - R[1][0]) / s};
+    }
+  else if (R[0][0] > R[1][1] && R[0][0] > R[2][2])
+    {
+      auto s = 2.0f * sqrtf(1.0f + R[0][0] - R[1][1] - R[2][2]);
+      q.real = (R[1][2] - R[2][1]) / s;
+      q.imaginary = {0.25f * s,
+                     (R[1][0] + R[0][1]) / s,
+                     (R[2][0] + R[0][2]) / s};
+    }
+  else if (R[1][1] > R[2][2])
+    {
+      auto s = 2.0f * sqrtf(1.0f + R[1][1] - R[0][0] - R[2][2]);
+      q.real = (R[2][0] - R[0][2]) / s;
+      q.imaginary = {(R[1][0] + R[0][1]) / s,
+                     0.25f * s,
+                     (R[2][1] + R[1][2]) / s};
+    }
+  else
+    {
+      auto s = 2.0f * sqrtf(1.0f + R[2][2] - R[0][0] - R[1][1]);
+      q.real = (R[0][1] - R[1][0]) / s;
+      q.imaginary = {(R[2][0] + R[0][2]) / s,
+                     (R[2][1] + R[1][2]) / s,
+                     0.25f * s};
+    }
+  return q.normalize();
+}
+
+dmp::Quaternion dmp::nlerp(float t,
+                           const Quaternion & lhs,
+                           const Quaternion & rhs)
+{
+  auto sign = (lhs.real * rhs.real
+               + glm::dot(lhs.imaginary, rhs.imaginary) < 0.0f) ? -1.0f : 1.0f;
+
+  Quaternion q;
+  q.real = (1.0f - t) * lhs.real + t * sign * rhs.real;
+  q.imaginary = (1.0f - t) * lhs.imaginary + t * sign * rhs.imaginary;
+  return q.normalize();
+}
+
+glm::mat4 dmp::rigidTransform(const Quaternion & q, const glm::vec3 & t)
+{
+  auto w = q.q0();
+  auto x = q.q1();
+  auto y = q.q2();
+  auto z = q.q3();
+
+  auto xx = x * x;
+  auto yy = y * y;
+  auto zz = z * z;
+  auto xy = x * y;
+  auto xz = x * z;
+  auto yz = y * z;
+  auto wx = w * x;
+  auto wy = w * y;
+  auto wz = w * z;
+
+  // column major
+  return
+    {
+      1.0f - 2.0f * (yy + zz), 2.0f * (xy + wz), 2.0f * (xz - wy), 0.0f,
+      2.0f * (xy - wz), 1.0f - 2.0f * (xx + zz), 2.0f * (yz + wx), 0.0f,
+      2.0f * (xz + wy), 2.0f * (yz - wx), 1.0f - 2.0f * (xx + yy), 0.0f,
+      t.x, t.y, t.z, 1.0f
+    };
+}
+
+dmp::DualQuaternion dmp::toDualQuaternion(const glm::mat4 & rigid)
+{
+  DualQuaternion dq;
+  dq.real = toQuaternion(glm::mat3(rigid));
+
+  // 0.5 * (0, t) * real, written out; operator* would normalize it
+  auto t = 0.5f * glm::vec3(rigid[3]);
+  const auto & r = dq.real;
+  dq.dual.real = -glm::dot(t, r.imaginary);
+  dq.dual.imaginary = r.real * t + glm::cross(t, r.imaginary);
+  return dq;
+}
+
+glm::vec3 dmp::transform(const DualQuaternion & dq, const glm::vec3 & p)
+{
+  // the translation is 2 * dual * conjugate(real)
+  const auto & r = dq.real;
+  const auto & d = dq.dual;
+  auto t = 2.0f * (r.real * d.imaginary - d.real * r.imaginary
+                   + glm::cross(r.imaginary, d.imaginary));
+  return rotate(r, p) + t;
+}
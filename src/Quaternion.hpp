@@ -62,6 +62,50 @@ namespace dmp
                         const Quaternion & q2,
                         const Quaternion & q3,
                         bool forceShortPath = true);
+
+  // Rotation about x by angles.x, then y, then z: the same rotation as
+  // rotate(z) * rotate(y) * rotate(x), in closed form
+  Quaternion eulerZYX(const glm::vec3 & angles);
+
+  // The inverse of eulerZYX, with y in [-pi/2, pi/2]
+  glm::vec3 toEulerZYX(const Quaternion & q);
+
+  // The Euler angles for q closest to near. Every rotation has two ZYX
+  // forms, and each angle can move by whole turns; picking the nearest
+  // keeps a joint continuous from frame to frame and its limits meaningful
+  glm::vec3 toEulerZYX(const Quaternion & q, const glm::vec3 & near);
+
+  // The inverse of a unit quaternion
+  Quaternion conjugate(const Quaternion & q);
+
+  // v rotated by the unit quaternion q
+  glm::vec3 rotate(const Quaternion & q, const glm::vec3 & v);
+
+  // The unit quaternion for the rotation matrix R
+  Quaternion toQuaternion(const glm::mat3 & R);
+
+  // Normalized lerp along the short path. Cheaper than slerp, and as good
+  // for the small angles between poses of one character
+  Quaternion nlerp(float t, const Quaternion & lhs, const Quaternion & rhs);
+
+  // Rotation by the unit quaternion q, then translation by t, as one
+  // matrix. Unlike the glm::mat4 conversion, q is not normalized first
+  glm::mat4 rigidTransform(const Quaternion & q, const glm::vec3 & t);
+
+  // A rigid transform as two quaternions: real is the rotation q, dual is
+  // 0.5 * (0, t) * q for the translation t. Blends of these, normalized,
+  // stay rigid where blends of matrices shrink
+  struct DualQuaternion
+  {
+    Quaternion real;
+    Quaternion dual;
+  };
+
+  // rigid must be a rotation then a translation, with no scale
+  DualQuaternion toDualQuaternion(const glm::mat4 & rigid);
+
+  // p moved by the unit dual quaternion dq
+  glm::vec3 transform(const DualQuaternion & dq, const glm::vec3 & p);
 }
 
 #endif
@@ -37,6 +37,50 @@ void dmp::Renderer::loadShaders(const std::string shaderName)
   mShaderProg.initShader(vertName.c_str(),
                          nullptr, nullptr, nullptr,
                          fragName.c_str());
+  mSkinnedProg.initShader(vertName.c_str(),
+                          nullptr, nullptr, nullptr,
+                          fragName.c_str(),
+                          {"SKINNED"});
+  mDualQuatProg.initShader(vertName.c_str(),
+                           nullptr, nullptr, nullptr,
+                           fragName.c_str(),
+                           {"SKINNED", "DUAL_QUATERNION"});
+
+  // vertex stage only; the rasterizer discards everything
+  mSkinCacheProg.initShader(vertName.c_str(),
+                            nullptr, nullptr, nullptr,
+                            nullptr,
+                            {"SKINNED", "SKIN_CACHE"},
+                            {"skinnedPos", "skinnedNormal"});
+  mDualQuatCacheProg.initShader(vertName.c_str(),
+                                nullptr, nullptr, nullptr,
+                                nullptr,
+                                {"SKINNED", "DUAL_QUATERNION", "SKIN_CACHE"},
+                                {"skinnedPos", "skinnedNormal"});
+}
+
+const dmp::Shader & dmp::Renderer::programFor(const Object & obj,
+                                              bool cached) const
+{
+  if (!obj.isSkinned() || cached) return mShaderProg;
+  return obj.isDualQuaternion() ? mDualQuatProg : mSkinnedProg;
+}
+
+void dmp::Renderer::useProgram(const Shader & prog)
+{
+  glUseProgram(prog);
+  glUniformBlockBinding(prog,
+                        glGetUniformBlockIndex(prog, "PassConstants"),
+                        1);
+  glUniformBlockBinding(prog,
+                        glGetUniformBlockIndex(prog, "MaterialConstants"),
+                        2);
+  glUniformBlockBinding(prog,
+                        glGetUniformBlockIndex(prog, "ObjectConstants"),
+                        3);
+  glUniform1i(glGetUniformLocation(prog, "tex"),
+              texUnitAsInt(GL_TEXTURE0));
+  expectNoErrors("Use shader program");
 }
 
 void dmp::Renderer::initRenderer()
@@ -101,7 +145,6 @@ void dmp::Renderer::render(const Scene & scene,
   expectNoErrors("Clear prior to render");
 
   expect("there should be objects to draw", !scene.objects.empty());
-  size_t materialIndex = scene.objects[0]->materialIndex();
 
   // Pass constants
 
@@ -123,6 +166,7 @@ void dmp::Renderer::render(const Scene & scene,
   pc.V = scene.cameras[0].getV();
   pc.invP = glm::inverse(pc.V);
   pc.PV = pc.P * pc.V;
+  mPV = pc.PV;
   pc.invPV = glm::inverse(pc.PV);
   pc.E = scene.cameras[0].getE(pc.PV);
   pc.nearZ = nearZ;
@@ -131,21 +175,13 @@ void dmp::Renderer::render(const Scene & scene,
   pc.totalT = timer.time();
 
   mPassConstants->update(0, pc);
-
-  GLuint pcIdx = glGetUniformBlockIndex(mShaderProg, "PassConstants");
-  glUniformBlockBinding(mShaderProg, pcIdx, 1);
   mPassConstants->bind(1, 0);
 
-  // Material Constants
-
-  GLuint mcIdx = glGetUniformBlockIndex(mShaderProg, "MaterialConstants");
-  glUniformBlockBinding(mShaderProg, mcIdx, 2);
-  scene.materialConstants->bind(2, materialIndex);
+  if (ro.cacheSkinning) skinToCaches(scene);
 
-  // Object Constants
+  // Material Constants
 
-  GLuint ocIdx = glGetUniformBlockIndex(mShaderProg, "ObjectConstants");
-  glUniformBlockBinding(mShaderProg, ocIdx, 3);
+  scene.materialConstants->bind(2, scene.objects[0]->materialIndex());
 
   // TODO: this should be last
   glDepthMask(GL_FALSE);
@@ -156,12 +192,101 @@ void dmp::Renderer::render(const Scene & scene,
   glDepthMask(GL_TRUE);
 
 
-  glUseProgram(mShaderProg);
+  drawObjects(scene, ro);
+  if (scene.crowd) drawCrowd(*scene.crowd, scene, ro);
 
-  expectNoErrors("Bind shader program");
+  if (ro.overlayWireframe && !ro.drawWireframe)
+    {
+      glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
+      drawObjects(scene, ro);
+      glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+    }
 
+  if (ro.drawWireframe) glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+}
+
+// Objects that know where they are, and aren't anywhere in view
+static bool isCulled(const dmp::Object & obj, const glm::mat4 & PV)
+{
+  return obj.askWorldBounds().isOutside(PV);
+}
+
+void dmp::Renderer::skinToCaches(const Scene & scene)
+{
+  // the passes after all draw from the caches, so skinning costs the
+  // same however many of them there are
+  glEnable(GL_RASTERIZER_DISCARD);
+
+  const Shader * prog = nullptr;
   for (size_t i = 0; i < scene.objects.size(); ++i)
     {
+      auto & obj = *scene.objects[i];
+      if (!obj.isSkinned() || isCulled(obj, mPV)) continue;
+
+      auto next = obj.isDualQuaternion() ? &mDualQuatCacheProg
+        : &mSkinCacheProg;
+      if (next != prog)
+        {
+          // nothing here reads the pass, material or texture
+          prog = next;
+          glUseProgram(*prog);
+          glUniformBlockBinding(*prog,
+                                glGetUniformBlockIndex(*prog,
+                                                       "ObjectConstants"),
+                                3);
+        }
+
+      scene.objectConstants->bind(3, i);
+      obj.skinToCache();
+    }
+
+  glDisable(GL_RASTERIZER_DISCARD);
+  expectNoErrors("Skinning pre-pass");
+}
+
+// The level of detail obj draws at its size on screen, by its world box
+// where it has one, or else its bounding sphere moved by its M
+static size_t meshLevel(const dmp::Object & obj, const dmp::AnimationLOD & lod)
+{
+  if (obj.askNumLODs() == 1) return 0;
+
+  const auto & box = obj.askWorldBounds();
+  if (!box.isEmpty())
+    {
+      return lod.askMeshLevel(box.askCenter(), glm::length(box.askExtent()));
+    }
+
+  auto M = obj.getM();
+  auto center = glm::vec3(M * glm::vec4(obj.askBoundsCenter(), 1.0f));
+  auto scale = std::max(glm::length(glm::vec3(M[0])),
+                        std::max(glm::length(glm::vec3(M[1])),
+                                 glm::length(glm::vec3(M[2]))));
+  return lod.askMeshLevel(center, scale * obj.askBoundsRadius());
+}
+
+void dmp::Renderer::drawObjects(const Scene & scene, const RenderOptions & ro)
+{
+  auto cached = ro.cacheSkinning;
+  size_t materialIndex = scene.objects[0]->materialIndex();
+  scene.materialConstants->bind(2, materialIndex);
+
+  // objects are sorted by material, not by shader; the program only
+  // changes where objects that skin differently meet
+  const Shader * prog = &mShaderProg;
+  useProgram(*prog);
+
+  for (size_t i = 0; i < scene.objects.size(); ++i)
+    {
+      const auto & obj = *scene.objects[i];
+      if (isCulled(obj, mPV)) continue;
+
+      auto fromCache = cached && obj.isSkinned();
+      if (&programFor(obj, fromCache) != prog)
+        {
+          prog = &programFor(obj, fromCache);
+          useProgram(*prog);
+        }
+
       if (scene.objects[i]->materialIndex() != materialIndex)
         {
           materialIndex = scene.objects[i]->materialIndex();
@@ -171,17 +296,43 @@ void dmp::Renderer::render(const Scene & scene,
       glActiveTexture(GL_TEXTURE0);
       glBindTexture(GL_TEXTURE_2D,
                     scene.textures[scene.objects[i]->textureIndex()]);
-      glUniform1i(glGetUniformLocation(mShaderProg, "tex"),
-                  texUnitAsInt(GL_TEXTURE0));
 
 
       scene.objectConstants->bind(3, i);
 
       expectNoErrors("Set uniforms");
 
-      scene.objects[i]->bind();
-      scene.objects[i]->draw();
+      if (fromCache) obj.bindCache();
+      else obj.bind();
+      obj.draw(ro.meshLOD ? meshLevel(obj, scene.animationLOD) : 0);
     }
+}
 
-  if (ro.drawWireframe) glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+void dmp::Renderer::drawCrowd(Crowd & crowd,
+                              const Scene & scene,
+                              const RenderOptions & ro)
+{
+  // every instance shares the mesh, material and texture; only the
+  // ObjectConstants slot changes between draws of a part
+  for (size_t p = 0; p < crowd.askNumParts(); ++p)
+    {
+      const auto & obj = crowd.askObject(p);
+
+      useProgram((crowd.askSkinningMode() == SkinningMode::dualQuaternion)
+                 ? mDualQuatProg : programFor(obj));
+      scene.materialConstants->bind(2, obj.materialIndex());
+      glActiveTexture(GL_TEXTURE0);
+      glBindTexture(GL_TEXTURE_2D, scene.textures[obj.textureIndex()]);
+
+      expectNoErrors("Set crowd uniforms");
+
+      obj.bind();
+      for (size_t i = 0; i < crowd.askCount(); ++i)
+        {
+          if (crowd.askInstanceBounds(i).isOutside(mPV)) continue;
+
+          crowd.askConstants(p).bind(3, i);
+          obj.draw(ro.meshLOD ? crowd.askMeshLevel(i) : 0);
+        }
+    }
 }
@@ -13,6 +13,16 @@ namespace dmp
   {
     bool drawWireframe = false;
     bool drawNormals = false;
+
+    // a second pass, drawing the wireframe over the shaded scene
+    bool overlayWireframe = false;
+
+    // skins each skinned object once a frame, before the passes, instead
+    // of in every pass that draws it
+    bool cacheSkinning = true;
+
+    // draws coarser levels of detail of what is small on screen
+    bool meshLOD = true;
   };
 
   class Renderer
@@ -31,13 +41,37 @@ namespace dmp
     void render(const Scene & scene,
                 const Timer & timer,
                 const RenderOptions & ro);
+
+    const glm::mat4 & askP() const {return mP;}
   private:
     void initRenderer();
     void loadShaders(const std::string shaderFile);
     void initPassConstants();
+    void drawCrowd(Crowd & crowd,
+                   const Scene & scene,
+                   const RenderOptions & ro);
+
+    // The skinning pre-pass: every skinned object in view into its cache
+    void skinToCaches(const Scene & scene);
+
+    // One pass over scene's objects. With ro.cacheSkinning, skinned
+    // objects draw from their caches
+    void drawObjects(const Scene & scene, const RenderOptions & ro);
+
+    // Binds prog's uniform blocks to the slots render fills, and its
+    // texture to unit 0
+    void useProgram(const Shader & prog);
 
     glm::mat4 mP;
+    glm::mat4 mPV; // this frame's, to cull by
     Shader mShaderProg;
+    Shader mSkinnedProg; // the same shader, skinning by the bone palette
+    Shader mDualQuatProg; // skinning by a dual quaternion palette
+    Shader mSkinCacheProg; // skinning only, into the cache
+    Shader mDualQuatCacheProg;
+
+    // The program obj draws with, from its cache if cached
+    const Shader & programFor(const Object & obj, bool cached = false) const;
 
     std::unique_ptr<UniformBuffer> mPassConstants;
   };
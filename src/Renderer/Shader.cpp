@@ -1,6 +1,7 @@
 #include "Shader.hpp"
 #include <fstream>
 #include <utility>
+#include <algorithm>
 #include <GL/glew.h>
 #include <iostream>
 
@@ -29,8 +30,29 @@ std::vector<char> dmp::Shader::loadGLSL(const std::string & path)
   return bytecodeIter->second;
 }
 
-static GLuint compileShader(std::vector<char> source, GLenum type)
+// GLSL wants #version before anything else, so the defines go right after
+// the first line
+static void insertDefines(std::vector<char> & source,
+                          const std::vector<std::string> & defines)
 {
+  if (defines.empty()) return;
+
+  std::string lines;
+  for (const auto & curr : defines)
+    {
+      lines += "#define " + curr + "\n";
+    }
+
+  auto eol = std::find(source.begin(), source.end(), '\n');
+  auto at = (eol == source.end()) ? source.begin() : eol + 1;
+  source.insert(at, lines.begin(), lines.end());
+}
+
+static GLuint compileShader(std::vector<char> source,
+                            GLenum type,
+                            const std::vector<std::string> & defines)
+{
+  insertDefines(source, defines);
   GLuint id = glCreateShader(type);
 
   auto sourcePtr = source.data();
@@ -63,17 +85,21 @@ dmp::Shader::Shader(const char * vertPath,
                     const char * geomPath,
                     const char * tescPath,
                     const char * tesePath,
-                    const char * fragPath)
+                    const char * fragPath,
+                    const std::vector<std::string> & defines,
+                    const std::vector<std::string> & feedback)
 {
   initShader(vertPath, geomPath,
              tescPath, tesePath,
-             fragPath);
+             fragPath, defines, feedback);
 }
 void dmp::Shader::initShader(const char * vertPath,
                              const char * geomPath,
                              const char * tescPath,
                              const char * tesePath,
-                             const char * fragPath)
+                             const char * fragPath,
+                             const std::vector<std::string> & defines,
+                             const std::vector<std::string> & feedback)
 {
   GLuint vertId = 0;
   GLuint geomId = 0;
@@ -85,35 +111,35 @@ void dmp::Shader::initShader(const char * vertPath,
   if (vertPath)
     {
       auto vertSrc = loadGLSL(vertPath);
-      vertId = compileShader(vertSrc, GL_VERTEX_SHADER);
+      vertId = compileShader(vertSrc, GL_VERTEX_SHADER, defines);
       expect("Load vertex shader", vertId != 0);
     }
 
   if (geomPath)
     {
       auto geomSrc = loadGLSL(geomPath);
-      geomId = compileShader(geomSrc, GL_GEOMETRY_SHADER);
+      geomId = compileShader(geomSrc, GL_GEOMETRY_SHADER, defines);
       expect("Load geometry shader", geomId != 0);
     }
 
   if (tescPath)
     {
       auto tescSrc = loadGLSL(tescPath);
-      tescId = compileShader(tescSrc, GL_TESS_CONTROL_SHADER);
+      tescId = compileShader(tescSrc, GL_TESS_CONTROL_SHADER, defines);
       expect("Load tess control shader", tescId != 0);
     }
 
   if (tesePath)
     {
       auto teseSrc = loadGLSL(tesePath);
-      teseId = compileShader(teseSrc, GL_TESS_EVALUATION_SHADER);
+      teseId = compileShader(teseSrc, GL_TESS_EVALUATION_SHADER, defines);
       expect("Load tess evaluation shader", teseId != 0);
     }
 
   if (fragPath)
     {
       auto fragSrc = loadGLSL(fragPath);
-      fragId = compileShader(fragSrc, GL_FRAGMENT_SHADER);
+      fragId = compileShader(fragSrc, GL_FRAGMENT_SHADER, defines);
       expect("Load fragment shader", fragId != 0);
     }
 
@@ -126,6 +152,20 @@ void dmp::Shader::initShader(const char * vertPath,
   if (tescPath) glAttachShader(mShaderProg, tescId);
   if (fragPath) glAttachShader(mShaderProg, fragId);
 
+  // only takes effect at link
+  if (!feedback.empty())
+    {
+      std::vector<const char *> names;
+      for (const auto & curr : feedback)
+        {
+          names.push_back(curr.c_str());
+        }
+      glTransformFeedbackVaryings(mShaderProg,
+                                  (GLsizei) names.size(),
+                                  names.data(),
+                                  GL_INTERLEAVED_ATTRIBS);
+    }
+
   glLinkProgram(mShaderProg);
 
   GLint result = GL_FALSE;
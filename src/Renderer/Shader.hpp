@@ -13,11 +13,18 @@ namespace dmp
   {
   public:
     Shader() {}
+
+    // Every stage is compiled with a #define for each name in defines, so
+    // that one source can build several variants. The last vertex stage's
+    // outputs named in feedback are captured by transform feedback,
+    // interleaved in that order
     Shader(const char * vertPath,
            const char * geomPath,
            const char * tescPath,
            const char * tesePath,
-           const char * fragPath);
+           const char * fragPath,
+           const std::vector<std::string> & defines = {},
+           const std::vector<std::string> & feedback = {});
 
     operator GLuint() const
     {
@@ -26,6 +33,9 @@ namespace dmp
       return mShaderProg;
     }
 
+    // True once initShader has succeeded
+    bool isValid() const {return mShaderProg != 0;}
+
     ~Shader()
     {
       if (mShaderProg != 0)
@@ -38,7 +48,9 @@ namespace dmp
                     const char * geomPath,
                     const char * tescPath,
                     const char * tesePath,
-                    const char * fragPath);
+                    const char * fragPath,
+                    const std::vector<std::string> & defines = {},
+                    const std::vector<std::string> & feedback = {});
   private:
     static std::map<const std::string, std::vector<char>> memo;
     static std::vector<char> loadGLSL(const std::string & path);
@@ -30,6 +30,32 @@ void dmp::UniformBuffer::update(size_t index, GLvoid * data)
   expectNoErrors("Update buffer");
 }
 
+void dmp::UniformBuffer::update(size_t index, GLvoid * data, size_t size)
+{
+  expect("index in range", (GLsizei) index < mNumElems);
+  expect("size in element", size <= (size_t) mElemSize);
+  glBindBuffer(GL_UNIFORM_BUFFER, mUBO);
+  glBufferSubData(GL_UNIFORM_BUFFER,
+                  (GLsizeiptr) (index * (size_t) mElemSize),
+                  (GLsizeiptr) size,
+                  data);
+  glBindBuffer(GL_UNIFORM_BUFFER, 0);
+  expectNoErrors("Update buffer prefix");
+}
+
+void dmp::UniformBuffer::update(size_t first, size_t count,
+                                const GLvoid * data)
+{
+  expect("range in bounds", (GLsizei) (first + count) <= mNumElems);
+  glBindBuffer(GL_UNIFORM_BUFFER, mUBO);
+  glBufferSubData(GL_UNIFORM_BUFFER,
+                  (GLsizeiptr) (first * (size_t) mElemSize),
+                  (GLsizeiptr) (count * (size_t) mElemSize),
+                  data);
+  glBindBuffer(GL_UNIFORM_BUFFER, 0);
+  expectNoErrors("Update buffer range");
+}
+
 void dmp::UniformBuffer::bind(size_t blockIndex, size_t bufferIndex)
 {
   expect("bufferIndex in range", bufferIndex < (size_t) mNumElems);
@@ -18,6 +18,15 @@ namespace dmp
 
     UniformBuffer(size_t elems, size_t elemSize);
     void update(size_t index, GLvoid * data);
+
+    // Updates only the first size bytes of element index, for elements
+    // whose tail nothing reads
+    void update(size_t index, GLvoid * data, size_t size);
+
+    // Updates count elements starting at first with one upload. data holds
+    // them back to back at askElemSize() stride
+    void update(size_t first, size_t count, const GLvoid * data);
+    size_t askElemSize() const {return (size_t) mElemSize;}
     void bind(size_t blockIndex, size_t bufferIndex);
     // TODO: void initializeData(std::vector<foo> data);
   private:
@@ -6,6 +6,11 @@
 #include <glm/gtc/constants.hpp>
 #include "config.hpp"
 
+// indices into the materials and textures build() fills
+static const size_t matRuby = 0;
+static const size_t matPearl = 1;
+static const size_t texNone = 0;
+
 void dmp::Scene::build(TransformFn cameraFn,
                        TransformFn lightFn,
                        TransformFn quatFn,
@@ -15,10 +20,10 @@ void dmp::Scene::build(TransformFn cameraFn,
   graph = std::make_unique<Branch>();
 
   std::string notex = "";
-  textures.emplace_back(notex);
+  textures.emplace_back(notex); // texNone
   Object::sortByMaterial(objects);
 
-  materials.push_back( // Ruby = 0
+  materials.push_back( // matRuby
     {
       {
         0.1745f, 0.01175f, 0.01175f, 1.0f
@@ -31,7 +36,7 @@ void dmp::Scene::build(TransformFn cameraFn,
       },
       0.6f
     });
-  materials.push_back( // Pearl = 1
+  materials.push_back( // matPearl
     {
       {
         0.25f, 0.20725f, 0.20725f, 1.0f
@@ -103,7 +108,7 @@ void dmp::Scene::build(TransformFn cameraFn,
    glm::vec4 max(0.2f, 0.5f, 0.1f, 1.0f);
    glm::vec4 min = -max;
 
-   Object build1(Cube, min, max, 1, 0);
+   Object build1(Cube, min, max, matPearl, texNone);
    auto staticBoxOne = [=](glm::mat4 & M, Quaternion & q, float)
      {
        return staticQuatFn(M, q, 0.0f);
@@ -112,7 +117,7 @@ void dmp::Scene::build(TransformFn cameraFn,
    auto boxOne = graph->transform(staticBoxOne);
    objects.push_back(boxOne->insert(build1));
 
-   Object build2(Cube, min, max, 1, 0);
+   Object build2(Cube, min, max, matPearl, texNone);
    auto staticBoxTwo = [=](glm::mat4 & M, Quaternion & q, float)
      {
        return staticQuatFn(M, q, 0.25f);
@@ -121,7 +126,7 @@ void dmp::Scene::build(TransformFn cameraFn,
    auto boxTwo = graph->transform(staticBoxTwo);
    objects.push_back(boxTwo->insert(build2));
 
-   Object build3(Cube, min, max, 1, 0);
+   Object build3(Cube, min, max, matPearl, texNone);
    auto staticBoxThree = [=](glm::mat4 & M, Quaternion & q, float)
      {
        return staticQuatFn(M, q, 0.5f);
@@ -130,7 +135,7 @@ void dmp::Scene::build(TransformFn cameraFn,
    auto boxThree = graph->transform(staticBoxThree);
    objects.push_back(boxThree->insert(build3));
 
-   Object build4(Cube, min, max, 1, 0);
+   Object build4(Cube, min, max, matPearl, texNone);
    auto staticBoxFour = [=](glm::mat4 & M, Quaternion & q, float)
      {
        return staticQuatFn(M, q, 0.75f);
@@ -139,7 +144,7 @@ void dmp::Scene::build(TransformFn cameraFn,
    auto boxFour = graph->transform(staticBoxFour);
    objects.push_back(boxFour->insert(build4));
 
-   Object build5(Cube, min, max, 1, 0);
+   Object build5(Cube, min, max, matPearl, texNone);
    auto staticBoxFive = [=](glm::mat4 & M, Quaternion & q, float)
      {
        return staticQuatFn(M, q, 1.0f);
@@ -148,11 +153,19 @@ void dmp::Scene::build(TransformFn cameraFn,
    auto boxFive = graph->transform(staticBoxFive);
    objects.push_back(boxFive->insert(build5));
 
-   Object buildLerp(Cube, min, max, 0, 0);
+   Object buildLerp(Cube, min, max, matRuby, texNone);
    auto lerpBox = graph->transform(quatFn);
    dynamicBox = lerpBox->insert(buildLerp);
    objects.push_back(dynamicBox);
 
+   // a crowd stands in for the one character, otherwise the character
+   // updates only as often as animation lod says
+   if (c.hasSkin() && c.hasSkel() && !c.hasCrowd())
+     {
+       model = std::make_unique<Model>(c, objects, matPearl, texNone);
+       if (c.hasAnim()) model->tellAnimationLOD(&animationLOD);
+     }
+
    objectConstants
      = std::make_unique<UniformBuffer>(objects.size(),
                                        ObjectConstants::std140Size());
@@ -162,29 +175,50 @@ void dmp::Scene::build(TransformFn cameraFn,
 
   skybox = std::make_unique<Skybox>(sb);
 
+  jobs = std::make_unique<JobSystem>(0);
+
+  // the crowd's instances share one mesh, so only the character can
+  // skin into its own buffers
+  if (model && c.cpuSkinning) model->skinOnCPU(jobs.get());
+
+  if (c.hasCrowd())
+    {
+      crowd = std::make_unique<Crowd>(c, c.crowdSize, matPearl, texNone);
+      ifDebug(std::cerr << "crowd of " << crowd->askCount() << " on "
+              << jobs->askNumThreads() << " threads" << std::endl);
+    }
+
   graph->update(0.0f, glm::mat4(), true);
 }
 
-void dmp::Scene::update(float deltaT)
+void dmp::Scene::update(float deltaT, const glm::mat4 & P)
 {
   expect("Object constant buffer not null",
          objectConstants);
 
   graph->update(deltaT);
 
+  // cameras first, so animation lod sees where this frame looks from
+  for (auto & curr : cameras)
+    {
+      curr.update();
+    }
+  animationLOD.tellView(cameras[0].getV(), P);
+  if (model) model->update(deltaT, glm::mat4(), false);
+
   for (size_t i = 0; i < objects.size(); ++i)
     {
       if (objects[i]->isDirty())
         {
-          objectConstants->update(i, objects[i]->getObjectConstants());
+          // only the bones the object uses, not all maxPaletteBones
+          objectConstants->update(i,
+                                  objects[i]->getObjectConstants(),
+                                  objects[i]->askConstantsSize());
           objects[i]->setClean();
         }
     }
 
-  for (auto & curr : cameras)
-    {
-      curr.update();
-    }
+  if (crowd) crowd->update(deltaT, *jobs, animationLOD);
 }
 
 void dmp::Scene::free()
@@ -199,5 +233,7 @@ void dmp::Scene::free()
       curr.freeTexture();
     }
 
+  if (crowd) crowd->free();
+
   skybox->freeSkybox();
 }
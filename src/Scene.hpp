@@ -8,6 +8,9 @@
 #include "Scene/Graph.hpp"
 #include "Scene/Camera.hpp"
 #include "Scene/Skybox.hpp"
+#include "Scene/Crowd.hpp"
+#include "Scene/Model.hpp"
+#include "JobSystem.hpp"
 #include "Renderer/UniformBuffer.hpp"
 #include "Renderer/Texture.hpp"
 #include "CommandLine.hpp"
@@ -25,6 +28,10 @@ namespace dmp
     std::unique_ptr<UniformBuffer> objectConstants;
     std::unique_ptr<Branch> graph;
     std::unique_ptr<Skybox> skybox;
+    std::unique_ptr<JobSystem> jobs;
+    std::unique_ptr<Crowd> crowd;
+    std::unique_ptr<Model> model;
+    AnimationLOD animationLOD;
 
     Object * dynamicBox = nullptr;
 
@@ -33,7 +40,8 @@ namespace dmp
                TransformFn quatFn,
                TransformFn staticQuatFn,
                const CommandLine & cmd);
-    void update(float deltaT);
+    // P is the renderer's projection, for animation lod
+    void update(float deltaT, const glm::mat4 & P);
     void free();
   };
 }
@@ -614,13 +614,13 @@ void dmp::Cloth::update(glm::mat4 M, float deltaT)
 
   // Now that the particles have moved, we need to update the Object
 
-  auto updateFn = [&](ObjectVertex * data,
+  auto updateFn = [&](DynamicVertex * data,
                       size_t numElems)
     {
       for (size_t i = 0; i < numElems; ++i)
         {
           data[i].position = mParticles[i].pos;
-          data[i].normal = mParticles[i].normal;
+          data[i].tellNormal(mParticles[i].normal);
         }
     };
   mObject->updateVertices(updateFn);
@@ -0,0 +1,310 @@
+#include "Crowd.hpp"
+#include "../JobSystem.hpp"
+#include <glm/gtc/matrix_transform.hpp>
+
+// instances per job. Each is a full evaluate + FK + palette, so this is
+// plenty to amortize the dispatch
+static const size_t crowdGrain = 16;
+static const float crowdSpacing = 4.0f;
+static const float crowdPoseQuantum = 1.0f / 120.0f;
+
+// std140 offsets of the ObjectConstants members
+static const size_t offsetM = 0;
+static const size_t offsetNormalM = 64;
+static const size_t offsetWB = 128;
+
+dmp::Crowd::Crowd(const CommandLine & c,
+                  size_t count,
+                  size_t matIdx,
+                  size_t texIdx)
+{
+  initCrowd(c, count, matIdx, texIdx);
+}
+
+void dmp::Crowd::initCrowd(const CommandLine & c,
+                           size_t count,
+                           size_t matIdx,
+                           size_t texIdx)
+{
+  expect("crowd has a skin", c.hasSkin());
+  expect("crowd has a skeleton", c.hasSkel());
+  expect("crowd has an animation", c.hasAnim());
+  expect("crowd not empty", count > 0);
+
+  mSkin = std::make_unique<Skin>(c.skinPath,
+                                 c.hasMaxBones() ? c.maxBones
+                                 : maxPaletteBones);
+  mRig = Rig::load(c.skelPath);
+  mAnimation = loadClip(c.animPath, c.resampleHz, c.compressTolerance);
+  mSkin->buildObjects(matIdx, texIdx);
+  mSkin->buildLODs();
+
+  expect("skin binds every joint",
+         mSkin->askBindings().size() == mRig->askNumJoints());
+
+  // a square grid centered on the origin, clocks spread by the golden
+  // ratio so neighbours are out of step
+  auto side = (size_t) ceilf(sqrtf((float) count));
+  auto half = 0.5f * crowdSpacing * (float) (side - 1);
+  auto duration = mAnimation->askDuration();
+  mInstances.resize(count);
+  for (size_t i = 0; i < count; ++i)
+    {
+      glm::vec3 pos = {crowdSpacing * (float) (i % side) - half,
+                       0.0f,
+                       crowdSpacing * (float) (i / side) - half};
+      mInstances[i].M = glm::translate(glm::mat4(), pos);
+      mInstances[i].timeOffset = duration * fmodf((float) i * 0.618034f, 1.0f);
+    }
+
+  mRestPose = mAnimation->askRestPose();
+  mPoses.assign(count, mRestPose);
+  tellPoseCacheQuantum(crowdPoseQuantum);
+
+  AnimationLOD::boundingSphere(mSkin->askVerts(),
+                               mBoundsCenter,
+                               mBoundsRadius);
+  mDue.assign(count, false);
+  mFramesLeft.assign(count, 0);
+  mMeshLevels.assign(count, 0);
+  mInstanceBounds.resize(count);
+  mTargetTimes.assign(count, 0.0f);
+  mTargets.resize(count);
+  mShown.resize(count);
+  mCurrent.resize(count * mRig->askNumJoints());
+
+  tellSkinningMode(c.dualQuaternion ? SkinningMode::dualQuaternion
+                   : SkinningMode::linear);
+}
+
+void dmp::Crowd::tellSkinningMode(SkinningMode mode)
+{
+  mSkin->tellSkinningMode(mode);
+  mStride = (mode == SkinningMode::dualQuaternion)
+    ? ObjectConstants::std140DualQuaternionSize()
+    : ObjectConstants::std140Size();
+  mStaging.resize(mSkin->askNumParts());
+  mConstants.clear();
+  for (auto & curr : mStaging)
+    {
+      curr.assign(mInstances.size() * mStride, 0);
+      mConstants.push_back(std::make_unique<UniformBuffer>(mInstances.size(),
+                                                           mStride));
+    }
+}
+
+void dmp::Crowd::update(float deltaT,
+                        JobSystem & jobs,
+                        const AnimationLOD & lod)
+{
+  mTimeElapsed += deltaT;
+  schedule(deltaT, lod);
+
+  if (mPoseCache)
+    {
+      updateCached(jobs);
+    }
+  else
+    {
+      jobs.parallelFor(mInstances.size(), crowdGrain,
+                       [this](size_t begin, size_t end)
+                       {
+                         updateRange(begin, end);
+                       });
+    }
+
+  for (size_t p = 0; p < mConstants.size(); ++p)
+    {
+      mConstants[p]->update(0, mInstances.size(), mStaging[p].data());
+    }
+  ++mFrame;
+}
+
+void dmp::Crowd::schedule(float deltaT, const AnimationLOD & lod)
+{
+  auto duration = mAnimation->askDuration();
+
+  mNumUpdated = 0;
+  for (size_t i = 0; i < mInstances.size(); ++i)
+    {
+      // every frame, due or not, from where the instance was last drawn
+      mMeshLevels[i] = (mFrame == 0) ? 0
+        : lod.askMeshLevel(instanceCenter(i), mBoundsRadius);
+
+      mDue[i] = mFramesLeft[i] == 0;
+      if (!mDue[i]) continue;
+      ++mNumUpdated;
+
+      // the first frame has no palette to step from, or to place the
+      // instance by
+      auto interval = (mFrame == 0) ? 1
+        : lod.askInterval(instanceCenter(i), mBoundsRadius);
+      auto frames = AnimationLOD::framesToUpdate(mFrame, i, interval);
+
+      // sample where the clock will be on the frame the steps land
+      auto now = mTimeElapsed + mInstances[i].timeOffset;
+      auto target = now + (float) (frames - 1) * deltaT;
+
+      // the root jumps back at the loop seam, stepping across it would
+      // slide the instance back over several frames instead
+      if (fmodf(target, duration) < fmodf(now, duration))
+        {
+          frames = 1;
+          target = now;
+        }
+
+      mFramesLeft[i] = frames;
+      mTargetTimes[i] = target;
+    }
+}
+
+glm::vec3 dmp::Crowd::instanceCenter(size_t i) const
+{
+  // the root's palette entry carries the walk away from the origin
+  const auto & root = mCurrent[i * mRig->askNumJoints()];
+  return glm::vec3(mInstances[i].M * root * glm::vec4(mBoundsCenter, 1.0f));
+}
+
+void dmp::Crowd::tellPoseCacheQuantum(float quantum)
+{
+  expect("quantum not negative", quantum >= 0.0f);
+  if (quantum == 0.0f)
+    {
+      mPoseCache = nullptr;
+      mSlots.clear();
+      return;
+    }
+
+  mPoseCache = std::make_unique<PoseCache>(quantum,
+                                           mRig->askNumJoints());
+  mSlots.resize(mInstances.size());
+}
+
+void dmp::Crowd::updateCached(JobSystem & jobs)
+{
+  // pick a slot per due instance, serially, then fill each distinct slot
+  // once and fan the results back out
+  mPoseCache->beginFrame();
+  for (size_t i = 0; i < mInstances.size(); ++i)
+    {
+      if (mDue[i]) mSlots[i] = mPoseCache->acquire(*mAnimation,
+                                                   mTargetTimes[i]);
+    }
+
+  if (mSlotPoses.size() < mPoseCache->askNumSlots())
+    {
+      mSlotPoses.resize(mPoseCache->askNumSlots());
+    }
+
+  // a slot costs what a due instance does, so it chunks the same way,
+  // and each chunk sets up its scratch pose and matrices once. The slot
+  // keeps the joint pose, for instances stepping toward it, and the
+  // palette, for those landing on it this frame
+  jobs.parallelFor(mPoseCache->askNumSlots(), crowdGrain,
+                   [this](size_t begin, size_t end)
+                   {
+                     auto pose = mRestPose;
+                     std::vector<glm::mat4> Ms;
+                     Ms.reserve(mRig->askNumJoints());
+                     for (size_t slot = begin; slot < end; ++slot)
+                       {
+                         mPoseCache->askSlotAnimation(slot)
+                           .evaluateAnimated(mPoseCache->askSlotTime(slot),
+                                             pose);
+                         mRig->toJointPose(pose, mSlotPoses[slot]);
+                         mRig->computeMs(mSlotPoses[slot], glm::mat4(), Ms);
+                         mSkin->computePalette(Ms,
+                                               mPoseCache->askMatrices(slot));
+                       }
+                   });
+
+  jobs.parallelFor(mInstances.size(), crowdGrain,
+                   [this](size_t begin, size_t end)
+                   {
+                     auto n = mRig->askNumJoints();
+                     std::vector<glm::mat4> Ms;
+                     Ms.reserve(n);
+                     for (size_t i = begin; i < end; ++i)
+                       {
+                         if (mDue[i])
+                           {
+                             mTargets[i] = mSlotPoses[mSlots[i]];
+                           }
+
+                         if (mDue[i] && mFramesLeft[i] == 1)
+                           {
+                             const auto * slot
+                               = mPoseCache->askMatrices(mSlots[i]);
+                             std::copy(slot, slot + n, &mCurrent[i * n]);
+                             mShown[i] = mTargets[i];
+                             --mFramesLeft[i];
+                           }
+                         else
+                           {
+                             stepPalette(i, Ms);
+                           }
+                         writeConstants(i);
+                       }
+                   });
+}
+
+void dmp::Crowd::stepPalette(size_t i, std::vector<glm::mat4> & Ms)
+{
+  AnimationLOD::step(mShown[i], mTargets[i], mFramesLeft[i]);
+  --mFramesLeft[i];
+  mRig->computeMs(mShown[i], glm::mat4(), Ms);
+  mSkin->computePalette(Ms, &mCurrent[i * mRig->askNumJoints()]);
+}
+
+void dmp::Crowd::writeConstants(size_t i)
+{
+  // the palette takes bind space to model space, M places the instance
+  const auto & M = mInstances[i].M;
+  auto normalM = glm::mat4(glm::transpose(glm::inverse(glm::mat3(M))));
+
+  const auto * current = &mCurrent[i * mRig->askNumJoints()];
+  mInstanceBounds[i] = mSkin->computeBounds(current).transformed(M);
+
+  // each part's palette holds its own bones, in its own slots
+  auto dual = askSkinningMode() == SkinningMode::dualQuaternion;
+  for (size_t p = 0; p < mSkin->askNumParts(); ++p)
+    {
+      auto * out = &mStaging[p][i * mStride];
+      *(glm::mat4 *) (out + offsetM) = M;
+      *(glm::mat4 *) (out + offsetNormalM) = normalM;
+
+      const auto & bones = mSkin->askPart(p).bones;
+      auto * WB = (glm::mat4 *) (out + offsetWB);
+      auto * DQ = (glm::vec4 *) (out + offsetWB);
+      for (size_t j = 0; j < bones.size(); ++j)
+        {
+          if (dual) toDualPalette(&current[bones[j]], 1, &DQ[2 * j]);
+          else WB[j] = current[bones[j]];
+        }
+    }
+}
+
+void dmp::Crowd::updateRange(size_t begin, size_t end)
+{
+  // INVARIANT: only touches instances [begin, end) and shared data that is
+  // read only during the update
+  std::vector<glm::mat4> Ms;
+  Ms.reserve(mRig->askNumJoints());
+
+  for (size_t i = begin; i < end; ++i)
+    {
+      if (mDue[i])
+        {
+          auto & pose = mPoses[i];
+          mAnimation->evaluateAnimated(mTargetTimes[i], pose);
+          mRig->toJointPose(pose, mTargets[i]);
+        }
+      stepPalette(i, Ms);
+      writeConstants(i);
+    }
+}
+
+void dmp::Crowd::free()
+{
+  mSkin->freeObject();
+}
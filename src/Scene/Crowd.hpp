@@ -0,0 +1,156 @@
+#ifndef DMP_CROWD_HPP
+#define DMP_CROWD_HPP
+
+#include <vector>
+#include <memory>
+#include <glm/glm.hpp>
+#include "../CommandLine.hpp"
+#include "../Renderer/UniformBuffer.hpp"
+#include "Object.hpp"
+#include "Model/Rig.hpp"
+#include "Model/Skin.hpp"
+#include "Model/Animation.hpp"
+#include "Model/PoseCache.hpp"
+#include "Model/AnimationLOD.hpp"
+
+namespace dmp
+{
+  class JobSystem;
+
+  struct CrowdInstance
+  {
+    float timeOffset;
+    glm::mat4 M;
+  };
+
+  // Many copies of one animated character. Every instance shares the
+  // Animation, Rig and Skin, and has only its own clock offset, world
+  // transform and pose. Each update evaluates, poses and skins the
+  // instances that lod says are due across a JobSystem, writing one
+  // ObjectConstants per instance and skin part straight into a staging
+  // buffer per part that goes to the GPU in a single upload
+  class Crowd
+  {
+  public:
+    Crowd() = delete;
+    Crowd(const Crowd &) = delete;
+    Crowd & operator=(const Crowd &) = delete;
+    Crowd(Crowd &&) = default;
+    Crowd & operator=(Crowd &&) = default;
+
+    // Instances start on a square grid in the xz plane, with their clocks
+    // spread over the animation
+    Crowd(const CommandLine & c,
+          size_t count,
+          size_t matIdx,
+          size_t texIdx);
+
+    void update(float deltaT, JobSystem & jobs, const AnimationLOD & lod);
+    void free();
+
+    // Instances whose clocks fall in the same bucket of quantum seconds
+    // share one evaluation, FK and palette per frame. 0 evaluates every
+    // instance exactly
+    void tellPoseCacheQuantum(float quantum);
+    const PoseCache * askPoseCache() const {return mPoseCache.get();}
+
+    // Dual quaternion palettes take half the staging buffer and upload of
+    // matrices. Rebuilds the constant buffer
+    void tellSkinningMode(SkinningMode mode);
+    SkinningMode askSkinningMode() const {return mSkin->askSkinningMode();}
+
+    size_t askCount() const {return mInstances.size();}
+
+    // Instances that got a fresh pose in the last update
+    size_t askNumUpdated() const {return mNumUpdated;}
+
+    // The level of detail instance i draws, from its size at the last
+    // update
+    size_t askMeshLevel(size_t i) const
+    {
+      expect("instance in range", i < mInstances.size());
+      return mMeshLevels[i];
+    }
+
+    // Instance i's world box as of the last update
+    const AABB & askInstanceBounds(size_t i) const
+    {
+      expect("instance in range", i < mInstances.size());
+      return mInstanceBounds[i];
+    }
+
+    const CrowdInstance & askInstance(size_t i) const
+    {
+      expect("instance in range", i < mInstances.size());
+      return mInstances[i];
+    }
+    void tellInstance(size_t i, const CrowdInstance & inst)
+    {
+      expect("instance in range", i < mInstances.size());
+      mInstances[i] = inst;
+    }
+
+    // The shared mesh, one object per skin part. Each is drawn once per
+    // instance with that instance's slot of the part's askConstants bound
+    // as ObjectConstants
+    size_t askNumParts() const {return mSkin->askNumParts();}
+    const Object & askObject(size_t part) const
+    {
+      return *mSkin->askPart(part).object;
+    }
+    UniformBuffer & askConstants(size_t part)
+    {
+      expect("part in range", part < mConstants.size());
+      return *mConstants[part];
+    }
+  private:
+    void initCrowd(const CommandLine & c,
+                   size_t count,
+                   size_t matIdx,
+                   size_t texIdx);
+    void schedule(float deltaT, const AnimationLOD & lod);
+    glm::vec3 instanceCenter(size_t i) const;
+    void updateRange(size_t begin, size_t end);
+    void updateCached(JobSystem & jobs);
+    void stepPalette(size_t i, std::vector<glm::mat4> & Ms);
+    void writeConstants(size_t i);
+
+    std::shared_ptr<const Rig> mRig;
+    std::unique_ptr<Skin> mSkin;
+    std::unique_ptr<Animation> mAnimation;
+
+    std::vector<CrowdInstance> mInstances;
+    std::vector<Pose> mPoses;
+    Pose mRestPose;
+
+    std::unique_ptr<PoseCache> mPoseCache;
+    std::vector<size_t> mSlots; // cache slot of each instance
+    std::vector<JointPose> mSlotPoses; // by cache slot, this frame
+
+    // lod state. An instance that is due this frame samples its animation
+    // at mTargetTimes into mTargets, then spends mFramesLeft frames
+    // stepping mShown there, posing its palette from each step
+    std::vector<bool> mDue;
+    std::vector<size_t> mFramesLeft;
+    std::vector<float> mTargetTimes;
+    std::vector<JointPose> mTargets;
+    std::vector<JointPose> mShown;
+    std::vector<glm::mat4> mCurrent; // the palettes last written
+    std::vector<size_t> mMeshLevels;
+    std::vector<AABB> mInstanceBounds;
+    size_t mNumUpdated = 0;
+    size_t mFrame = 0;
+    glm::vec3 mBoundsCenter; // bind space
+    float mBoundsRadius = 0.0f;
+
+    // by skin part, one std140 ObjectConstants per instance, mStride bytes
+    // apart, the palette as matrices or dual quaternions by the skin's mode
+    std::vector<std::vector<unsigned char>> mStaging;
+    size_t mStride = 0;
+    std::vector<std::unique_ptr<UniformBuffer>> mConstants;
+
+    float mTimeElapsed = 0.0f;
+  };
+}
+
+#endif
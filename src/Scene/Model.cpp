@@ -31,7 +31,9 @@ dmp::Model::Model(const CommandLine & c,
   if (skinExists)
     {
       expect("given skin file actually exists", fileExists(c.skinPath));
-      mSkin = std::make_unique<Skin>(c.skinPath);
+      mSkin = std::make_unique<Skin>(c.skinPath,
+                                     c.hasMaxBones() ? c.maxBones
+                                     : maxPaletteBones);
       mSkin->insertInScene(objs, matIdx, texIdx);
     }
   if (skelExists)
@@ -59,30 +61,50 @@ dmp::Model::Model(const CommandLine & c,
   if (animExists)
     {
       expect("given anim file actually exists", fileExists(c.animPath));
-      mAnimation = std::make_unique<Animation>(c.animPath);
+      mAnimation = loadClip(c.animPath, c.resampleHz, c.compressTolerance);
+
+      // constant channels are folded into the skeleton here, and never
+      // evaluated or applied again
+      mPose = mAnimation->askRestPose();
+      if (mSkeleton) mSkeleton->bakePose(mPose);
     }
 
   // Morphs
 
-  if (!c.hasMorphs() || !skinExists) return;
-
-  mMorphs.resize(1); // we want the null morph to be a location 0.
-                     // We will overwrite this
-  mMorphs.reserve(c.morphPaths.size() + 1);
-  for (const auto & curr : c.morphPaths)
+  if (c.hasMorphs() && skinExists)
     {
-      mMorphs.emplace_back(curr);
+      mMorphs.resize(1); // we want the null morph to be a location 0.
+                         // We will overwrite this
+      mMorphs.reserve(c.morphPaths.size() + 1);
+      for (const auto & curr : c.morphPaths)
+        {
+          mMorphs.emplace_back(curr);
+          mMorphs.back().remap(mSkin->askSources(),
+                               mSkin->askNumFileVerts());
+        }
+
+      // TODO: this is a bit gross
+      auto morphs = mMorphs.data();
+      auto length = mMorphs.size();
+      ++morphs;
+      --length;
+      mMorphs[0].initNullMorph(mSkin->askVerts(),
+                               mSkin->askNormals(),
+                               morphs,
+                               length);
     }
 
-  // TODO: this is a bit gross
-  auto morphs = mMorphs.data();
-  auto length = mMorphs.size();
-  ++morphs;
-  --length;
-  mMorphs[0].initNullMorph(mSkin->askVerts(),
-                           mSkin->askNormals(),
-                           morphs,
-                           length);
+  // Levels of detail, leaving whatever a morph moves alone
+
+  if (skinExists)
+    {
+      std::vector<char> locked(mSkin->askVerts().size(), 0);
+      for (const auto & morph : mMorphs)
+        {
+          for (const auto & curr : morph.verts) locked[curr.first] = 1;
+        }
+      mSkin->buildLODs(locked);
+    }
 }
 
 void dmp::Model::update(float deltaT,
@@ -90,22 +112,29 @@ void dmp::Model::update(float deltaT,
                         bool dirty)
 {
   mTimeElapsed += deltaT;
-  if (mSkeleton)
+  if (mMixer) mMixer->update(deltaT);
+  if (mLOD)
     {
-      if (mAnimation)
-        {
-          auto thePose = mAnimation->evaluate(mTimeElapsed);
-          mM = glm::translate(glm::mat4(), thePose.translation);
-          mSkeleton->applyPose(thePose);
-        }
+      updateLOD(deltaT, M, dirty);
+    }
+  else if (mSkeleton)
+    {
+      if (mAnimation) applyAnimation(0.0f);
       mSkeleton->update(deltaT, M * mM, dirty);
     }
 
   if (mSkeleton && mSkin)
     {
       mSkin->update(deltaT, M, dirty);
-      auto Ms = mSkeleton->getMs();
-      mSkin->tellBindingMats(Ms);
+      if (mLOD)
+        {
+          mSkin->tellBindingMats(mShownMs);
+        }
+      else
+        {
+          auto Ms = mSkeleton->getMs();
+          mSkin->tellBindingMats(Ms);
+        }
     }
   else if (mSkeleton && !mSkin)
     {
@@ -144,6 +173,100 @@ void dmp::Model::update(float deltaT,
     }
 }
 
+void dmp::Model::tellAnimationLOD(const AnimationLOD * lod)
+{
+  if (lod)
+    {
+      expect("lod model has a skeleton", mSkeleton);
+      expect("lod model has a skin", mSkin);
+      expect("lod model has an animation", mAnimation);
+      AnimationLOD::boundingSphere(mSkin->askVerts(),
+                                   mBoundsCenter,
+                                   mBoundsRadius);
+    }
+
+  mLOD = lod;
+  mShownPose.rotations.clear();
+  mFramesLeft = 0;
+}
+
+void dmp::Model::skinOnCPU(JobSystem * jobs)
+{
+  expect("cpu skinned model has a skin", mSkin);
+  mSkin->skinOnCPU(jobs);
+}
+
+void dmp::Model::updateLOD(float deltaT, glm::mat4 M, bool dirty)
+{
+  if (mFramesLeft == 0 || dirty)
+    {
+      // nothing to step from yet, or the model moved under us
+      auto center = glm::vec3(M * mM * glm::vec4(mBoundsCenter, 1.0f));
+      auto interval = (mShownPose.rotations.empty() || dirty) ? 1
+        : mLOD->askInterval(center, mBoundsRadius);
+      mFramesLeft = AnimationLOD::framesToUpdate(mFrame, 0, interval);
+
+      // sample where the clock will be on the frame the steps land, but
+      // never across the loop seam, where the root jumps back
+      auto duration = mAnimation->askDuration();
+      auto target = mTimeElapsed + (float) (mFramesLeft - 1) * deltaT;
+      if (fmodf(target, duration) < fmodf(mTimeElapsed, duration))
+        {
+          mFramesLeft = 1;
+          target = mTimeElapsed;
+        }
+
+      applyAnimation(target - mTimeElapsed);
+      mSkeleton->update(deltaT, M * mM, dirty);
+
+      // whatever the skeleton ended up with, dof window edits included
+      const auto & rig = *mSkeleton->askRig();
+      mTargetPose.translation = mPose.translation;
+      mTargetPose.rotations.resize(rig.askNumJoints());
+      for (size_t i = 0; i < rig.askNumJoints(); ++i)
+        {
+          mTargetPose.rotations[i]
+            = rig.jointRotation(i, mSkeleton->askJointRotation(i));
+        }
+    }
+
+  AnimationLOD::step(mShownPose, mTargetPose, mFramesLeft);
+  --mFramesLeft;
+  mSkeleton->askRig()->computeMs(mShownPose, M, mShownMs);
+  ++mFrame;
+}
+
+dmp::AnimationMixer & dmp::Model::askMixer()
+{
+  if (!mMixer)
+    {
+      expect("mixed model has a skeleton", mSkeleton);
+      expect("mixed model has an animation", mAnimation);
+      mMixer = std::make_unique<AnimationMixer>(mSkeleton->askRig());
+      auto base = mMixer->addLayer(LayerMode::override);
+      auto clip = mMixer->addClip(base, *mAnimation);
+      mMixer->tellClipTime(base, clip, mTimeElapsed);
+    }
+  return *mMixer;
+}
+
+void dmp::Model::applyAnimation(float ahead)
+{
+  if (mMixer)
+    {
+      mMixer->update(ahead);
+      mMixer->evaluate(mPose);
+      mMixer->update(-ahead);
+      mSkeleton->applyPose(mPose, mMixer->askJoints());
+    }
+  else
+    {
+      mAnimation->evaluateAnimated(mTimeElapsed + ahead, mPose);
+      mSkeleton->applyPose(mPose, mAnimation->askAnimatedJoints());
+    }
+  mM = glm::translate(glm::mat4(), mPose.translation);
+}
+
 void dmp::Model::applyMorph(size_t index, float time)
 {
   expect("has skin", mSkin);
@@ -8,6 +8,8 @@
 #include "Model/Skin.hpp"
 #include "Model/Morph.hpp"
 #include "Model/Animation.hpp"
+#include "Model/AnimationLOD.hpp"
+#include "Model/AnimationMixer.hpp"
 
 namespace dmp
 {
@@ -45,13 +47,42 @@ namespace dmp
 
     Animation * askAnimation() {return mAnimation.get();}
     bool hasAnimation() {return mAnimation != nullptr;}
+
+    // The mixer the model plays through, made on first use with the
+    // model's animation as the one clip of its base layer. From then on,
+    // update plays the mixer instead of the animation
+    AnimationMixer & askMixer();
+
+    // Skinned, animated models update their pose as often as lod says
+    // instead of every frame. lod must outlive the model; nullptr goes
+    // back to every frame
+    void tellAnimationLOD(const AnimationLOD * lod);
+
+    // Skins on the CPU across jobs instead of in the shader; see
+    // Skin::skinOnCPU
+    void skinOnCPU(JobSystem * jobs);
+
+    // The skin's world box as of the last update; empty without a skin
+    AABB askBounds() const
+    {
+      if (!mSkin) return {};
+      return mSkin->askWorldBounds();
+    }
   private:
+    void updateLOD(float deltaT, glm::mat4 M, bool dirty);
+
+    // Poses the skeleton as the animation, or the mixer, will be ahead
+    // seconds from now
+    void applyAnimation(float ahead);
+
     glm::mat4 mM;
     bool mDirty = true;
     std::unique_ptr<Skeleton> mSkeleton;
     std::unique_ptr<Skin> mSkin;
     std::vector<Morph> mMorphs;
     std::unique_ptr<Animation> mAnimation;
+    std::unique_ptr<AnimationMixer> mMixer;
+    Pose mPose;
 
     static constexpr const float period = 0.5f;
     bool mMorphLerpInProgress = false;
@@ -60,6 +91,15 @@ namespace dmp
     size_t mMorphNew = 0;
 
     float mTimeElapsed = 0.0f;
+
+    const AnimationLOD * mLOD = nullptr;
+    JointPose mShownPose;
+    JointPose mTargetPose;
+    std::vector<glm::mat4> mShownMs; // FK of mShownPose
+    size_t mFramesLeft = 0;
+    size_t mFrame = 0;
+    glm::vec3 mBoundsCenter;
+    float mBoundsRadius = 0.0f;
   };
 }
 
@@ -2,6 +2,8 @@
 #include "parsing.hpp"
 #include <iostream>
 #include <list>
+#include <map>
+#include <algorithm>
 #include <cmath>
 #include <glm/gtx/string_cast.hpp>
 #include "../../config.hpp"
@@ -24,6 +26,437 @@ static const std::string tokTangentFlat = "flat";
 static const std::string tokTangentLinear = "linear";
 static const std::string tokTangentSmooth = "smooth";
 
+// -----------------------------------------------------------------------------
+// Channel evaluators
+// -----------------------------------------------------------------------------
+
+namespace
+{
+  using dmp::ChannelData;
+  using dmp::ChannelEvaluator;
+  using dmp::CompressedChannel;
+  using dmp::CompressedEvaluator;
+  using dmp::CompressedKey;
+  using dmp::Extrapolation;
+  using dmp::Keyframe;
+
+  enum class KeyClass
+  {
+    single, pair, many
+  };
+
+  float evaluateSegment(const Keyframe & kf, float t)
+  {
+    expect("current keyframe has had coefficients evaluated",
+           kf.invLerpRhs != 0.0f);
+
+    auto u = kf.invLerpRhs * (t - kf.time);
+    const auto & cc = kf.cubicCoefficients;
+
+    return cc.w + u * (cc.z + u * (cc.y + u * (cc.x)));
+  }
+
+  // Evaluate t in [startTime, endTime]
+  template <KeyClass K>
+  float evaluateInRange(const ChannelData & cd, float t);
+
+  template <>
+  float evaluateInRange<KeyClass::single>(const ChannelData & cd, float t)
+  {
+    expect("time is ~ keyframe time", dmp::roughEq(cd.keyframes[0].time, t));
+    return cd.keyframes[0].value;
+  }
+
+  template <>
+  float evaluateInRange<KeyClass::pair>(const ChannelData & cd, float t)
+  {
+    const auto & kf = cd.keyframes;
+    if (dmp::roughEq(kf[1].time, t)) return kf[1].value;
+    return evaluateSegment(kf[0], t);
+  }
+
+  template <>
+  float evaluateInRange<KeyClass::many>(const ChannelData & cd, float t)
+  {
+    const auto & kf = cd.keyframes;
+    for (size_t i = 1; i < kf.size(); ++i)
+      {
+        if (dmp::roughEq(kf[i].time, t))
+          {
+            return kf[i].value;
+          }
+        else if (kf[i].time > t)
+          {
+            return evaluateSegment(kf[i - 1], t);
+          }
+      }
+    impossible("found a suitable keyframe");
+  }
+
+  // Compressed channels. Keys are decoded in place; nothing is expanded back
+  // into Keyframes
+
+  float hermite(float p0, float p1, float m0, float m1, float u)
+  {
+    auto u2 = u * u;
+    auto u3 = u2 * u;
+    return p0 * (2.0f * u3 - 3.0f * u2 + 1.0f)
+      + p1 * (3.0f * u2 - 2.0f * u3)
+      + m0 * (u3 - 2.0f * u2 + u)
+      + m1 * (u3 - u2);
+  }
+
+  float decodeValue(const CompressedChannel & cc, const CompressedKey & k)
+  {
+    return cc.valueBase + (float) k.value * cc.valueScale;
+  }
+
+  // qt is a time in the channel's quantized time units
+  float evaluateCompressedSegment(const CompressedChannel & cc,
+                                  size_t i, float qt)
+  {
+    const auto & lhs = cc.keys[i];
+    const auto & rhs = cc.keys[i + 1];
+    auto deltaQ = (float) rhs.time - (float) lhs.time;
+    auto deltaT = deltaQ * cc.timeScale;
+    return hermite(decodeValue(cc, lhs),
+                   decodeValue(cc, rhs),
+                   deltaT * (float) lhs.tangentOut * cc.tangentScale,
+                   deltaT * (float) rhs.tangentIn * cc.tangentScale,
+                   (qt - (float) lhs.time) / deltaQ);
+  }
+
+  template <KeyClass K>
+  float evaluateInRange(const CompressedChannel & cc, float t);
+
+  template <>
+  float evaluateInRange<KeyClass::single>(const CompressedChannel & cc, float)
+  {
+    return decodeValue(cc, cc.keys[0]);
+  }
+
+  template <>
+  float evaluateInRange<KeyClass::pair>(const CompressedChannel & cc, float t)
+  {
+    auto qt = (t - cc.timeBase) / cc.timeScale;
+    if (qt >= (float) cc.keys[1].time) return decodeValue(cc, cc.keys[1]);
+    return evaluateCompressedSegment(cc, 0, qt);
+  }
+
+  template <>
+  float evaluateInRange<KeyClass::many>(const CompressedChannel & cc, float t)
+  {
+    auto qt = (t - cc.timeBase) / cc.timeScale;
+    const auto * k = cc.keys;
+
+    // the first key after qt closes its segment. A qt landing on a key
+    // starts the next segment, which evaluates to that key exactly
+    auto next = std::upper_bound(k + 1, k + cc.numKeys, qt,
+                                 [](float q, const CompressedKey & key)
+                                 {
+                                   return q < (float) key.time;
+                                 });
+
+    // t rounded onto or past the last key
+    if (next == k + cc.numKeys) return decodeValue(cc, k[cc.numKeys - 1]);
+    return evaluateCompressedSegment(cc, (size_t) (next - k) - 1, qt);
+  }
+
+  // What the extrapolation rules need to know about either storage
+
+  float frontTime(const ChannelData & cd) {return cd.keyframes.front().time;}
+  float backTime(const ChannelData & cd) {return cd.keyframes.back().time;}
+
+  float frontTangentOut(const ChannelData & cd)
+  {
+    return cd.keyframes.front().getTangentOut();
+  }
+
+  float backTangentIn(const ChannelData & cd)
+  {
+    return cd.keyframes.back().getTangentIn();
+  }
+
+  float frontTime(const CompressedChannel & cc) {return cc.timeBase;}
+  float backTime(const CompressedChannel & cc) {return cc.timeEnd;}
+
+  float frontTangentOut(const CompressedChannel & cc)
+  {
+    return (float) cc.keys[0].tangentOut * cc.tangentScale;
+  }
+
+  float backTangentIn(const CompressedChannel & cc)
+  {
+    return (float) cc.keys[cc.numKeys - 1].tangentIn * cc.tangentScale;
+  }
+
+  // The extrapolation rules. One specialization per mode, so the mode switch
+  // happens once at load in selectEvaluator rather than on every sample
+
+  template <Extrapolation E, KeyClass K>
+  struct ExtrapolateIn;
+
+  template <Extrapolation E, KeyClass K>
+  struct ExtrapolateOut;
+
+  template <KeyClass K>
+  struct ExtrapolateIn<Extrapolation::constant, K>
+  {
+    template <typename C>
+    static float apply(const C & cd, float t,
+                       float startTime, float endTime, float rangeTime)
+    {
+      return evaluateInRange<K>(cd, startTime);
+    }
+  };
+
+  template <KeyClass K>
+  struct ExtrapolateIn<Extrapolation::linear, K>
+  {
+    template <typename C>
+    static float apply(const C & cd, float t,
+                       float startTime, float endTime, float rangeTime)
+    {
+      return evaluateInRange<K>(cd, startTime) * frontTangentOut(cd);
+    }
+  };
+
+  template <KeyClass K>
+  struct ExtrapolateIn<Extrapolation::cycle, K>
+  {
+    template <typename C>
+    static float apply(const C & cd, float t,
+                       float startTime, float endTime, float rangeTime)
+    {
+      float tPrime = dmp::mod(t - startTime, rangeTime) + startTime;
+      expect ("tPrime in in range",
+              startTime <= tPrime && tPrime <= endTime);
+      return evaluateInRange<K>(cd, tPrime);
+    }
+  };
+
+  template <KeyClass K>
+  struct ExtrapolateIn<Extrapolation::cycleOffset, K>
+  {
+    template <typename C>
+    static float apply(const C & cd, float t,
+                       float startTime, float endTime, float rangeTime)
+    {
+      float tPrime = dmp::mod(t - startTime, rangeTime) + startTime;
+      expect ("tPrime in in range",
+              startTime <= tPrime && tPrime <= endTime);
+      size_t distance = 0;
+      float acc = t;
+      while (true)
+        {
+          acc = acc + rangeTime;
+          ++distance;
+          if (acc >= startTime && acc <= endTime) break;
+        }
+      return ((((float) distance) * evaluateInRange<K>(cd, startTime))
+              + (evaluateInRange<K>(cd, tPrime)));
+    }
+  };
+
+  template <KeyClass K>
+  struct ExtrapolateIn<Extrapolation::bounce, K>
+  {
+    template <typename C>
+    static float apply(const C & cd, float t,
+                       float startTime, float endTime, float rangeTime)
+    {
+      float tPrime = dmp::mod(t - startTime, rangeTime) + startTime;
+      expect ("tPrime in in range",
+              startTime <= tPrime && tPrime <= endTime);
+      size_t distance = 0;
+      float acc = t;
+      while (true)
+        {
+          acc = acc + rangeTime;
+          if (acc >= startTime && acc <= endTime) break;
+          ++distance;
+        }
+      if (distance % 2) return evaluateInRange<K>(cd, endTime - tPrime); // odd
+      else return evaluateInRange<K>(cd, tPrime);
+    }
+  };
+
+  template <KeyClass K>
+  struct ExtrapolateOut<Extrapolation::constant, K>
+  {
+    template <typename C>
+    static float apply(const C & cd, float t,
+                       float startTime, float endTime, float rangeTime)
+    {
+      return evaluateInRange<K>(cd, endTime);
+    }
+  };
+
+  template <KeyClass K>
+  struct ExtrapolateOut<Extrapolation::linear, K>
+  {
+    template <typename C>
+    static float apply(const C & cd, float t,
+                       float startTime, float endTime, float rangeTime)
+    {
+      return evaluateInRange<K>(cd, endTime) * backTangentIn(cd);
+    }
+  };
+
+  template <KeyClass K>
+  struct ExtrapolateOut<Extrapolation::cycle, K>
+  {
+    template <typename C>
+    static float apply(const C & cd, float t,
+                       float startTime, float endTime, float rangeTime)
+    {
+      float tPrime = dmp::mod(t - startTime, rangeTime) + startTime;
+      expect ("tPrime out in range",
+              startTime <= tPrime && tPrime <= endTime);
+      return evaluateInRange<K>(cd, tPrime);
+    }
+  };
+
+  template <KeyClass K>
+  struct ExtrapolateOut<Extrapolation::cycleOffset, K>
+  {
+    template <typename C>
+    static float apply(const C & cd, float t,
+                       float startTime, float endTime, float rangeTime)
+    {
+      size_t distance = 0;
+      float acc = t;
+      while (true)
+        {
+          acc = acc - rangeTime;
+          ++distance;
+          if (acc >= startTime && acc <= endTime) break;
+        }
+      return ((((float) distance) * evaluateInRange<K>(cd, endTime))
+              + (evaluateInRange<K>(cd, fabsf(acc))));
+    }
+  };
+
+  template <KeyClass K>
+  struct ExtrapolateOut<Extrapolation::bounce, K>
+  {
+    template <typename C>
+    static float apply(const C & cd, float t,
+                       float startTime, float endTime, float rangeTime)
+    {
+      float tPrime = dmp::mod(t - startTime, rangeTime) + startTime;
+      expect ("tPrime out in range",
+              startTime <= tPrime && tPrime <= endTime);
+      size_t distance = 0;
+      float acc = t;
+      while (true)
+        {
+          acc = acc - rangeTime;
+          ++distance;
+          if (acc >= startTime && acc <= endTime) break;
+        }
+      if (distance % 2) return evaluateInRange<K>(cd, endTime - tPrime); // odd
+      else return evaluateInRange<K>(cd, tPrime);
+    }
+  };
+
+  template <Extrapolation In, Extrapolation Out, KeyClass K, typename C>
+  float evaluateChannel(const C & cd, float t)
+  {
+    auto startTime = frontTime(cd);
+    auto endTime = backTime(cd);
+    auto rangeTime = endTime - startTime;
+
+    if (t < startTime)
+      {
+        return ExtrapolateIn<In, K>::apply(cd, t, startTime,
+                                           endTime, rangeTime);
+      }
+    else if (t > endTime)
+      {
+        return ExtrapolateOut<Out, K>::apply(cd, t, startTime,
+                                             endTime, rangeTime);
+      }
+    return evaluateInRange<K>(cd, t);
+  }
+
+  float evaluateConstant(const ChannelData & cd, float)
+  {
+    return cd.keyframes[0].value;
+  }
+
+  // F is the evaluator type to select, ChannelEvaluator or
+  // CompressedEvaluator. The storage type is deduced from it
+  template <typename F, Extrapolation In, Extrapolation Out>
+  F selectForKeys(KeyClass k)
+  {
+    switch (k)
+      {
+      case KeyClass::single:
+        return &evaluateChannel<In, Out, KeyClass::single>;
+      case KeyClass::pair:
+        return &evaluateChannel<In, Out, KeyClass::pair>;
+      case KeyClass::many:
+        return &evaluateChannel<In, Out, KeyClass::many>;
+      }
+    impossible("KeyClass switch non-exhaustive");
+  }
+
+  template <typename F, Extrapolation In>
+  F selectForOut(Extrapolation out, KeyClass k)
+  {
+    switch (out)
+      {
+      case Extrapolation::constant:
+        return selectForKeys<F, In, Extrapolation::constant>(k);
+      case Extrapolation::linear:
+        return selectForKeys<F, In, Extrapolation::linear>(k);
+      case Extrapolation::cycle:
+        return selectForKeys<F, In, Extrapolation::cycle>(k);
+      case Extrapolation::cycleOffset:
+        return selectForKeys<F, In, Extrapolation::cycleOffset>(k);
+      case Extrapolation::bounce:
+        return selectForKeys<F, In, Extrapolation::bounce>(k);
+      }
+    impossible("Extrapolation switch non-exhaustive");
+  }
+
+  template <typename F>
+  F selectEvaluator(Extrapolation in, Extrapolation out, KeyClass k)
+  {
+    switch (in)
+      {
+      case Extrapolation::constant:
+        return selectForOut<F, Extrapolation::constant>(out, k);
+      case Extrapolation::linear:
+        return selectForOut<F, Extrapolation::linear>(out, k);
+      case Extrapolation::cycle:
+        return selectForOut<F, Extrapolation::cycle>(out, k);
+      case Extrapolation::cycleOffset:
+        return selectForOut<F, Extrapolation::cycleOffset>(out, k);
+      case Extrapolation::bounce:
+        return selectForOut<F, Extrapolation::bounce>(out, k);
+      }
+    impossible("Extrapolation switch non-exhaustive");
+  }
+
+  KeyClass classifyKeys(size_t count)
+  {
+    return (count == 1) ? KeyClass::single
+      : ((count == 2) ? KeyClass::pair : KeyClass::many);
+  }
+
+  // True if extrapolating a flat curve with e stays on that curve's value.
+  // Bounce only qualifies with a nonzero range; with a single key its
+  // search for the mirrored time never terminates
+  bool holdsValue(Extrapolation e, size_t numKeys)
+  {
+    return e == Extrapolation::constant
+      || e == Extrapolation::cycle
+      || (e == Extrapolation::bounce && numKeys > 1);
+  }
+}
+
 dmp::Channel::Channel(const ChannelData & cd)
 {
   mData = cd;
@@ -34,12 +467,25 @@ void dmp::Channel::precompute()
   computeTangents();
   computeCubicCoefficients();
 
-  glGenVertexArrays(1, &mVAO);
-  glGenBuffers(1, &mVBO);
+  expect("channel has keyframes", !mData.keyframes.empty());
 
-  expectNoErrors("Gen vao/vbo");
+  if (isConstant())
+    {
+      mEvaluator = &evaluateConstant;
+    }
+  else
+    {
+      mEvaluator = selectEvaluator<ChannelEvaluator>
+        (mData.extrapIn, mData.extrapOut, classifyKeys(mData.keyframes.size()));
+    }
+}
 
-  std::vector<ChannelVertex> verts(0);
+void dmp::Channel::buildCurve()
+{
+  // the curve as line segments, then the in and out tangent handles of
+  // every keyframe, all in one buffer. The vertex type picks the color
+  std::vector<ChannelVertex> verts;
+  verts.reserve(1000 + 4 * mData.keyframes.size());
 
   for (float t = -5.0f; t < 4.9f; t = t + 0.02f)
   {
@@ -47,6 +493,23 @@ void dmp::Channel::precompute()
     verts.push_back({glm::vec2(t + 0.02f, evaluate(t + 0.02f)), CURVE_TYPE});
   }
 
+  for (const auto & curr : mData.keyframes)
+    {
+      verts.push_back({glm::vec2((curr.time-0.1f),
+                                 curr.value + curr.getTangentIn() * -0.1f),
+                       TAN_IN_TYPE});
+      verts.push_back({glm::vec2(curr.time, curr.value), TAN_IN_TYPE});
+      verts.push_back({glm::vec2(curr.time, curr.value), TAN_OUT_TYPE});
+      verts.push_back({glm::vec2((curr.time+0.1f),
+                                 curr.value + curr.getTangentOut() * 0.1f),
+                       TAN_OUT_TYPE});
+    }
+
+  glGenVertexArrays(1, &mVAO);
+  glGenBuffers(1, &mVBO);
+
+  expectNoErrors("Gen vao/vbo");
+
   drawCount = (GLsizei) verts.size();
   glBindVertexArray(mVAO);
   glBindBuffer(GL_ARRAY_BUFFER, mVBO);
@@ -72,54 +535,19 @@ void dmp::Channel::precompute()
 
   expectNoErrors("Set vertex attributes");
 
-  for (auto & curr : mData.keyframes)
-    {
-      std::vector<ChannelVertex> verts(4);
-      verts[0] = {glm::vec2((curr.time-0.1f),
-                            curr.value + curr.getTangentIn() * -0.1f), TAN_IN_TYPE};
-      verts[1] = {glm::vec2(curr.time,
-                            (curr.value)), TAN_IN_TYPE};
-      verts[2] = {glm::vec2(curr.time,
-                            (curr.value)), TAN_OUT_TYPE};
-      verts[3] = {glm::vec2((curr.time+0.1f),
-                            curr.value + curr.getTangentOut() * 0.1f), TAN_OUT_TYPE};
-
-      expect("|verts| = 4", verts.size() == 4);
-      curr.drawCount = (GLsizei) verts.size();
-      glGenVertexArrays(1, &curr.mVAO);
-      glGenBuffers(1, &curr.mVBO);
-
-      expectNoErrors("Gen vao/vbo");
-
-      glBindVertexArray(curr.mVAO);
-      glBindBuffer(GL_ARRAY_BUFFER, curr.mVBO);
-      glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr) (verts.size() * sizeof(ChannelVertex)),
-                   verts.data(), GL_STATIC_DRAW);
-
-      expectNoErrors("Fill VBO");
-
-      glEnableVertexAttribArray(0);
-      glVertexAttribPointer(0,
-                            2,
-                            GL_FLOAT,
-                            GL_FALSE,
-                            sizeof(ChannelVertex),
-                            (GLvoid *) 0);
-
-      glEnableVertexAttribArray(1);
-      glVertexAttribIPointer(1,
-                             1,
-                             GL_INT,
-                             sizeof(ChannelVertex),
-                             (GLvoid *) offsetof(ChannelVertex, type));
-
-      expectNoErrors("Set vertex attributes");
-    }
-
   glBindBuffer(GL_ARRAY_BUFFER, 0);
   glBindVertexArray(0);
 }
 
+void dmp::Channel::releaseCurve()
+{
+  if (mVAO != 0) glDeleteVertexArrays(1, &mVAO);
+  if (mVBO != 0) glDeleteBuffers(1, &mVBO);
+  mVAO = 0;
+  mVBO = 0;
+  drawCount = 0;
+}
+
 static void parseChannel(dmp::ChannelData & cd,
                          dmp::TokenIterator & b,
                          dmp::TokenIterator & e)
@@ -527,133 +955,35 @@ void dmp::Channel::computeTangents()
     }
 }
 
-float dmp::Channel::evaluateImpl(float t)
+bool dmp::Channel::isConstant() const
 {
-  Keyframe kf;
-  bool foundSuitable = false;
-
-  if (mData.keyframes.size() == 1)
-    {
-      expect("time is ~ keyframe time", roughEq(mData.keyframes[0].time, t));
-      return mData.keyframes[0].value;
-    }
+  // INVARIANT: computeTangents must be called before this!
+  const auto & kf = mData.keyframes;
+  if (kf.empty()) return false;
+  if (!holdsValue(mData.extrapIn, kf.size())) return false;
+  if (!holdsValue(mData.extrapOut, kf.size())) return false;
+  if (kf.size() == 1) return true;
 
-  for (size_t i = 1; i < mData.keyframes.size(); ++i)
+  for (const auto & curr : kf)
     {
-      if (roughEq(mData.keyframes[i].time, t))
-        {
-          return mData.keyframes[i].value;
-        }
-      else if ( mData.keyframes[i].time > t)
-        {
-          expect("found larger time. This should not be index 0", i != 0);
-          kf = mData.keyframes[i-1];
-          foundSuitable = true;
-          break;
-        }
+      if (curr.value != kf[0].value) return false;
+      if (curr.getTangentIn() != 0.0f) return false;
+      if (curr.getTangentOut() != 0.0f) return false;
     }
-  expect("found a suitable keyframe", foundSuitable);
-  expect("current keyframe has had coefficients evaluated",
-         kf.invLerpRhs != 0.0f);
-
-  auto u = kf.invLerpRhs * (t - kf.time);
-  const auto & cc = kf.cubicCoefficients;
-
-  return cc.w + u * (cc.z + u * (cc.y + u * (cc.x)));
+  return true;
 }
 
-float dmp::Channel::evaluate(float t)
+float dmp::Channel::askConstantValue() const
 {
-  auto startTime = mData.keyframes.front().time;
-  auto endTime = mData.keyframes.back().time;
-  auto rangeTime = endTime - startTime;
-
-
-  if (t >= startTime && t <= endTime)
-    { // In range, just evaluate
-      return evaluateImpl(t);
-    }
-
-  else if (t < startTime)
-    {// extrapolateIn
-      float tPrime = mod(t-startTime, rangeTime) + startTime;
-      size_t distance = 0;
-      float acc = t;
-      float startVal = evaluateImpl(startTime);
-
-      expect ("tPrime in in range",
-              startTime <= tPrime && tPrime <= endTime);
-
-      switch (mData.extrapIn)
-        {
-        case Extrapolation::constant:
-          return startVal;
-        case Extrapolation::linear:
-          return startVal
-            * mData.keyframes.front().getTangentOut();
-        case Extrapolation::cycle:
-          return evaluateImpl(tPrime);
-          return 0.0f;
-        case Extrapolation::cycleOffset:
-          while (true)
-            {
-              acc = acc + rangeTime;
-              ++distance;
-              if (acc >= startTime && acc <= endTime) break;
-            }
-          return ((((float) distance) * startVal)
-          + (evaluateImpl(tPrime)));
-        case Extrapolation::bounce:
-          while (true)
-            {
-              acc = acc + rangeTime;
-              if (acc >= startTime && acc <= endTime) break;
-              ++distance;
-            }
-          if (distance % 2) return evaluateImpl(endTime - tPrime); // odd
-          else return evaluateImpl(tPrime);
-        }
-    }
-  else
-    { // extrapolateOut
-      float tPrime = mod(t-startTime, rangeTime) + startTime;
-      size_t distance = 0;
-      float acc = t;
-      float endVal = evaluateImpl(endTime);
-
-      expect ("tPrime out in range",
-              startTime <= tPrime && tPrime <= endTime);
+  expect("channel is constant", isConstant());
+  return mData.keyframes[0].value;
+}
 
-      switch (mData.extrapOut)
-        {
-        case Extrapolation::constant:
-          return endVal;
-        case Extrapolation::linear:
-          return endVal
-            * mData.keyframes.back().getTangentIn();
-        case Extrapolation::cycle:
-          return evaluateImpl(tPrime);
-        case Extrapolation::cycleOffset:
-          while (true)
-            {
-              acc = acc - rangeTime;
-              ++distance;
-              if (acc >= startTime && acc <= endTime) break;
-            }
-          return ((((float) distance) * endVal)
-          + (evaluateImpl(fabsf(acc))));
-        case Extrapolation::bounce:
-          while (true)
-            {
-              acc = acc - rangeTime;
-              ++distance;
-              if (acc >= startTime && acc <= endTime) break;
-            }
-          if (distance % 2) return evaluateImpl(endTime - tPrime); // odd
-          else return evaluateImpl(tPrime);
-        }
-    }
-  impossible("channel::evaluate if/then/else didn't return");
+void dmp::Channel::releaseKeyframes()
+{
+  releaseCurve();
+  std::vector<Keyframe>().swap(mData.keyframes);
+  mEvaluator = nullptr;
 }
 
 dmp::Animation::Animation(const std::string & path)
@@ -661,6 +991,33 @@ dmp::Animation::Animation(const std::string & path)
   initAnimation(path);
 }
 
+std::unique_ptr<dmp::Animation> dmp::loadClip(const std::string & path,
+                                              float rateHz,
+                                              float tolerance)
+{
+  auto anim = std::make_unique<Animation>(path);
+  if (rateHz > 0.0f)
+    {
+      auto err = anim->resample(rateHz);
+      std::cerr << "resampled " << path << " at " << rateHz
+                << "Hz: max error = " << err.maxError << " (channel "
+                << err.worstChannel << "), rms error = " << err.rmsError
+                << std::endl;
+    }
+  if (tolerance > 0.0f)
+    {
+      auto stats = anim->compress(tolerance);
+      anim->releaseSourceKeyframes();
+      std::cerr << "compressed " << path << " to " << tolerance << ": "
+                << stats.keysBefore << " -> " << stats.keysAfter
+                << " keyframes, " << stats.bytesBefore << " -> "
+                << stats.bytesAfter << " bytes, max error = "
+                << stats.maxError << " (channel " << stats.worstChannel
+                << ")" << std::endl;
+    }
+  return anim;
+}
+
 
 
 void dmp::Animation::initAnimation(const std::string & path)
@@ -748,51 +1105,432 @@ void dmp::Animation::initAnimation(const std::string & path)
       curr.precompute();
     }
 
-  auto vertName = channelShader + std::string(".vert");
-  auto fragName = channelShader + std::string(".frag");
+  groupChannels();
+  findAnimatedJoints();
+
+  ifDebug(std::cerr << "animation: " << mConstantChannels.size() << "/"
+          << mChannels.size() << " channels constant, "
+          << mAnimatedJoints.size() << "/" << ((mChannels.size() / 3) - 1)
+          << " joints animated" << std::endl);
+}
+
+// -----------------------------------------------------------------------------
+// Keyframe compression
+// -----------------------------------------------------------------------------
+
+namespace
+{
+  const size_t compressSubSamples = 8;
+
+  // Largest |exact - approx| over the keyframes first..last of ch and
+  // compressSubSamples points inside each segment between them
+  template <typename F>
+  float maxErrorOver(const dmp::Channel & ch, size_t first, size_t last,
+                     F approx)
+  {
+    const auto & kf = ch.askData().keyframes;
+    float err = 0.0f;
+    for (size_t i = first; i < last; ++i)
+      {
+        auto deltaT = kf[i + 1].time - kf[i].time;
+        for (size_t sub = 0; sub < compressSubSamples; ++sub)
+          {
+            auto t = kf[i].time
+              + deltaT * (float) sub / (float) compressSubSamples;
+            err = glm::max(err, fabsf(ch.evaluate(t) - approx(t)));
+          }
+      }
+    auto t = kf[last].time;
+    return glm::max(err, fabsf(ch.evaluate(t) - approx(t)));
+  }
+
+  // Greedily drop each interior keyframe the curve stays within tolerance
+  // without, measured against the original curve over the whole span the
+  // merged segment covers. Tangents are already values, so the surviving
+  // keyframes keep theirs. Returns the indices kept
+  std::vector<size_t> reduceKeyframes(const dmp::Channel & ch, float tolerance)
+  {
+    const auto & kf = ch.askData().keyframes;
+    std::vector<size_t> keep = {0};
+    for (size_t i = 1; i + 1 < kf.size(); ++i)
+      {
+        const auto & lhs = kf[keep.back()];
+        const auto & rhs = kf[i + 1];
+        auto deltaT = rhs.time - lhs.time;
+        auto merged = [&lhs, &rhs, deltaT](float t)
+          {
+            return hermite(lhs.value, rhs.value,
+                           deltaT * lhs.getTangentOut(),
+                           deltaT * rhs.getTangentIn(),
+                           (t - lhs.time) / deltaT);
+          };
+        if (maxErrorOver(ch, keep.back(), i + 1, merged) > tolerance)
+          {
+            keep.push_back(i);
+          }
+      }
+    if (kf.size() > 1) keep.push_back(kf.size() - 1);
+    return keep;
+  }
+
+  uint16_t quantizeUnorm(float v, float base, float scale)
+  {
+    if (scale == 0.0f) return 0;
+    return (uint16_t) glm::clamp(roundf((v - base) / scale), 0.0f, 65535.0f);
+  }
+
+  int16_t quantizeSnorm(float v, float scale)
+  {
+    if (scale == 0.0f) return 0;
+    return (int16_t) glm::clamp(roundf(v / scale), -32767.0f, 32767.0f);
+  }
+
+  // Fills keys and returns the channel over them. The channel points into
+  // keys, so it is only valid as long as keys is not reallocated
+  CompressedChannel quantizeKeyframes(const ChannelData & cd,
+                                      const std::vector<size_t> & keep,
+                                      std::vector<CompressedKey> & keys)
+  {
+    const auto & kf = cd.keyframes;
+    expect("keeping at least one keyframe", !keep.empty());
+
+    auto minValue = kf[keep.front()].value;
+    auto maxValue = minValue;
+    auto maxTangent = 0.0f;
+    for (auto idx : keep)
+      {
+        minValue = glm::min(minValue, kf[idx].value);
+        maxValue = glm::max(maxValue, kf[idx].value);
+        maxTangent = glm::max(maxTangent, fabsf(kf[idx].getTangentIn()));
+        maxTangent = glm::max(maxTangent, fabsf(kf[idx].getTangentOut()));
+      }
+
+    CompressedChannel cc;
+    cc.timeBase = kf[keep.front()].time;
+    cc.timeEnd = kf[keep.back()].time;
+    cc.timeScale = (cc.timeEnd - cc.timeBase) / 65535.0f;
+    cc.valueBase = minValue;
+    cc.valueScale = (maxValue - minValue) / 65535.0f;
+    cc.tangentScale = maxTangent / 32767.0f;
+
+    keys.clear();
+    keys.reserve(keep.size());
+    for (auto idx : keep)
+      {
+        keys.push_back({quantizeUnorm(kf[idx].time,
+                                      cc.timeBase, cc.timeScale),
+                        quantizeUnorm(kf[idx].value,
+                                      cc.valueBase, cc.valueScale),
+                        quantizeSnorm(kf[idx].getTangentIn(),
+                                      cc.tangentScale),
+                        quantizeSnorm(kf[idx].getTangentOut(),
+                                      cc.tangentScale)});
+        expect("keyframes further apart than the time quantum",
+               keys.size() == 1
+               || keys.back().time > keys[keys.size() - 2].time);
+      }
+
+    cc.keys = keys.data();
+    cc.numKeys = (uint32_t) keys.size();
+    return cc;
+  }
+}
+
+dmp::CompressionStats dmp::Animation::compress(float tolerance)
+{
+  expect("tolerance positive", tolerance > 0.0f);
+  expect("source keyframes present", !mSourceReleased);
+  clearCompression();
+
+  CompressionStats stats;
+  std::vector<CompressedKey> keys;
+  std::vector<size_t> firstKey;
+  for (const auto & group : mChannelGroups)
+    {
+      for (auto idx : group.channels)
+        {
+          const auto & ch = mChannels[idx];
+          auto numKeys = ch.askData().keyframes.size();
+
+          // leave half the budget to quantization. If that was not enough,
+          // keep more keyframes, down to keeping them all
+          auto reduceTolerance = 0.5f * tolerance;
+          CompressedChannel cc;
+          CompressedEvaluator evaluator;
+          float err;
+          for (size_t attempt = 1; ; ++attempt)
+            {
+              cc = quantizeKeyframes(ch.askData(),
+                                     reduceKeyframes(ch, reduceTolerance),
+                                     keys);
+              evaluator = selectEvaluator<CompressedEvaluator>
+                (ch.askData().extrapIn, ch.askData().extrapOut,
+                 classifyKeys(cc.numKeys));
+              err = maxErrorOver(ch, 0, numKeys - 1,
+                                 [&cc, evaluator](float t)
+                                 {
+                                   return evaluator(cc, t);
+                                 });
+              if (err <= tolerance || reduceTolerance == 0.0f) break;
+              reduceTolerance = (attempt < 3) ? 0.25f * reduceTolerance : 0.0f;
+            }
+
+          stats.keysBefore += numKeys;
+          stats.keysAfter += cc.numKeys;
+          // what stays resident once the source keyframes are released:
+          // the emptied Channel and its index in its group stay, and the
+          // compressed channel adds its own index
+          stats.bytesBefore += sizeof(Channel) + sizeof(size_t)
+            + numKeys * sizeof(Keyframe);
+          stats.bytesAfter += sizeof(Channel) + 2 * sizeof(size_t)
+            + sizeof(CompressedChannel) + sizeof(CompressedEvaluator)
+            + cc.numKeys * sizeof(CompressedKey);
+          if (err > stats.maxError)
+            {
+              stats.maxError = err;
+              stats.worstChannel = idx;
+            }
+
+          firstKey.push_back(mCompressedKeys.size());
+          mCompressedKeys.insert(mCompressedKeys.end(), keys.begin(), keys.end());
+          mCompressedChannels.push_back(idx);
+          mCompressed.push_back(cc);
+          mCompressedEvaluators.push_back(evaluator);
+        }
+    }
+
+  // the pool is complete, point the channels into it
+  mCompressedKeys.shrink_to_fit();
+  for (size_t i = 0; i < mCompressed.size(); ++i)
+    {
+      mCompressed[i].keys = &mCompressedKeys[firstKey[i]];
+    }
 
-  mShaderProg.initShader(vertName.c_str(),
-                         nullptr, nullptr, nullptr,
-                         fragName.c_str());
+  return stats;
+}
 
-  expectNoErrors("load channel shader");
+void dmp::Animation::clearCompression()
+{
+  expect("source keyframes present", !mSourceReleased);
+  mCompressedChannels.clear();
+  mCompressed.clear();
+  mCompressedEvaluators.clear();
+  mCompressedKeys.clear();
 }
 
-dmp::Pose dmp::Animation::evaluate(float t)
+void dmp::Animation::releaseSourceKeyframes()
+{
+  expect("animation compressed", isCompressed());
+  for (auto idx : mCompressedChannels)
+    {
+      mChannels[idx].releaseKeyframes();
+    }
+  mSourceReleased = true;
+}
+
+void dmp::Animation::groupChannels()
+{
+  // INVARIANT: every channel must be precomputed before this!
+  mChannelGroups.clear();
+  mConstantChannels.clear();
+  mConstantValues.clear();
+
+  std::map<ChannelEvaluator, size_t> groupIdx;
+
+  for (size_t i = 0; i < mChannels.size(); ++i)
+    {
+      const auto & curr = mChannels[i];
+      if (curr.isConstant())
+        {
+          mConstantChannels.push_back(i);
+          mConstantValues.push_back(curr.askConstantValue());
+          continue;
+        }
+
+      auto evaluator = curr.askEvaluator();
+      expect("channel has evaluator", evaluator);
+
+      auto found = groupIdx.find(evaluator);
+      if (found == groupIdx.end())
+        {
+          groupIdx[evaluator] = mChannelGroups.size();
+          mChannelGroups.push_back({evaluator, {i}});
+        }
+      else
+        {
+          mChannelGroups[found->second].channels.push_back(i);
+        }
+    }
+}
+
+void dmp::Animation::findAnimatedJoints()
+{
+  expect("channels come in triples", mChannels.size() % 3 == 0);
+  mAnimatedJoints.clear();
+
+  // channels 0, 1, 2 are the root translation, joints start at channel 3
+  for (size_t joint = 0; (joint + 1) * 3 < mChannels.size(); ++joint)
+    {
+      auto first = (joint + 1) * 3;
+      if (!mChannels[first].isConstant()
+          || !mChannels[first + 1].isConstant()
+          || !mChannels[first + 2].isConstant())
+        {
+          mAnimatedJoints.push_back(joint);
+        }
+    }
+}
+
+// channel 0, 1, 2 -> root translation, channel 3n, 3n+1, 3n+2 -> joint n - 1
+static float & poseComponent(dmp::Pose & p, size_t channel)
+{
+  auto joint = channel / 3;
+  auto axis = (glm::length_t) (channel % 3);
+  if (joint == 0) return p.translation[axis];
+  return p.rotations[joint - 1][axis];
+}
+
+dmp::Pose dmp::Animation::evaluate(float t) const
 {
   Pose retval;
+  evaluate(t, retval);
+  return retval;
+}
+
+void dmp::Animation::evaluate(float t, Pose & out) const
+{
+  expect("channels come in triples", mChannels.size() % 3 == 0);
+  expect("at least a root translation", mChannels.size() >= 3);
+
+  out.rotations.resize((mChannels.size() / 3) - 1);
 
-  auto begin = mChannels.begin();
-  auto end = mChannels.end();
+  for (size_t i = 0; i < mConstantChannels.size(); ++i)
+    {
+      poseComponent(out, mConstantChannels[i]) = mConstantValues[i];
+    }
+
+  evaluateAnimated(t, out);
+}
+
+void dmp::Animation::evaluateAnimated(float t, Pose & out) const
+{
+  expect("pose matches animation",
+         (out.rotations.size() + 1) * 3 == mChannels.size());
 
   auto startTime = mRangeBegin;
   auto endTime = mRangeEnd;
   auto spanTime = endTime - startTime;
   float tPrime = startTime + fmodf(t, spanTime);
 
-  float x, y, z;
+  if (isResampled())
+    {
+      auto stride = mSampledChannels.size();
+      auto f = glm::clamp((tPrime - startTime) / mSampleStep,
+                          0.0f, (float) (mNumFrames - 1));
+      auto frame = glm::min((size_t) f, mNumFrames - 2);
+      auto l = f - (float) frame;
+      const float * lhs = &mSampled[frame * stride];
+      const float * rhs = lhs + stride;
+
+      for (size_t i = 0; i < stride; ++i)
+        {
+          poseComponent(out, mSampledChannels[i]) = glm::mix(lhs[i], rhs[i], l);
+        }
+      return;
+    }
+
+  if (isCompressed())
+    {
+      for (size_t i = 0; i < mCompressed.size(); ++i)
+        {
+          poseComponent(out, mCompressedChannels[i])
+            = mCompressedEvaluators[i](mCompressed[i], tPrime);
+        }
+      return;
+    }
+
+  for (const auto & group : mChannelGroups)
+    {
+      auto evaluator = group.evaluator;
+      for (auto idx : group.channels)
+        {
+          poseComponent(out, idx) = evaluator(mChannels[idx].askData(), tPrime);
+        }
+    }
+}
 
-  x = begin->evaluate(tPrime);
-  safeIncr(begin, end);
-  y = begin->evaluate(tPrime);
-  safeIncr(begin, end);
-  z = begin->evaluate(tPrime);
-  safeIncr(begin, end);
+dmp::ResampleError dmp::Animation::resample(float rateHz)
+{
+  expect("sample rate positive", rateHz > 0.0f);
+  expect("source keyframes present", !mSourceReleased);
+  clearResampling();
 
-  retval.translation = {x, y, z};
+  auto spanTime = mRangeEnd - mRangeBegin;
+  expect("animation range not empty", spanTime > 0.0f);
 
-  while (begin != end)
+  for (const auto & group : mChannelGroups)
     {
-      x = begin->evaluate(tPrime);
-      safeIncr(begin, end);
-      y = begin->evaluate(tPrime);
-      safeIncr(begin, end);
-      z = begin->evaluate(tPrime);
-      safeIncr(begin, end);
-      retval.rotations.emplace_back(x, y, z);
+      mSampledChannels.insert(mSampledChannels.end(),
+                              group.channels.begin(),
+                              group.channels.end());
     }
+  std::sort(mSampledChannels.begin(), mSampledChannels.end());
 
-  return retval;
+  // at least 2 frames so every lerp has a right hand side
+  mNumFrames = glm::max((size_t) ceilf(spanTime * rateHz), (size_t) 1) + 1;
+  mSampleStep = spanTime / (float) (mNumFrames - 1);
+
+  auto stride = mSampledChannels.size();
+  std::vector<float> table(mNumFrames * stride);
+  for (size_t frame = 0; frame < mNumFrames; ++frame)
+    {
+      auto t = mRangeBegin + (float) frame * mSampleStep;
+      for (size_t i = 0; i < stride; ++i)
+        {
+          table[frame * stride + i] = mChannels[mSampledChannels[i]].evaluate(t);
+        }
+    }
+
+  // measure at a few points inside each frame interval; the table is
+  // exact on the frames themselves
+  static const size_t subSamples = 4;
+  ResampleError err;
+  double sumSq = 0.0;
+  size_t count = 0;
+  for (size_t frame = 0; frame + 1 < mNumFrames; ++frame)
+    {
+      for (size_t sub = 1; sub <= subSamples; ++sub)
+        {
+          auto l = (float) sub / (float) (subSamples + 1);
+          auto t = mRangeBegin + ((float) frame + l) * mSampleStep;
+          for (size_t i = 0; i < stride; ++i)
+            {
+              auto approx = glm::mix(table[frame * stride + i],
+                                     table[(frame + 1) * stride + i],
+                                     l);
+              auto e = fabsf(approx - mChannels[mSampledChannels[i]].evaluate(t));
+              sumSq += (double) (e * e);
+              ++count;
+              if (e > err.maxError)
+                {
+                  err.maxError = e;
+                  err.worstChannel = mSampledChannels[i];
+                }
+            }
+        }
+    }
+  if (count > 0) err.rmsError = (float) sqrt(sumSq / (double) count);
+
+  mSampled = std::move(table);
+  return err;
+}
+
+void dmp::Animation::clearResampling()
+{
+  mSampledChannels.clear();
+  mSampled.clear();
+  mNumFrames = 0;
+  mSampleStep = 0.0f;
 }
 
 void dmp::Animation::printChannel(size_t idx)
@@ -872,10 +1610,28 @@ int dmp::Animation::prevCurveIndex(int prev)
 
 void dmp::Animation::drawCurveIndex(int idx)
 {
+  // the viewer moved off the last curve, free its geometry
+  if (mDrawnCurve >= 0 && idx != mDrawnCurve)
+    {
+      mChannels[(size_t) mDrawnCurve].releaseCurve();
+    }
+  mDrawnCurve = -1;
+
   if (idx < 0) return;
   if ((size_t) idx >= mChannels.size()) return;
+  if (mSourceReleased) return;
+
+  if (!mShaderProg.isValid())
+    {
+      auto vertName = channelShader + std::string(".vert");
+      auto fragName = channelShader + std::string(".frag");
+
+      mShaderProg.initShader(vertName.c_str(),
+                             nullptr, nullptr, nullptr,
+                             fragName.c_str());
 
-  expect("shader program valid", ((GLuint) mShaderProg) != 0);
+      expectNoErrors("load channel shader");
+    }
 
   expectNoErrors("enter draw curve");
   glUseProgram(mShaderProg);
@@ -884,22 +1640,16 @@ void dmp::Animation::drawCurveIndex(int idx)
   expect("index not negative", idx >= 0);
 
   mChannels[(size_t) idx].draw();
+  mDrawnCurve = idx;
 }
 
 void dmp::Channel::draw()
 {
+  if (mVAO == 0) buildCurve();
+
   glBindVertexArray(mVAO);
   expectNoErrors("bind VAO");
 
   glDrawArrays(GL_LINES, 0, drawCount);
   expectNoErrors("draw");
-
-  for (auto & curr : mData.keyframes)
-    {
-      glBindVertexArray(curr.mVAO);
-      expectNoErrors("bind VAO");
-
-      glDrawArrays(GL_LINES, 0, curr.drawCount);
-      expectNoErrors("draw");
-    }
 }
@@ -2,6 +2,8 @@
 #define DMP_ANIMATION_HPP
 
 #include <vector>
+#include <memory>
+#include <cstdint>
 #include <string>
 #include <glm/glm.hpp>
 #include "Pose.hpp"
@@ -38,10 +40,6 @@ namespace dmp
       expect("tangentOut evaluated", tangentOut.which() == 0);
       return boost::get<float>(tangentOut);
     }
-
-    GLuint mVAO = 0;
-    GLuint mVBO = 0;
-    GLsizei drawCount = 0;
   };
 
   enum class Extrapolation
@@ -56,6 +54,40 @@ namespace dmp
     std::vector<Keyframe> keyframes;
   };
 
+  // Evaluates a fully precomputed channel at time t. Each instantiation has
+  // its extrapolation modes and keyframe count class baked in at compile time
+  typedef float (*ChannelEvaluator)(const ChannelData & cd, float t);
+
+  // A keyframe quantized against its channel's ranges: times and values are
+  // unorm16, tangents snorm16
+  struct CompressedKey
+  {
+    uint16_t time;
+    uint16_t value;
+    int16_t tangentIn;
+    int16_t tangentOut;
+  };
+
+  // A channel with its redundant keyframes removed and the rest quantized.
+  // time = timeBase + key.time * timeScale, and likewise for values and
+  // tangents (tangents have no base). timeEnd is the last key's exact time,
+  // so rounding never moves the end of the range. The extrapolation modes
+  // live in the channel's evaluator, and the keys in a pool owned by the
+  // animation
+  struct CompressedChannel
+  {
+    float timeBase;
+    float timeEnd;
+    float timeScale;
+    float valueBase;
+    float valueScale;
+    float tangentScale;
+    const CompressedKey * keys;
+    uint32_t numKeys;
+  };
+
+  typedef float (*CompressedEvaluator)(const CompressedChannel & cc, float t);
+
   #define CURVE_TYPE 0
   #define TAN_IN_TYPE 1
   #define TAN_OUT_TYPE 2
@@ -76,31 +108,66 @@ namespace dmp
 
     ~Channel()
     {
-      if (mVAO != 0) glDeleteVertexArrays(1, &mVAO);
-      if (mVBO != 0) glDeleteBuffers(1, &mVBO);
-
-      for (auto & curr : mData.keyframes)
-        {
-          if (curr.mVAO != 0) glDeleteVertexArrays(1, &curr.mVAO);
-          if (curr.mVBO != 0) glDeleteBuffers(1, &curr.mVBO);
-        }
+      releaseCurve();
     }
 
     Channel(const ChannelData & cd);
     void precompute();
-    float evaluate(float t);
+    float evaluate(float t) const
+    {
+      expect("channel precomputed", mEvaluator);
+      return mEvaluator(mData, t);
+    }
     void printChannel();
+
+    // The curve's geometry is built on the first draw and kept until
+    // releaseCurve
     void draw();
+    void releaseCurve();
+
+    // INVARIANT: only valid after precompute
+    ChannelEvaluator askEvaluator() const {return mEvaluator;}
+    const ChannelData & askData() const {return mData;}
+
+    // True if this channel holds one value for all time. Such channels are
+    // evaluated as a plain load of askConstantValue()
+    bool isConstant() const;
+    float askConstantValue() const;
+
+    // Frees the keyframes. The channel can no longer be evaluated or drawn
+    void releaseKeyframes();
   private:
-    float evaluateImpl(float t);
     void computeTangents();
     void computeCubicCoefficients();
+    void buildCurve();
     ChannelData mData;
+    ChannelEvaluator mEvaluator = nullptr;
     GLuint mVAO = 0;
     GLuint mVBO = 0;
     GLsizei drawCount = 0;
   };
 
+  // How far a resampled animation strays from the exact Hermite curves
+  struct ResampleError
+  {
+    float maxError = 0.0f;
+    float rmsError = 0.0f;
+    size_t worstChannel = 0;
+  };
+
+  // What compress() did to the animated channels. Errors are versus the
+  // exact Hermite curves. Bytes after are what stays resident once the
+  // source keyframes are released
+  struct CompressionStats
+  {
+    size_t keysBefore = 0;
+    size_t keysAfter = 0;
+    size_t bytesBefore = 0;
+    size_t bytesAfter = 0;
+    float maxError = 0.0f;
+    size_t worstChannel = 0;
+  };
+
   class Animation
   {
   public:
@@ -112,20 +179,99 @@ namespace dmp
 
     Animation(const std::string & path);
 
-    Pose evaluate(float t);
+    Pose evaluate(float t) const;
+    void evaluate(float t, Pose & out) const;
+
+    // Only writes the non-constant channels of out. out must already hold a
+    // full pose of this animation, e.g. from askRestPose()
+    void evaluateAnimated(float t, Pose & out) const;
+
+    // The pose every constant channel is folded into. Animated channels hold
+    // their value at t = 0
+    Pose askRestPose() const {return evaluate(0.0f);}
+
+    float askDuration() const {return mRangeEnd - mRangeBegin;}
+
+    // Indices into Pose::rotations of the joints with at least one
+    // non-constant rotation channel. All other joints are static
+    const std::vector<size_t> & askAnimatedJoints() const
+    {
+      return mAnimatedJoints;
+    }
+
+    // Bake every non-constant channel at rateHz into a dense frame-major
+    // table. While resampled, evaluation is a lerp between two frames with
+    // no segment search or Hermite evaluation. Returns the error versus the
+    // exact curves, measured between frames
+    ResampleError resample(float rateHz);
+    void clearResampling();
+    bool isResampled() const {return !mSampled.empty();}
+
+    // Drop every keyframe of the animated channels that the curve can do
+    // without, staying within tolerance of the exact curve, then quantize
+    // the rest to 16 bits. While compressed, evaluation decodes the
+    // quantized keys directly
+    CompressionStats compress(float tolerance);
+    void clearCompression();
+    bool isCompressed() const {return !mCompressed.empty();}
+
+    // Free the full precision keyframes of the animated channels, leaving
+    // only the compressed ones. Curves can no longer be drawn or resampled
+    void releaseSourceKeyframes();
 
     int nextCurveIndex(int prev);
     int prevCurveIndex(int next);
+    // Only the curve last drawn holds GL objects; the shader is loaded on
+    // the first call
     void drawCurveIndex(int idx);
     void printChannel(size_t idx);
   private:
+    // Channels sharing an evaluator, i.e. the same (extrapIn, extrapOut,
+    // keycount class). Evaluated back to back so the hot loop never switches
+    // on modes
+    struct ChannelGroup
+    {
+      ChannelEvaluator evaluator;
+      std::vector<size_t> channels;
+    };
+
     void printAnimation();
     void initAnimation(const std::string & path);
+    void groupChannels();
+    void findAnimatedJoints();
     float mRangeBegin;
     float mRangeEnd;
     std::vector<Channel> mChannels;
+    std::vector<ChannelGroup> mChannelGroups;
+    std::vector<size_t> mConstantChannels;
+    std::vector<float> mConstantValues;
+    std::vector<size_t> mAnimatedJoints;
+
+    // resampled table: mSampled[frame * mSampledChannels.size() + i] is
+    // channel mSampledChannels[i] at mRangeBegin + frame * mSampleStep
+    std::vector<size_t> mSampledChannels;
+    std::vector<float> mSampled;
+    size_t mNumFrames = 0;
+    float mSampleStep = 0.0f;
+
+    // compressed channels, in channel group order. mCompressed[i].keys
+    // points into mCompressedKeys
+    std::vector<size_t> mCompressedChannels;
+    std::vector<CompressedChannel> mCompressed;
+    std::vector<CompressedEvaluator> mCompressedEvaluators;
+    std::vector<CompressedKey> mCompressedKeys;
+    bool mSourceReleased = false;
+
+    int mDrawnCurve = -1;
     Shader mShaderProg;
   };
+
+  // Loads the clip at path, resampled at rateHz and compressed to
+  // tolerance where those are positive. A compressed clip keeps only its
+  // compressed keys. Reports the error each adds on std::cerr
+  std::unique_ptr<Animation> loadClip(const std::string & path,
+                                      float rateHz,
+                                      float tolerance);
 }
 
 #endif
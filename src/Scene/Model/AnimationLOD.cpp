@@ -0,0 +1,104 @@
+#include "AnimationLOD.hpp"
+#include <limits>
+#include <algorithm>
+
+// smallest projected size, as a fraction of the viewport height, that
+// still gets updated every frame, every 2nd frame and every 4th frame
+static const float sizeEveryFrame = 0.25f;
+static const float sizeEvery2nd = 0.12f;
+static const float sizeEvery4th = 0.06f;
+
+// the same for the full mesh and the first two coarser levels. Each level
+// has about half the triangles of the one before
+static const float sizeFullMesh = 0.3f;
+static const float sizeMeshLevel1 = 0.15f;
+static const float sizeMeshLevel2 = 0.075f;
+
+void dmp::AnimationLOD::tellView(const glm::mat4 & V, const glm::mat4 & P)
+{
+  mV = V;
+  mScale = P[1][1];
+}
+
+float dmp::AnimationLOD::projectedSize(const glm::vec3 & center,
+                                       float radius) const
+{
+  auto depth = -(mV * glm::vec4(center, 1.0f)).z;
+  if (depth < -radius) return 0.0f;
+  if (depth <= radius) return std::numeric_limits<float>::infinity();
+
+  // the viewport spans 2 * depth / mScale at this depth
+  return radius * mScale / depth;
+}
+
+size_t dmp::AnimationLOD::askInterval(const glm::vec3 & center,
+                                      float radius) const
+{
+  if (!mEnabled || mScale == 0.0f) return 1;
+
+  auto size = projectedSize(center, radius);
+  if (size >= sizeEveryFrame) return 1;
+  if (size >= sizeEvery2nd) return 2;
+  if (size >= sizeEvery4th) return 4;
+  return maxInterval;
+}
+
+size_t dmp::AnimationLOD::askMeshLevel(const glm::vec3 & center,
+                                      float radius) const
+{
+  if (mScale == 0.0f) return 0;
+
+  auto size = projectedSize(center, radius);
+  if (size >= sizeFullMesh) return 0;
+  if (size >= sizeMeshLevel1) return 1;
+  if (size >= sizeMeshLevel2) return 2;
+  return maxMeshLevel;
+}
+
+void dmp::AnimationLOD::step(JointPose & current,
+                             const JointPose & target,
+                             size_t framesLeft)
+{
+  expect("frames left not 0", framesLeft > 0);
+
+  if (framesLeft == 1 || current.rotations.size() != target.rotations.size())
+    {
+      current.translation = target.translation;
+      current.rotations.assign(target.rotations.begin(),
+                               target.rotations.end());
+      return;
+    }
+
+  // a step of 1 / framesLeft of what is left keeps the poses in between
+  // evenly spaced, give or take the nlerp's easing
+  auto a = 1.0f / (float) framesLeft;
+  current.translation = glm::mix(current.translation, target.translation, a);
+  for (size_t i = 0; i < current.rotations.size(); ++i)
+    {
+      current.rotations[i] = nlerp(a,
+                                   current.rotations[i],
+                                   target.rotations[i]);
+    }
+}
+
+void dmp::AnimationLOD::boundingSphere(const std::vector<glm::vec3> & verts,
+                                       glm::vec3 & center,
+                                       float & radius)
+{
+  expect("verts not empty", !verts.empty());
+
+  auto lo = verts[0];
+  auto hi = verts[0];
+  for (const auto & curr : verts)
+    {
+      lo = glm::min(lo, curr);
+      hi = glm::max(hi, curr);
+    }
+
+  center = 0.5f * (lo + hi);
+  radius = 0.0f;
+  for (const auto & curr : verts)
+    {
+      radius = std::max(radius, glm::length(curr - center));
+    }
+}
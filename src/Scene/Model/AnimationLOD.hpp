@@ -0,0 +1,65 @@
+#ifndef DMP_ANIMATIONLOD_HPP
+#define DMP_ANIMATIONLOD_HPP
+
+#include <vector>
+#include <glm/glm.hpp>
+#include "Pose.hpp"
+#include "../../util.hpp"
+
+namespace dmp
+{
+  // How often an animated character gets a fresh pose, picked from how
+  // big it is on screen. Near characters update every frame; small ones
+  // every 2nd, 4th or 8th frame, and move their joints a step toward
+  // the next pose on the frames in between. Which of its meshes' levels
+  // of detail it draws goes by the same size
+  class AnimationLOD
+  {
+  public:
+    static const size_t maxInterval = 8;
+
+    // Everything updates every frame until a view is told
+    void tellView(const glm::mat4 & V, const glm::mat4 & P);
+    void tellEnabled(bool enabled) {mEnabled = enabled;}
+    bool isEnabled() const {return mEnabled;}
+
+    // Height of a world space sphere as a fraction of the viewport height.
+    // Spheres around the eye fill the screen, spheres behind it are 0
+    float projectedSize(const glm::vec3 & center, float radius) const;
+
+    // 1, 2, 4 or maxInterval frames between updates
+    size_t askInterval(const glm::vec3 & center, float radius) const;
+
+    // The level of detail to draw, 0 for the full mesh, up to
+    // maxMeshLevel for the smallest. 0 until a view is told, enabled or not
+    static const size_t maxMeshLevel = 3;
+    size_t askMeshLevel(const glm::vec3 & center, float radius) const;
+
+    // Frames from frame until the next update of something on an interval
+    // grid shifted by phase, so that characters with the same interval
+    // don't all update on the same frame. Between 1 and interval
+    static size_t framesToUpdate(size_t frame, size_t phase, size_t interval)
+    {
+      expect("interval not 0", interval > 0);
+      return interval - (frame + phase) % interval;
+    }
+
+    // Moves current one of framesLeft equal steps toward target: each
+    // joint's rotation along an nlerp, the root along a line. framesLeft of
+    // 1 lands on it, as does a current with no joints yet
+    static void step(JointPose & current,
+                     const JointPose & target,
+                     size_t framesLeft);
+
+    // A sphere around every vertex, for projectedSize
+    static void boundingSphere(const std::vector<glm::vec3> & verts,
+                               glm::vec3 & center,
+                               float & radius);
+  private:
+    glm::mat4 mV;
+    float mScale = 0.0f; // P[1][1]: 1 / tan(fovy / 2)
+    bool mEnabled = true;
+  };
+}
+
+#endif
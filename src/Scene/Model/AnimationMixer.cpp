@@ -0,0 +1,647 @@
+#include "AnimationMixer.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// joints per blend step
+static const size_t mixLanes = 4;
+
+// quaternions shorter than this squared are left at zero by normalize,
+// which only happens to padding
+static const float mixMinLengthSq = 1e-20f;
+
+// -----------------------------------------------------------------------------
+// Four joints at a time
+// -----------------------------------------------------------------------------
+
+#ifdef __SSE2__
+typedef __m128 Lane4;
+
+static inline Lane4 load4(const float * p) {return _mm_loadu_ps(p);}
+static inline void store4(float * p, Lane4 v) {_mm_storeu_ps(p, v);}
+static inline Lane4 splat4(float f) {return _mm_set1_ps(f);}
+static inline Lane4 add4(Lane4 a, Lane4 b) {return _mm_add_ps(a, b);}
+static inline Lane4 sub4(Lane4 a, Lane4 b) {return _mm_sub_ps(a, b);}
+static inline Lane4 mul4(Lane4 a, Lane4 b) {return _mm_mul_ps(a, b);}
+
+// v, negated in the lanes where s is negative
+static inline Lane4 flipSign4(Lane4 v, Lane4 s)
+{
+  return _mm_xor_ps(v, _mm_and_ps(s, _mm_set1_ps(-0.0f)));
+}
+
+static inline Lane4 invLength4(Lane4 lengthSq)
+{
+  auto l = _mm_sqrt_ps(_mm_max_ps(lengthSq, _mm_set1_ps(mixMinLengthSq)));
+  return _mm_div_ps(_mm_set1_ps(1.0f), l);
+}
+#else
+struct Lane4
+{
+  float v[mixLanes];
+};
+
+template <typename Fn>
+static inline Lane4 map4(Fn fn)
+{
+  Lane4 r;
+  for (size_t i = 0; i < mixLanes; ++i)
+    {
+      r.v[i] = fn(i);
+    }
+  return r;
+}
+
+static inline Lane4 load4(const float * p)
+{
+  return map4([p](size_t i) {return p[i];});
+}
+static inline void store4(float * p, Lane4 v)
+{
+  std::copy(v.v, v.v + mixLanes, p);
+}
+static inline Lane4 splat4(float f) {return map4([f](size_t) {return f;});}
+static inline Lane4 add4(Lane4 a, Lane4 b)
+{
+  return map4([&](size_t i) {return a.v[i] + b.v[i];});
+}
+static inline Lane4 sub4(Lane4 a, Lane4 b)
+{
+  return map4([&](size_t i) {return a.v[i] - b.v[i];});
+}
+static inline Lane4 mul4(Lane4 a, Lane4 b)
+{
+  return map4([&](size_t i) {return a.v[i] * b.v[i];});
+}
+static inline Lane4 flipSign4(Lane4 v, Lane4 s)
+{
+  return map4([&](size_t i) {return (s.v[i] < 0.0f) ? -v.v[i] : v.v[i];});
+}
+static inline Lane4 invLength4(Lane4 lengthSq)
+{
+  return map4([&](size_t i)
+              {
+                return 1.0f / sqrtf(std::max(lengthSq.v[i], mixMinLengthSq));
+              });
+}
+#endif
+
+// Four joints' quaternions
+struct Quat4
+{
+  Lane4 w, x, y, z;
+};
+
+static inline Quat4 load(const dmp::BlendPose & p, size_t i)
+{
+  return {load4(p.w() + i), load4(p.x() + i), load4(p.y() + i),
+      load4(p.z() + i)};
+}
+
+static inline void store(dmp::BlendPose & p, size_t i, const Quat4 & q)
+{
+  store4(p.w() + i, q.w);
+  store4(p.x() + i, q.x);
+  store4(p.y() + i, q.y);
+  store4(p.z() + i, q.z);
+}
+
+static inline Lane4 dot(const Quat4 & a, const Quat4 & b)
+{
+  return add4(add4(mul4(a.w, b.w), mul4(a.x, b.x)),
+              add4(mul4(a.y, b.y), mul4(a.z, b.z)));
+}
+
+static inline Quat4 scale(const Quat4 & q, Lane4 s)
+{
+  return {mul4(q.w, s), mul4(q.x, s), mul4(q.y, s), mul4(q.z, s)};
+}
+
+static inline Quat4 add(const Quat4 & a, const Quat4 & b)
+{
+  return {add4(a.w, b.w), add4(a.x, b.x), add4(a.y, b.y), add4(a.z, b.z)};
+}
+
+static inline Quat4 normalize(const Quat4 & q)
+{
+  return scale(q, invLength4(dot(q, q)));
+}
+
+// a * b
+static inline Quat4 multiply(const Quat4 & a, const Quat4 & b)
+{
+  return {
+    sub4(sub4(mul4(a.w, b.w), mul4(a.x, b.x)),
+         add4(mul4(a.y, b.y), mul4(a.z, b.z))),
+    add4(add4(mul4(a.w, b.x), mul4(a.x, b.w)),
+         sub4(mul4(a.y, b.z), mul4(a.z, b.y))),
+    add4(add4(mul4(a.w, b.y), mul4(a.y, b.w)),
+         sub4(mul4(a.z, b.x), mul4(a.x, b.z))),
+    add4(add4(mul4(a.w, b.z), mul4(a.z, b.w)),
+         sub4(mul4(a.x, b.y), mul4(a.y, b.x)))
+  };
+}
+
+static inline Quat4 conjugate(const Quat4 & q)
+{
+  auto zero = splat4(0.0f);
+  return {q.w, sub4(zero, q.x), sub4(zero, q.y), sub4(zero, q.z)};
+}
+
+// dst += weight * src, src on the same side of the sphere as dst
+static void accumulate(dmp::BlendPose & dst,
+                       const dmp::BlendPose & src,
+                       float weight)
+{
+  auto w = splat4(weight);
+  for (size_t i = 0; i < dst.stride; i += mixLanes)
+    {
+      auto d = load(dst, i);
+      auto s = load(src, i);
+      store(dst, i, add(d, scale(s, flipSign4(w, dot(d, s)))));
+    }
+}
+
+static void normalize(dmp::BlendPose & p)
+{
+  for (size_t i = 0; i < p.stride; i += mixLanes)
+    {
+      store(p, i, normalize(load(p, i)));
+    }
+}
+
+// Each joint of dst weights[joint] of the way to src
+static void nlerpTo(dmp::BlendPose & dst,
+                    const dmp::BlendPose & src,
+                    const float * weights)
+{
+  auto one = splat4(1.0f);
+  for (size_t i = 0; i < dst.stride; i += mixLanes)
+    {
+      auto d = load(dst, i);
+      auto s = load(src, i);
+      auto t = load4(weights + i);
+      auto blended = add(scale(d, sub4(one, t)),
+                         scale(s, flipSign4(t, dot(d, s))));
+      store(dst, i, normalize(blended));
+    }
+}
+
+// out = conjugate(ref) * src, the turn from ref to src
+static void difference(dmp::BlendPose & out,
+                       const dmp::BlendPose & ref,
+                       const dmp::BlendPose & src)
+{
+  for (size_t i = 0; i < out.stride; i += mixLanes)
+    {
+      store(out, i, multiply(conjugate(load(ref, i)), load(src, i)));
+    }
+}
+
+// Each joint of dst turned on by weights[joint] of delta
+static void addTo(dmp::BlendPose & dst,
+                  const dmp::BlendPose & delta,
+                  const float * weights)
+{
+  auto one = splat4(1.0f);
+  for (size_t i = 0; i < dst.stride; i += mixLanes)
+    {
+      auto e = load(delta, i);
+      auto t = load4(weights + i);
+
+      // nlerp from identity, whose dot with e is e.w
+      auto ts = flipSign4(t, e.w);
+      Quat4 part = {add4(sub4(one, t), mul4(ts, e.w)),
+                    mul4(ts, e.x), mul4(ts, e.y), mul4(ts, e.z)};
+      store(dst, i, multiply(load(dst, i), normalize(part)));
+    }
+}
+
+// -----------------------------------------------------------------------------
+// PosePool
+// -----------------------------------------------------------------------------
+
+dmp::PosePool::PosePool(size_t numJoints)
+{
+  initPosePool(numJoints);
+}
+
+void dmp::PosePool::initPosePool(size_t numJoints)
+{
+  expect("pool joints not empty", numJoints > 0);
+  mNumJoints = numJoints;
+}
+
+dmp::BlendPose * dmp::PosePool::acquire()
+{
+  if (mFree.empty())
+    {
+      auto p = std::make_unique<BlendPose>();
+      p->stride = (mNumJoints + mixLanes - 1) / mixLanes * mixLanes;
+      p->data.assign(4 * p->stride, 0.0f);
+      mFree.push_back(p.get());
+      mAll.push_back(std::move(p));
+    }
+
+  auto p = mFree.back();
+  mFree.pop_back();
+  return p;
+}
+
+void dmp::PosePool::release(BlendPose * p)
+{
+  expect("released pose not null", p);
+  mFree.push_back(p);
+}
+
+// -----------------------------------------------------------------------------
+// AnimationMixer
+// -----------------------------------------------------------------------------
+
+dmp::AnimationMixer::AnimationMixer(std::shared_ptr<const Rig> rig,
+                                    std::shared_ptr<PosePool> pool)
+{
+  initAnimationMixer(std::move(rig), std::move(pool));
+}
+
+void dmp::AnimationMixer::initAnimationMixer(std::shared_ptr<const Rig> rig,
+                                             std::shared_ptr<PosePool> pool)
+{
+  expect("rig not null", rig);
+  mRig = std::move(rig);
+
+  auto n = mRig->askNumJoints();
+  if (!pool) pool = std::make_shared<PosePool>(n);
+  expect("pool fits the rig", pool->askNumJoints() == n);
+  mPool = std::move(pool);
+
+  mMoved.assign(n, 0);
+}
+
+dmp::AnimationMixer::Layer & dmp::AnimationMixer::layerAt(size_t layer)
+{
+  expect("layer in range", layer < mLayers.size());
+  return mLayers[layer];
+}
+
+dmp::AnimationMixer::Clip & dmp::AnimationMixer::clipAt(size_t layer,
+                                                        size_t clip)
+{
+  auto & l = layerAt(layer);
+  expect("clip in range", clip < l.clips.size());
+  return l.clips[clip];
+}
+
+size_t dmp::AnimationMixer::addLayer(LayerMode mode, float weight)
+{
+  Layer l;
+  l.mode = mode;
+  l.weight = weight;
+  mLayers.push_back(std::move(l));
+  return mLayers.size() - 1;
+}
+
+void dmp::AnimationMixer::tellLayerWeight(size_t layer, float weight)
+{
+  layerAt(layer).weight = weight;
+}
+
+void dmp::AnimationMixer::tellLayerMask(size_t layer,
+                                        const std::vector<float> & mask)
+{
+  auto & l = layerAt(layer);
+  if (mask.empty())
+    {
+      l.mask.clear();
+      return;
+    }
+
+  auto n = mRig->askNumJoints();
+  expect("one mask weight per joint", mask.size() == n);
+  l.mask.assign((n + mixLanes - 1) / mixLanes * mixLanes, 0.0f);
+  for (size_t j = 0; j < n; ++j)
+    {
+      l.mask[j] = glm::clamp(mask[j], 0.0f, 1.0f);
+    }
+}
+
+void dmp::AnimationMixer::tellLayerReference(size_t layer,
+                                             const Pose & reference)
+{
+  auto & l = layerAt(layer);
+  expect("reference fits the rig",
+         reference.rotations.size() == mRig->askNumJoints());
+  l.reference = reference;
+  l.hasReference = true;
+  l.referenceDirty = true;
+}
+
+size_t dmp::AnimationMixer::addClip(size_t layer,
+                                    const Animation & anim,
+                                    float weight)
+{
+  auto & l = layerAt(layer);
+
+  Clip c;
+  c.anim = &anim;
+  c.weight = weight;
+  c.pose = anim.askRestPose();
+  expect("clip fits the rig",
+         c.pose.rotations.size() == mRig->askNumJoints());
+
+  // the first clip's rest pose is what every joint left out of mJoints
+  // holds, so a joint joins if any clip animates it or rests elsewhere
+  const Clip * first = nullptr;
+  for (const auto & other : mLayers)
+    {
+      if (!other.clips.empty())
+        {
+          first = &other.clips.front();
+          break;
+        }
+    }
+  for (auto j : anim.askAnimatedJoints())
+    {
+      mMoved[j] = 1;
+    }
+  if (first)
+    {
+      for (size_t j = 0; j < mMoved.size(); ++j)
+        {
+          if (c.pose.rotations[j] != first->pose.rotations[j]) mMoved[j] = 1;
+        }
+    }
+  mJoints.clear();
+  for (size_t j = 0; j < mMoved.size(); ++j)
+    {
+      if (mMoved[j]) mJoints.push_back(j);
+    }
+  for (auto & other : mLayers)
+    {
+      other.referenceDirty = true;
+    }
+
+  l.clips.push_back(std::move(c));
+  return l.clips.size() - 1;
+}
+
+void dmp::AnimationMixer::tellClipWeight(size_t layer,
+                                         size_t clip,
+                                         float weight)
+{
+  clipAt(layer, clip).weight = weight;
+}
+
+void dmp::AnimationMixer::tellClipTime(size_t layer, size_t clip, float t)
+{
+  clipAt(layer, clip).time = t;
+}
+
+void dmp::AnimationMixer::tellClipSpeed(size_t layer,
+                                        size_t clip,
+                                        float speed)
+{
+  clipAt(layer, clip).speed = speed;
+}
+
+void dmp::AnimationMixer::update(float deltaT)
+{
+  for (auto & l : mLayers)
+    {
+      for (auto & c : l.clips)
+        {
+          c.time += deltaT * c.speed;
+        }
+    }
+}
+
+void dmp::AnimationMixer::toBlendPose(const Pose & p, BlendPose & out) const
+{
+  auto n = mRig->askNumJoints();
+  auto stride = (n + mixLanes - 1) / mixLanes * mixLanes;
+  if (out.data.size() != 4 * stride)
+    {
+      out.stride = stride;
+      out.data.assign(4 * stride, 0.0f);
+    }
+
+  // joints outside mJoints are the same in every clip, and never read
+  out.translation = p.translation;
+  for (auto j : mJoints)
+    {
+      auto q = mRig->jointRotation(j, p.rotations[j]);
+      out.w()[j] = q.real;
+      out.x()[j] = q.imaginary.x;
+      out.y()[j] = q.imaginary.y;
+      out.z()[j] = q.imaginary.z;
+    }
+}
+
+void dmp::AnimationMixer::blendClips(Layer & layer,
+                                     BlendPose & out,
+                                     BlendPose & scratch)
+{
+  float total = 0.0f;
+  for (const auto & c : layer.clips)
+    {
+      if (c.weight > 0.0f) total += c.weight;
+    }
+
+  std::fill(out.data.begin(), out.data.end(), 0.0f);
+  out.translation = glm::vec3(0.0f);
+  for (auto & c : layer.clips)
+    {
+      if (c.weight <= 0.0f) continue;
+      auto w = c.weight / total;
+      c.anim->evaluateAnimated(c.time, c.pose);
+      toBlendPose(c.pose, scratch);
+      accumulate(out, scratch, w);
+      out.translation += w * c.pose.translation;
+    }
+  normalize(out);
+}
+
+void dmp::AnimationMixer::evaluate(Pose & out)
+{
+  auto n = mRig->askNumJoints();
+  expect("out holds a full pose", out.rotations.size() == n);
+
+  auto result = mPool->acquire();
+  auto layerPose = mPool->acquire();
+  auto scratch = mPool->acquire();
+  const Pose * nearPose = nullptr; // the base layer's heaviest clip
+  bool haveBase = false;
+
+  for (auto & l : mLayers)
+    {
+      const Clip * heaviest = nullptr;
+      for (const auto & c : l.clips)
+        {
+          if (c.weight > 0.0f && (!heaviest || c.weight > heaviest->weight))
+            {
+              heaviest = &c;
+            }
+        }
+      if (!heaviest || l.weight <= 0.0f) continue;
+      if (!haveBase && l.mode == LayerMode::additive) continue;
+
+      blendClips(l, *layerPose, *scratch);
+
+      mWeights.assign(layerPose->stride, 0.0f);
+      for (size_t j = 0; j < n; ++j)
+        {
+          mWeights[j] = l.weight * (l.mask.empty() ? 1.0f : l.mask[j]);
+        }
+      auto rootWeight = mWeights[0];
+
+      if (l.mode == LayerMode::override)
+        {
+          if (!haveBase)
+            {
+              std::swap(result, layerPose);
+              nearPose = &heaviest->pose;
+              haveBase = true;
+            }
+          else
+            {
+              nlerpTo(*result, *layerPose, mWeights.data());
+              result->translation = glm::mix(result->translation,
+                                             layerPose->translation,
+                                             rootWeight);
+            }
+        }
+      else
+        {
+          if (!l.hasReference)
+            {
+              l.reference = l.clips.front().anim->askRestPose();
+              l.hasReference = true;
+            }
+          if (l.referenceDirty)
+            {
+              if (!l.referenceQ) l.referenceQ = std::make_unique<BlendPose>();
+              toBlendPose(l.reference, *l.referenceQ);
+              l.referenceDirty = false;
+            }
+          difference(*scratch, *l.referenceQ, *layerPose);
+          addTo(*result, *scratch, mWeights.data());
+          result->translation += rootWeight
+            * (layerPose->translation - l.referenceQ->translation);
+        }
+    }
+
+  if (haveBase)
+    {
+      for (auto j : mJoints)
+        {
+          Quaternion q;
+          q.real = result->w()[j];
+          q.imaginary = {result->x()[j], result->y()[j], result->z()[j]};
+          auto hint = mRig->clampRotation(j, nearPose->rotations[j]);
+          out.rotations[j] = toEulerZYX(q, hint);
+        }
+      out.translation = result->translation;
+    }
+
+  mPool->release(scratch);
+  mPool->release(layerPose);
+  mPool->release(result);
+}
+
+// -----------------------------------------------------------------------------
+// Benchmark
+// -----------------------------------------------------------------------------
+
+dmp::MixerTiming dmp::benchmarkMixer(std::shared_ptr<const Rig> rig,
+                                     const Animation & anim,
+                                     size_t iterations)
+{
+  using Clock = std::chrono::steady_clock;
+  expect("at least one iteration", iterations > 0);
+
+  auto n = rig->askNumJoints();
+  auto deltaT = anim.askDuration() / (float) iterations;
+
+  AnimationMixer single(rig);
+  single.addClip(single.addLayer(LayerMode::override), anim);
+
+  AnimationMixer layered(rig);
+  auto base = layered.addLayer(LayerMode::override);
+  layered.addClip(base, anim, 0.5f);
+  layered.tellClipTime(base, layered.addClip(base, anim, 0.5f),
+                       0.5f * anim.askDuration());
+  layered.addClip(layered.addLayer(LayerMode::additive, 0.5f), anim);
+  auto over = layered.addLayer(LayerMode::override, 0.7f);
+  layered.tellClipTime(over, layered.addClip(over, anim),
+                       0.25f * anim.askDuration());
+  std::vector<float> mask(n, 0.0f);
+  for (size_t j = 0; j < n; j += 2) mask[j] = 1.0f;
+  layered.tellLayerMask(over, mask);
+
+  // every way writes into its own pose, warmed once so none pays for
+  // first touches
+  auto clipPose = anim.askRestPose();
+  auto singlePose = clipPose;
+  auto layeredPose = clipPose;
+  anim.evaluateAnimated(0.0f, clipPose);
+  single.evaluate(singlePose);
+  layered.evaluate(layeredPose);
+
+  MixerTiming timing;
+  timing.joints = n;
+
+  auto start = Clock::now();
+  for (size_t i = 0; i < iterations; ++i)
+    {
+      anim.evaluateAnimated((float) i * deltaT, clipPose);
+    }
+  auto mid = Clock::now();
+  for (size_t i = 0; i < iterations; ++i)
+    {
+      single.tellClipTime(0, 0, (float) i * deltaT);
+      single.evaluate(singlePose);
+    }
+  auto late = Clock::now();
+  for (size_t i = 0; i < iterations; ++i)
+    {
+      layered.update(deltaT);
+      layered.evaluate(layeredPose);
+    }
+  auto end = Clock::now();
+
+  // the mixer hands back its own Euler angles for each joint, so compare
+  // the rotations they make
+  for (size_t i = 0; i < iterations; ++i)
+    {
+      auto t = (float) i * deltaT;
+      anim.evaluateAnimated(t, clipPose);
+      single.tellClipTime(0, 0, t);
+      single.evaluate(singlePose);
+
+      for (size_t j = 0; j < n; ++j)
+        {
+          auto d = conjugate(rig->jointRotation(j, clipPose.rotations[j]))
+            * rig->jointRotation(j, singlePose.rotations[j]);
+          auto angle = 2.0f * asinf(std::min(1.0f,
+                                             glm::length(d.imaginary)));
+          timing.maxAngle = std::max(timing.maxAngle, angle);
+        }
+      timing.maxOffset = std::max(timing.maxOffset,
+                                  glm::length(clipPose.translation
+                                              - singlePose.translation));
+    }
+
+  auto perPose = [iterations](Clock::time_point from, Clock::time_point to)
+    {
+      return std::chrono::duration<float, std::micro>(to - from).count()
+        / (float) iterations;
+    };
+  timing.clipMicroseconds = perPose(start, mid);
+  timing.singleMicroseconds = perPose(mid, late);
+  timing.layeredMicroseconds = perPose(late, end);
+  return timing;
+}
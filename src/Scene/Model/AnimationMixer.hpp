@@ -0,0 +1,173 @@
+#ifndef DMP_ANIMATIONMIXER_HPP
+#define DMP_ANIMATIONMIXER_HPP
+
+#include <vector>
+#include <memory>
+#include <glm/glm.hpp>
+#include "Rig.hpp"
+#include "Pose.hpp"
+#include "Animation.hpp"
+
+namespace dmp
+{
+  // A pose as joint quaternions, one array per component, padded to a
+  // multiple of four joints so that blends run four joints at a time.
+  // Padding joints hold zeros
+  struct BlendPose
+  {
+    glm::vec3 translation;
+    size_t stride;
+    std::vector<float> data; // w, then x, then y, then z, stride each
+
+    float * w() {return data.data();}
+    float * x() {return data.data() + stride;}
+    float * y() {return data.data() + 2 * stride;}
+    float * z() {return data.data() + 3 * stride;}
+    const float * w() const {return data.data();}
+    const float * x() const {return data.data() + stride;}
+    const float * y() const {return data.data() + 2 * stride;}
+    const float * z() const {return data.data() + 3 * stride;}
+  };
+
+  // BlendPoses for one rig, reused so that blending allocates nothing once
+  // warm. Not thread safe; mixers sharing a pool must run on one thread
+  class PosePool
+  {
+  public:
+    PosePool() = delete;
+    PosePool(const PosePool &) = delete;
+    PosePool & operator=(const PosePool &) = delete;
+    PosePool(PosePool &&) = default;
+    PosePool & operator=(PosePool &&) = default;
+
+    PosePool(size_t numJoints);
+
+    // Contents are left over from the last user
+    BlendPose * acquire();
+    void release(BlendPose * p);
+
+    size_t askNumJoints() const {return mNumJoints;}
+    size_t askNumAllocated() const {return mAll.size();}
+  private:
+    void initPosePool(size_t numJoints);
+
+    size_t mNumJoints;
+    std::vector<std::unique_ptr<BlendPose>> mAll;
+    std::vector<BlendPose *> mFree;
+  };
+
+  enum class LayerMode
+  {
+    // blends over the layers below, by the layer's weight
+    override,
+    // adds its difference from a reference pose on top of them
+    additive
+  };
+
+  // Blends weighted clips in layers. Each layer's clips are nlerped
+  // together by their weights, then the layer goes over the result of the
+  // layers below it by its weight times its per-joint mask. Layer 0 is the
+  // base, and should be an override layer. Blends work on BlendPoses from
+  // the pool, four joints at a time, in SSE where the compiler has it.
+  //
+  // Clips are referenced, not owned, and must outlive the mixer
+  class AnimationMixer
+  {
+  public:
+    AnimationMixer() = delete;
+    AnimationMixer(const AnimationMixer &) = delete;
+    AnimationMixer & operator=(const AnimationMixer &) = delete;
+    AnimationMixer(AnimationMixer &&) = default;
+    AnimationMixer & operator=(AnimationMixer &&) = default;
+
+    // Without a pool the mixer makes its own
+    AnimationMixer(std::shared_ptr<const Rig> rig,
+                   std::shared_ptr<PosePool> pool = nullptr);
+
+    size_t addLayer(LayerMode mode, float weight = 1.0f);
+    size_t askNumLayers() const {return mLayers.size();}
+    void tellLayerWeight(size_t layer, float weight);
+
+    // How much of the layer each joint takes, from 0 to 1. Empty is all
+    // of it
+    void tellLayerMask(size_t layer, const std::vector<float> & mask);
+
+    // The pose an additive layer's clips are differences from. Until told,
+    // it's the rest pose of the layer's first clip
+    void tellLayerReference(size_t layer, const Pose & reference);
+
+    // Returns the clip's index in the layer. Its clock starts at 0
+    size_t addClip(size_t layer, const Animation & anim, float weight = 1.0f);
+    void tellClipWeight(size_t layer, size_t clip, float weight);
+    void tellClipTime(size_t layer, size_t clip, float t);
+    void tellClipSpeed(size_t layer, size_t clip, float speed);
+
+    // Moves every clip's clock on by deltaT times its speed
+    void update(float deltaT);
+
+    // The blended pose. out must hold a full pose of the rig, e.g. the base
+    // clip's rest pose; only askJoints() and the translation are written
+    void evaluate(Pose & out);
+
+    // The joints any clip moves, or holds differently from the others.
+    // The rest are the same in every clip, so evaluate leaves them alone
+    const std::vector<size_t> & askJoints() const {return mJoints;}
+  private:
+    struct Clip
+    {
+      const Animation * anim;
+      float weight;
+      float time = 0.0f;
+      float speed = 1.0f;
+      Pose pose; // last evaluated, constant channels filled in
+    };
+
+    struct Layer
+    {
+      LayerMode mode;
+      float weight;
+      std::vector<float> mask; // padded, empty for none
+      std::vector<Clip> clips;
+      bool hasReference = false;
+      Pose reference;
+      bool referenceDirty = true; // referenceQ is out of date
+      std::unique_ptr<BlendPose> referenceQ;
+    };
+
+    void initAnimationMixer(std::shared_ptr<const Rig> rig,
+                            std::shared_ptr<PosePool> pool);
+    void blendClips(Layer & layer, BlendPose & out, BlendPose & scratch);
+    void toBlendPose(const Pose & p, BlendPose & out) const;
+    Layer & layerAt(size_t layer);
+    Clip & clipAt(size_t layer, size_t clip);
+
+    std::shared_ptr<const Rig> mRig;
+    std::shared_ptr<PosePool> mPool;
+    std::vector<Layer> mLayers;
+    std::vector<size_t> mJoints;
+    std::vector<char> mMoved; // by joint, whether it's in mJoints
+    std::vector<float> mWeights; // per-joint weights of one layer
+  };
+
+  // Mean time per pose of anim evaluated on its own, through a mixer
+  // playing it alone, and through a mixer of three layers over it
+  struct MixerTiming
+  {
+    size_t joints = 0;
+    float clipMicroseconds = 0.0f;
+    float singleMicroseconds = 0.0f;
+    float layeredMicroseconds = 0.0f;
+    float maxAngle = 0.0f; // radians between the single mixer and the clip
+    float maxOffset = 0.0f; // root translation, the same
+  };
+
+  // Evaluates iterations poses of anim spread over its duration each way.
+  // The layered mixer blends two clocks of anim half a clip apart in the
+  // base, adds anim over its rest pose at half weight, and overrides every
+  // other joint with a third clock
+  MixerTiming benchmarkMixer(std::shared_ptr<const Rig> rig,
+                             const Animation & anim,
+                             size_t iterations);
+}
+
+#endif
@@ -0,0 +1,298 @@
+#include "CPUSkinning.hpp"
+#include <chrono>
+#include <cmath>
+#include "Skin.hpp"
+#include "../../JobSystem.hpp"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// vertices per job. A chunk is a few microseconds of blending, worth
+// handing to a worker, and small enough that even wasp's 694 vertices
+// split three ways
+static const size_t skinGrain = 256;
+
+// influences per vertex, as many as the shader takes
+static const size_t skinInfluences = dmp::maxSkinInfluences;
+
+// normals shorter than this squared are left as they are
+static const float skinMinLengthSq = 1e-20f;
+
+// -----------------------------------------------------------------------------
+// One vertex
+// -----------------------------------------------------------------------------
+
+#ifdef __SSE2__
+// Blends the four matrices a column at a time, then transforms the
+// position and normal by the blend
+static inline void skinVertex(const glm::mat4 * palette,
+                              const uint32_t * bones,
+                              const float * weights,
+                              const glm::vec3 & p,
+                              const glm::vec3 & n,
+                              glm::vec3 & outP,
+                              glm::vec3 & outN)
+{
+  auto c0 = _mm_setzero_ps();
+  auto c1 = _mm_setzero_ps();
+  auto c2 = _mm_setzero_ps();
+  auto c3 = _mm_setzero_ps();
+  for (size_t k = 0; k < skinInfluences; ++k)
+    {
+      const float * m = &palette[bones[k]][0][0];
+      auto w = _mm_set1_ps(weights[k]);
+      c0 = _mm_add_ps(c0, _mm_mul_ps(w, _mm_loadu_ps(m)));
+      c1 = _mm_add_ps(c1, _mm_mul_ps(w, _mm_loadu_ps(m + 4)));
+      c2 = _mm_add_ps(c2, _mm_mul_ps(w, _mm_loadu_ps(m + 8)));
+      c3 = _mm_add_ps(c3, _mm_mul_ps(w, _mm_loadu_ps(m + 12)));
+    }
+
+  auto pos = _mm_add_ps(_mm_add_ps(c3, _mm_mul_ps(c0, _mm_set1_ps(p.x))),
+                        _mm_add_ps(_mm_mul_ps(c1, _mm_set1_ps(p.y)),
+                                   _mm_mul_ps(c2, _mm_set1_ps(p.z))));
+  auto nor = _mm_add_ps(_mm_mul_ps(c0, _mm_set1_ps(n.x)),
+                        _mm_add_ps(_mm_mul_ps(c1, _mm_set1_ps(n.y)),
+                                   _mm_mul_ps(c2, _mm_set1_ps(n.z))));
+
+  float ps[4];
+  float ns[4];
+  _mm_storeu_ps(ps, pos);
+  _mm_storeu_ps(ns, nor);
+  outP = {ps[0], ps[1], ps[2]};
+  outN = {ns[0], ns[1], ns[2]};
+}
+#else
+static inline void skinVertex(const glm::mat4 * palette,
+                              const uint32_t * bones,
+                              const float * weights,
+                              const glm::vec3 & p,
+                              const glm::vec3 & n,
+                              glm::vec3 & outP,
+                              glm::vec3 & outN)
+{
+  glm::mat4 B(0.0f);
+  for (size_t k = 0; k < skinInfluences; ++k)
+    {
+      B += weights[k] * palette[bones[k]];
+    }
+  outP = glm::vec3(B * glm::vec4(p, 1.0f));
+  outN = glm::mat3(B) * n;
+}
+#endif
+
+// Blends the four dual quaternions, each flipped onto the first one's
+// hemisphere so the blend takes the short way around. Plain glm: the sign
+// test per influence costs SSE more than the blend saves
+static inline void blendDual(const glm::vec4 * palette,
+                             const uint32_t * bones,
+                             const float * weights,
+                             glm::vec4 & outR,
+                             glm::vec4 & outD)
+{
+  const auto & r0 = palette[2 * bones[0]];
+  outR = glm::vec4(0.0f);
+  outD = glm::vec4(0.0f);
+  for (size_t k = 0; k < skinInfluences; ++k)
+    {
+      const auto & rk = palette[2 * bones[k]];
+      auto w = (glm::dot(r0, rk) < 0.0f) ? -weights[k] : weights[k];
+      outR += w * rk;
+      outD += w * palette[2 * bones[k] + 1];
+    }
+}
+
+// -----------------------------------------------------------------------------
+// CPUSkinner
+// -----------------------------------------------------------------------------
+
+dmp::CPUSkinner::CPUSkinner(const Skin & skin)
+{
+  initCPUSkinner(skin);
+}
+
+void dmp::CPUSkinner::initCPUSkinner(const Skin & skin)
+{
+  const auto & weights = skin.askWeights();
+  mNumBones = skin.askBindings().size();
+  mPositions = skin.askVerts();
+  mNormals = skin.askNormals();
+  expect("a weight per vertex", weights.size() == mPositions.size());
+  expect("a normal per vertex", mNormals.size() == mPositions.size());
+  expect("skin has bones", mNumBones > 0);
+
+  mInfluences.resize(weights.size());
+  for (size_t i = 0; i < weights.size(); ++i)
+    {
+      const auto & w = weights[i];
+      auto & inf = mInfluences[i];
+      for (size_t k = 0; k < skinInfluences; ++k)
+        {
+          inf.bones[k] = w.index[k];
+          inf.weights[k] = w.askWeight(k);
+        }
+    }
+}
+
+void dmp::CPUSkinner::tellRest(size_t i,
+                               const glm::vec3 & position,
+                               const glm::vec3 & normal)
+{
+  expect("vertex in range", i < mPositions.size());
+  mPositions[i] = position;
+  mNormals[i] = normal;
+}
+
+void dmp::CPUSkinner::skin(const glm::mat4 * palette,
+                           DynamicVertex * out) const
+{
+  skinRange(palette, out, 0, mPositions.size());
+}
+
+void dmp::CPUSkinner::skin(const glm::mat4 * palette,
+                           DynamicVertex * out,
+                           JobSystem & jobs) const
+{
+  jobs.parallelFor(mPositions.size(), skinGrain,
+                   [&](size_t begin, size_t end)
+                   {
+                     skinRange(palette, out, begin, end);
+                   });
+}
+
+void dmp::CPUSkinner::skinRange(const glm::mat4 * palette,
+                                DynamicVertex * out,
+                                size_t begin,
+                                size_t end) const
+{
+  for (size_t i = begin; i < end; ++i)
+    {
+      const auto & inf = mInfluences[i];
+      glm::vec3 p;
+      glm::vec3 n;
+      skinVertex(palette, inf.bones, inf.weights,
+                 mPositions[i], mNormals[i], p, n);
+
+      // blending shortens normals, and the packing needs them unit
+      auto lengthSq = glm::dot(n, n);
+      if (lengthSq > skinMinLengthSq) n *= 1.0f / sqrtf(lengthSq);
+
+      out[i].position = p;
+      out[i].tellNormal(n);
+    }
+}
+
+void dmp::CPUSkinner::skinDual(const glm::vec4 * palette,
+                               DynamicVertex * out) const
+{
+  skinDualRange(palette, out, 0, mPositions.size());
+}
+
+void dmp::CPUSkinner::skinDual(const glm::vec4 * palette,
+                               DynamicVertex * out,
+                               JobSystem & jobs) const
+{
+  jobs.parallelFor(mPositions.size(), skinGrain,
+                   [&](size_t begin, size_t end)
+                   {
+                     skinDualRange(palette, out, begin, end);
+                   });
+}
+
+void dmp::CPUSkinner::skinDualRange(const glm::vec4 * palette,
+                                    DynamicVertex * out,
+                                    size_t begin,
+                                    size_t end) const
+{
+  for (size_t i = begin; i < end; ++i)
+    {
+      const auto & inf = mInfluences[i];
+      glm::vec4 r;
+      glm::vec4 d;
+      blendDual(palette, inf.bones, inf.weights, r, d);
+
+      auto lengthSq = glm::dot(r, r);
+      if (lengthSq > skinMinLengthSq)
+        {
+          auto invLength = 1.0f / sqrtf(lengthSq);
+          r *= invLength;
+          d *= invLength;
+        }
+
+      // as the shader does it: rotate by r, then translate by
+      // 2 * d * conjugate(r)
+      glm::vec3 rv(r);
+      glm::vec3 dv(d);
+      auto t = 2.0f * (r.w * dv - d.w * rv + glm::cross(rv, dv));
+      const auto & p = mPositions[i];
+      const auto & n = mNormals[i];
+      out[i].position = p
+        + 2.0f * glm::cross(rv, glm::cross(rv, p) + r.w * p) + t;
+      out[i].tellNormal(n + 2.0f * glm::cross(rv, glm::cross(rv, n)
+                                              + r.w * n));
+    }
+}
+
+void dmp::CPUSkinner::writeRest(DynamicVertex * out) const
+{
+  for (size_t i = 0; i < mPositions.size(); ++i)
+    {
+      out[i].position = mPositions[i];
+      out[i].tellNormal(mNormals[i]);
+    }
+}
+
+// -----------------------------------------------------------------------------
+// Benchmark
+// -----------------------------------------------------------------------------
+
+dmp::CPUSkinningTiming dmp::benchmarkCPUSkinning(const Skin & skin,
+                                                 const Rig & rig,
+                                                 size_t iterations,
+                                                 size_t numWorkers)
+{
+  using Clock = std::chrono::steady_clock;
+  expect("at least one iteration", iterations > 0);
+  expect("a bone per binding",
+         rig.askNumJoints() == skin.askBindings().size());
+
+  Pose rest;
+  rest.translation = glm::vec3(0.0f);
+  for (size_t i = 0; i < rig.askNumJoints(); ++i)
+    {
+      rest.rotations.push_back(rig.askRestRotation(i));
+    }
+  std::vector<glm::mat4> Ms;
+  rig.computeMs(rest, glm::mat4(1.0f), Ms);
+  std::vector<glm::mat4> palette(Ms.size());
+  skin.computePalette(Ms, palette.data());
+
+  CPUSkinner skinner(skin);
+  JobSystem jobs(numWorkers);
+  std::vector<DynamicVertex> out(skinner.askNumVerts());
+
+  // once each first, so neither pays for touching out
+  skinner.skin(palette.data(), out.data());
+  skinner.skin(palette.data(), out.data(), jobs);
+
+  auto start = Clock::now();
+  for (size_t i = 0; i < iterations; ++i)
+    {
+      skinner.skin(palette.data(), out.data());
+    }
+  auto mid = Clock::now();
+  for (size_t i = 0; i < iterations; ++i)
+    {
+      skinner.skin(palette.data(), out.data(), jobs);
+    }
+  auto end = Clock::now();
+
+  CPUSkinningTiming timing;
+  timing.verts = skinner.askNumVerts();
+  timing.threads = jobs.askNumThreads();
+  timing.singleMicroseconds = std::chrono::duration<float, std::micro>
+    (mid - start).count() / (float) iterations;
+  timing.jobsMicroseconds = std::chrono::duration<float, std::micro>
+    (end - mid).count() / (float) iterations;
+  return timing;
+}
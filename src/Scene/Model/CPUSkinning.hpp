@@ -0,0 +1,100 @@
+#ifndef DMP_CPUSKINNING_HPP
+#define DMP_CPUSKINNING_HPP
+
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <glm/glm.hpp>
+#include "Rig.hpp"
+#include "../Object.hpp"
+
+namespace dmp
+{
+  class Skin;
+  class JobSystem;
+
+  // Skinning on the CPU, for headless runs, baking, and drivers that can't
+  // be trusted to skin in the shader. Keeps the skin's rest mesh packed
+  // for it: per vertex, four bones and four weights, the unused ones
+  // weighing 0 so that every vertex blends the same way. Vertices go in
+  // chunks across a JobSystem, matrix blends in SSE where the compiler
+  // has it
+  class CPUSkinner
+  {
+  public:
+    CPUSkinner() = delete;
+    CPUSkinner(const CPUSkinner &) = delete;
+    CPUSkinner & operator=(const CPUSkinner &) = delete;
+    CPUSkinner(CPUSkinner &&) = default;
+    CPUSkinner & operator=(CPUSkinner &&) = default;
+
+    CPUSkinner(const Skin & skin);
+
+    size_t askNumVerts() const {return mPositions.size();}
+    size_t askNumBones() const {return mNumBones;}
+
+    // Replaces vertex i's rest position and normal, e.g. after a morph
+    void tellRest(size_t i,
+                  const glm::vec3 & position,
+                  const glm::vec3 & normal);
+
+    // Writes every vertex's skinned position and normal to out, which must
+    // hold askNumVerts() vertices, e.g. Object::updateVertices' buffer.
+    // palette holds askNumBones() matrices, e.g. from Skin::computePalette.
+    // The first runs on the calling thread only
+    void skin(const glm::mat4 * palette, DynamicVertex * out) const;
+    void skin(const glm::mat4 * palette,
+              DynamicVertex * out,
+              JobSystem & jobs) const;
+
+    // The same for a dual quaternion palette, two vec4s per bone as
+    // toDualPalette lays them out
+    void skinDual(const glm::vec4 * palette, DynamicVertex * out) const;
+    void skinDual(const glm::vec4 * palette,
+                  DynamicVertex * out,
+                  JobSystem & jobs) const;
+
+    // Writes the rest positions and normals to out, undoing skin
+    void writeRest(DynamicVertex * out) const;
+  private:
+    struct Influences
+    {
+      uint32_t bones[4];
+      float weights[4];
+    };
+
+    void initCPUSkinner(const Skin & skin);
+    void skinRange(const glm::mat4 * palette,
+                   DynamicVertex * out,
+                   size_t begin,
+                   size_t end) const;
+    void skinDualRange(const glm::vec4 * palette,
+                       DynamicVertex * out,
+                       size_t begin,
+                       size_t end) const;
+
+    size_t mNumBones;
+    std::vector<glm::vec3> mPositions;
+    std::vector<glm::vec3> mNormals;
+    std::vector<Influences> mInfluences;
+  };
+
+  // Mean time to skin every vertex of a skin once, on the calling thread
+  // alone and across a JobSystem of threads threads
+  struct CPUSkinningTiming
+  {
+    size_t verts = 0;
+    size_t threads = 0;
+    float singleMicroseconds = 0.0f;
+    float jobsMicroseconds = 0.0f;
+  };
+
+  // Skins skin iterations times in rig's rest pose. numWorkers is as for
+  // JobSystem, 0 for one per hardware thread
+  CPUSkinningTiming benchmarkCPUSkinning(const Skin & skin,
+                                         const Rig & rig,
+                                         size_t iterations,
+                                         size_t numWorkers = 0);
+}
+
+#endif
@@ -0,0 +1,485 @@
+#include "IK.hpp"
+#include "../../JobSystem.hpp"
+#include <cmath>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/constants.hpp>
+
+using SteadyClock = std::chrono::steady_clock;
+
+// chains per job. Each is a few tiny FK passes per iteration
+static const size_t ikGrain = 8;
+
+// shorter than this and a direction means nothing
+static const float ikMinLength = 1e-6f;
+
+// benchmarkIK: how its characters are spaced, how far each target circles
+// from where the limb reaches at rest, as a fraction of the limb's length,
+// and the solver's cap and tolerance
+static const float ikBenchSpacing = 4.0f;
+static const float ikBenchReach = 0.3f;
+static const size_t ikBenchMaxIterations = 10;
+static const float ikBenchTolerance = 0.01f;
+
+dmp::IKChain::IKChain(const Rig & rig,
+                      size_t endJoint,
+                      size_t length,
+                      const glm::vec3 & effector)
+{
+  initIKChain(rig, endJoint, length, effector);
+}
+
+void dmp::IKChain::initIKChain(const Rig & rig,
+                               size_t endJoint,
+                               size_t length,
+                               const glm::vec3 & effector)
+{
+  expect("end joint in range", endJoint < rig.askNumJoints());
+  expect("chain not empty", length > 0);
+
+  mJoints.resize(length);
+  auto curr = (int) endJoint;
+  for (size_t i = length; i > 0; --i)
+    {
+      expect("chain fits below the root", curr >= 0);
+      mJoints[i - 1] = (size_t) curr;
+      curr = rig.askParent((size_t) curr);
+    }
+  mEffector = effector;
+}
+
+dmp::IKSolver::IKSolver(IKMethod method,
+                        size_t maxIterations,
+                        float tolerance,
+                        float budgetMicroseconds)
+{
+  initIKSolver(method, maxIterations, tolerance, budgetMicroseconds);
+}
+
+void dmp::IKSolver::initIKSolver(IKMethod method,
+                                 size_t maxIterations,
+                                 float tolerance,
+                                 float budgetMicroseconds)
+{
+  expect("at least one iteration", maxIterations > 0);
+  expect("tolerance positive", tolerance > 0.0f);
+  expect("budget not negative", budgetMicroseconds >= 0.0f);
+
+  mMethod = method;
+  mMaxIterations = maxIterations;
+  mTolerance = tolerance;
+  mBudget = budgetMicroseconds;
+}
+
+// -----------------------------------------------------------------------------
+// Chain geometry
+// -----------------------------------------------------------------------------
+
+// The world frame the chain's first joint hangs off: M, the root
+// translation, then every ancestor's local transform
+static glm::mat4 chainBase(const dmp::Rig & rig,
+                           const dmp::Pose & pose,
+                           const glm::mat4 & M,
+                           size_t firstJoint)
+{
+  std::vector<size_t> ancestors;
+  for (auto curr = rig.askParent(firstJoint);
+       curr >= 0;
+       curr = rig.askParent((size_t) curr))
+    {
+      ancestors.push_back((size_t) curr);
+    }
+
+  auto base = M * glm::translate(glm::mat4(), pose.translation);
+  for (auto iter = ancestors.rbegin(); iter != ancestors.rend(); ++iter)
+    {
+      base = base * rig.localTransform(*iter, pose.rotations[*iter]);
+    }
+  return base;
+}
+
+// W[i] is the world matrix of the chain's ith joint
+static void chainFK(const dmp::Rig & rig,
+                    const dmp::Pose & pose,
+                    const std::vector<size_t> & joints,
+                    const glm::mat4 & base,
+                    std::vector<glm::mat4> & W)
+{
+  W.resize(joints.size());
+  for (size_t i = 0; i < joints.size(); ++i)
+    {
+      const auto & parentM = (i == 0) ? base : W[i - 1];
+      W[i] = parentM * rig.localTransform(joints[i],
+                                          pose.rotations[joints[i]]);
+    }
+}
+
+static glm::vec3 effectorOf(const std::vector<glm::mat4> & W,
+                            const glm::vec3 & effector)
+{
+  return glm::vec3(W.back() * glm::vec4(effector, 1.0f));
+}
+
+// Turns joint so that from, a world point moving with it, heads toward the
+// world point to, then clamps the joint to its limits. parentM is the
+// frame the joint hangs off, jointM the joint's own world matrix
+static void aim(const dmp::Rig & rig,
+                dmp::Pose & pose,
+                size_t joint,
+                const glm::mat4 & parentM,
+                const glm::mat4 & jointM,
+                const glm::vec3 & from,
+                const glm::vec3 & to)
+{
+  // the joint's rotation applies in its parent's axes, at its own origin
+  auto pivot = glm::vec3(jointM[3]);
+  auto toParent = glm::inverse(glm::mat3(parentM));
+  auto a = toParent * (from - pivot);
+  auto b = toParent * (to - pivot);
+
+  auto la = glm::length(a);
+  auto lb = glm::length(b);
+  if (la < ikMinLength || lb < ikMinLength) return;
+  a /= la;
+  b /= lb;
+
+  auto axis = glm::cross(a, b);
+  auto s = glm::length(axis);
+  if (s < ikMinLength) return; // lined up, or exactly opposite
+
+  dmp::Quaternion turn(atan2f(s, glm::dot(a, b)), axis / s);
+  auto & rot = pose.rotations[joint];
+  auto current = rig.jointRotation(joint, rot);
+  rot = rig.clampRotation(joint, toEulerZYX(turn * current, rot));
+}
+
+// One CCD sweep: each joint from the tip in, turned to point the effector
+// at the target
+static void iterateCCD(const dmp::Rig & rig,
+                       dmp::Pose & pose,
+                       const std::vector<size_t> & joints,
+                       const glm::mat4 & base,
+                       const glm::vec3 & effector,
+                       const glm::vec3 & target,
+                       std::vector<glm::mat4> & W)
+{
+  for (size_t k = joints.size(); k > 0; --k)
+    {
+      auto i = k - 1;
+      chainFK(rig, pose, joints, base, W);
+      const auto & parentM = (i == 0) ? base : W[i - 1];
+      aim(rig, pose, joints[i], parentM, W[i],
+          effectorOf(W, effector), target);
+    }
+}
+
+// One FABRIK sweep: the joint positions are pulled to the target and back
+// to the base keeping every segment's length, then each joint from the base
+// out is turned toward its new child position
+static void iterateFABRIK(const dmp::Rig & rig,
+                          dmp::Pose & pose,
+                          const std::vector<size_t> & joints,
+                          const glm::mat4 & base,
+                          const glm::vec3 & effector,
+                          const glm::vec3 & target,
+                          std::vector<glm::mat4> & W,
+                          std::vector<glm::vec3> & P)
+{
+  auto n = joints.size();
+  chainFK(rig, pose, joints, base, W);
+
+  // P[n] is the effector
+  P.resize(n + 1);
+  for (size_t i = 0; i < n; ++i)
+    {
+      P[i] = glm::vec3(W[i][3]);
+    }
+  P[n] = effectorOf(W, effector);
+
+  auto reach = [](const glm::vec3 & anchor,
+                  const glm::vec3 & toward,
+                  float length)
+    {
+      auto d = toward - anchor;
+      auto l = glm::length(d);
+      if (l < ikMinLength) return anchor;
+      return anchor + d * (length / l);
+    };
+
+  std::vector<float> lengths(n);
+  for (size_t i = 0; i < n; ++i)
+    {
+      lengths[i] = glm::length(P[i + 1] - P[i]);
+    }
+
+  auto root = P[0];
+  P[n] = target;
+  for (size_t i = n; i > 0; --i)
+    {
+      P[i - 1] = reach(P[i], P[i - 1], lengths[i - 1]);
+    }
+  P[0] = root;
+  for (size_t i = 0; i < n; ++i)
+    {
+      P[i + 1] = reach(P[i], P[i + 1], lengths[i]);
+    }
+
+  // back to rotations, refreshing the chain as each joint turns
+  for (size_t i = 0; i < n; ++i)
+    {
+      if (i > 0) chainFK(rig, pose, joints, base, W);
+      const auto & parentM = (i == 0) ? base : W[i - 1];
+      auto child = (i + 1 < n) ? glm::vec3(W[i + 1][3])
+        : effectorOf(W, effector);
+      aim(rig, pose, joints[i], parentM, W[i], child, P[i + 1]);
+    }
+}
+
+// -----------------------------------------------------------------------------
+// Solving
+// -----------------------------------------------------------------------------
+
+size_t dmp::IKSolver::run(IKProblem & problem,
+                          SteadyClock::time_point deadline,
+                          bool & converged) const
+{
+  expect("problem complete", problem.rig && problem.pose && problem.chain);
+
+  const auto & rig = *problem.rig;
+  auto & pose = *problem.pose;
+  auto & chain = *problem.chain;
+  const auto & joints = chain.mJoints;
+  expect("pose covers chain", pose.rotations.size() > joints.back());
+
+  if (chain.hasSolution())
+    {
+      for (size_t i = 0; i < joints.size(); ++i)
+        {
+          pose.rotations[joints[i]] = chain.mSolution[i];
+        }
+    }
+
+  auto base = chainBase(rig, pose, problem.M, joints.front());
+  std::vector<glm::mat4> W;
+  std::vector<glm::vec3> P;
+
+  auto error = [&]()
+    {
+      chainFK(rig, pose, joints, base, W);
+      return glm::length(effectorOf(W, chain.mEffector) - problem.target);
+    };
+
+  size_t iterations = 0;
+  converged = error() <= mTolerance;
+  while (!converged
+         && iterations < mMaxIterations
+         && SteadyClock::now() < deadline)
+    {
+      switch (mMethod)
+        {
+        case IKMethod::CCD:
+          iterateCCD(rig, pose, joints, base,
+                     chain.mEffector, problem.target, W);
+          break;
+        case IKMethod::FABRIK:
+          iterateFABRIK(rig, pose, joints, base,
+                        chain.mEffector, problem.target, W, P);
+          break;
+        }
+      ++iterations;
+      converged = error() <= mTolerance;
+    }
+
+  chain.mSolution.resize(joints.size());
+  for (size_t i = 0; i < joints.size(); ++i)
+    {
+      chain.mSolution[i] = pose.rotations[joints[i]];
+    }
+  return iterations;
+}
+
+size_t dmp::IKSolver::solveOne(IKProblem & problem) const
+{
+  bool converged;
+  return run(problem, SteadyClock::time_point::max(), converged);
+}
+
+dmp::IKStats dmp::IKSolver::solve(std::vector<IKProblem> & problems,
+                                  JobSystem & jobs)
+{
+  IKStats stats;
+  stats.problems = problems.size();
+  if (problems.empty()) return stats;
+
+  auto start = SteadyClock::now();
+  auto budget = std::chrono::duration<float, std::micro>(mBudget);
+  auto deadline = start
+    + std::chrono::duration_cast<SteadyClock::duration>(budget);
+
+  auto n = problems.size();
+  auto first = mNext % n;
+  std::vector<size_t> iterations(n, 0);
+  std::vector<char> converged(n, 0);
+  std::vector<char> skipped(n, 0);
+
+  // INVARIANT: each problem is touched by exactly one job
+  jobs.parallelFor(n, ikGrain,
+                   [&](size_t begin, size_t end)
+                   {
+                     for (size_t i = begin; i < end; ++i)
+                       {
+                         auto idx = (first + i) % n;
+                         auto & problem = problems[idx];
+
+                         if (SteadyClock::now() >= deadline)
+                           {
+                             // out of time: hold last frame's answer
+                             skipped[idx] = 1;
+                             const auto & chain = *problem.chain;
+                             for (size_t j = 0; j < chain.mSolution.size(); ++j)
+                               {
+                                 problem.pose->rotations[chain.mJoints[j]]
+                                   = chain.mSolution[j];
+                               }
+                             continue;
+                           }
+
+                         bool c = false;
+                         iterations[idx] = run(problem, deadline, c);
+                         converged[idx] = c;
+                       }
+                   });
+
+  // the first chain this batch skipped goes first next time
+  for (size_t i = 0; i < n; ++i)
+    {
+      auto idx = (first + i) % n;
+      if (skipped[idx])
+        {
+          mNext = idx;
+          break;
+        }
+    }
+
+  for (size_t i = 0; i < n; ++i)
+    {
+      stats.iterations += iterations[i];
+      if (converged[i]) ++stats.converged;
+      if (skipped[i]) ++stats.skipped;
+    }
+  stats.microseconds = std::chrono::duration<float, std::micro>
+    (SteadyClock::now() - start).count();
+  return stats;
+}
+
+// -----------------------------------------------------------------------------
+// Benchmark
+// -----------------------------------------------------------------------------
+
+dmp::IKTiming dmp::benchmarkIK(const Rig & rig,
+                               IKMethod method,
+                               size_t instances,
+                               size_t batches,
+                               float budgetMicroseconds,
+                               size_t numWorkers)
+{
+  expect("at least one instance", instances > 0);
+  expect("at least one batch", batches > 0);
+
+  std::vector<bool> hasChild(rig.askNumJoints(), false);
+  for (size_t i = 0; i < rig.askNumJoints(); ++i)
+    {
+      if (rig.askParent(i) >= 0) hasChild[(size_t) rig.askParent(i)] = true;
+    }
+
+  std::vector<size_t> leaves;
+  for (size_t i = 0; i < rig.askNumJoints(); ++i)
+    {
+      auto parent = rig.askParent(i);
+      if (!hasChild[i] && parent >= 0 && rig.askParent((size_t) parent) >= 0)
+        {
+          leaves.push_back(i);
+        }
+    }
+  expect("rig has limbs", !leaves.empty());
+
+  Pose rest;
+  rest.translation = glm::vec3(0.0f);
+  for (size_t i = 0; i < rig.askNumJoints(); ++i)
+    {
+      rest.rotations.push_back(rig.askRestRotation(i));
+    }
+  std::vector<glm::mat4> Ms;
+  rig.computeMs(rest, glm::mat4(), Ms);
+
+  // a leaf has nothing past it to give the limb's far end, so its effector
+  // is a segment as long as the one above it
+  std::vector<glm::vec3> rests;
+  std::vector<float> reaches;
+  for (auto leaf : leaves)
+    {
+      const auto & segment = rig.askOffset(leaf);
+      rests.push_back(glm::vec3(Ms[leaf] * glm::vec4(segment, 1.0f)));
+      reaches.push_back(ikBenchReach * 2.0f * glm::length(segment));
+    }
+
+  // every character on a square grid, in its rest pose
+  auto side = (size_t) ceilf(sqrtf((float) instances));
+  std::vector<Pose> poses(instances, rest);
+  std::vector<IKChain> chains;
+  chains.reserve(instances * leaves.size());
+  std::vector<IKProblem> problems;
+  for (size_t i = 0; i < instances; ++i)
+    {
+      glm::vec3 pos = {ikBenchSpacing * (float) (i % side),
+                       0.0f,
+                       ikBenchSpacing * (float) (i / side)};
+      for (auto leaf : leaves)
+        {
+          chains.emplace_back(rig, leaf, 2, rig.askOffset(leaf));
+          problems.push_back({&rig,
+                              &poses[i],
+                              glm::translate(glm::mat4(), pos),
+                              &chains.back(),
+                              glm::vec3()});
+        }
+    }
+
+  IKSolver solver(method,
+                  ikBenchMaxIterations,
+                  ikBenchTolerance,
+                  budgetMicroseconds);
+  JobSystem jobs(numWorkers);
+
+  IKTiming timing;
+  timing.problems = problems.size();
+  timing.threads = jobs.askNumThreads();
+  for (size_t b = 0; b < batches; ++b)
+    {
+      // a turn of the circle every 16 batches, each character a little
+      // out of step with the one before it
+      for (size_t p = 0; p < problems.size(); ++p)
+        {
+          auto i = p / leaves.size();
+          auto l = p % leaves.size();
+          auto turns = (float) b / 16.0f + (float) i * 0.618034f;
+          auto angle = glm::two_pi<float>() * turns;
+          glm::vec3 circle = {cosf(angle), 0.0f, sinf(angle)};
+          problems[p].target = glm::vec3(problems[p].M
+                                         * glm::vec4(rests[l]
+                                                     + reaches[l] * circle,
+                                                     1.0f));
+        }
+
+      auto stats = solver.solve(problems, jobs);
+      timing.converged += (float) stats.converged;
+      timing.iterations += (float) stats.iterations;
+      timing.skipped += (float) stats.skipped;
+      timing.microseconds += stats.microseconds;
+    }
+
+  timing.converged /= (float) batches;
+  timing.iterations /= (float) batches;
+  timing.skipped /= (float) batches;
+  timing.microseconds /= (float) batches;
+  return timing;
+}
@@ -0,0 +1,154 @@
+#ifndef DMP_IK_HPP
+#define DMP_IK_HPP
+
+#include <vector>
+#include <memory>
+#include <chrono>
+#include <glm/glm.hpp>
+#include "Rig.hpp"
+#include "Pose.hpp"
+
+namespace dmp
+{
+  class JobSystem;
+
+  enum class IKMethod {CCD, FABRIK};
+
+  // A run of joints, each the parent of the next, ending in an effector
+  // point fixed in the last joint's frame. Also remembers its last
+  // solution, so that next frame's solve starts from there instead of from
+  // whatever the animation says
+  class IKChain
+  {
+  public:
+    IKChain() = delete;
+    IKChain(const IKChain &) = delete;
+    IKChain & operator=(const IKChain &) = delete;
+    IKChain(IKChain &&) = default;
+    IKChain & operator=(IKChain &&) = default;
+
+    // The length joints ending at endJoint, e.g. hip and knee for a leg.
+    // effector is in endJoint's frame
+    IKChain(const Rig & rig,
+            size_t endJoint,
+            size_t length,
+            const glm::vec3 & effector = glm::vec3());
+
+    size_t askLength() const {return mJoints.size();}
+    size_t askJoint(size_t i) const
+    {
+      expect("chain index in range", i < mJoints.size());
+      return mJoints[i];
+    }
+    const glm::vec3 & askEffector() const {return mEffector;}
+
+    bool hasSolution() const {return !mSolution.empty();}
+
+    // Forget the last solution; the next solve starts from the pose
+    void reset() {mSolution.clear();}
+  private:
+    friend class IKSolver;
+
+    void initIKChain(const Rig & rig,
+                     size_t endJoint,
+                     size_t length,
+                     const glm::vec3 & effector);
+
+    std::vector<size_t> mJoints; // root first
+    glm::vec3 mEffector;
+    std::vector<glm::vec3> mSolution; // Euler angles per joint
+  };
+
+  // One chain of one character to solve this frame. pose is read for every
+  // joint above the chain and gets the chain's answer written back. Chains
+  // of the same pose in one batch may run at once, so they must not share
+  // joints, and none may hold an ancestor of another
+  struct IKProblem
+  {
+    const Rig * rig;
+    Pose * pose;
+    glm::mat4 M; // places the character; target is in the same space
+    IKChain * chain;
+    glm::vec3 target;
+  };
+
+  struct IKStats
+  {
+    size_t problems = 0;
+    size_t converged = 0;
+    size_t iterations = 0;
+    size_t skipped = 0; // never started, the budget ran out first
+    float microseconds = 0.0f;
+  };
+
+  // Solves batches of chains across a JobSystem, under an iteration cap per
+  // chain and a time budget for the whole batch. Each joint stays within
+  // its Balljoint limits after every step. Chains the budget cuts short or
+  // skips keep their last solution, and go first next frame
+  class IKSolver
+  {
+  public:
+    IKSolver() = delete;
+    IKSolver(const IKSolver &) = delete;
+    IKSolver & operator=(const IKSolver &) = delete;
+    IKSolver(IKSolver &&) = default;
+    IKSolver & operator=(IKSolver &&) = default;
+
+    // tolerance is how close, in world units, counts as there
+    IKSolver(IKMethod method,
+             size_t maxIterations,
+             float tolerance,
+             float budgetMicroseconds);
+
+    void tellMethod(IKMethod method) {mMethod = method;}
+    void tellBudget(float microseconds) {mBudget = microseconds;}
+
+    IKStats solve(std::vector<IKProblem> & problems, JobSystem & jobs);
+
+    // One problem, on this thread, without a budget. Returns the number of
+    // iterations it took
+    size_t solveOne(IKProblem & problem) const;
+  private:
+    void initIKSolver(IKMethod method,
+                      size_t maxIterations,
+                      float tolerance,
+                      float budgetMicroseconds);
+
+    // Iterates on problem until it converges, hits the cap or passes
+    // deadline. Returns the number of iterations
+    size_t run(IKProblem & problem,
+               std::chrono::steady_clock::time_point deadline,
+               bool & converged) const;
+
+    IKMethod mMethod;
+    size_t mMaxIterations;
+    float mTolerance;
+    float mBudget;
+    size_t mNext = 0; // where the next batch starts
+  };
+
+  // Mean outcome and time of one IKSolver::solve over every limb of many
+  // characters
+  struct IKTiming
+  {
+    size_t problems = 0; // chains per batch
+    size_t threads = 0;
+    float converged = 0.0f;
+    float iterations = 0.0f;
+    float skipped = 0.0f;
+    float microseconds = 0.0f;
+  };
+
+  // Poses instances copies of rig and solves batches batches of their
+  // limbs, each a leaf joint and its parent below the root, reaching for
+  // targets that circle the rest pose's effectors from batch to batch.
+  // numWorkers is as for JobSystem, 0 for one per hardware thread
+  IKTiming benchmarkIK(const Rig & rig,
+                       IKMethod method,
+                       size_t instances,
+                       size_t batches,
+                       float budgetMicroseconds,
+                       size_t numWorkers = 0);
+}
+
+#endif
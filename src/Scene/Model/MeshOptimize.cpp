@@ -0,0 +1,245 @@
+#include "MeshOptimize.hpp"
+#include <cmath>
+#include <algorithm>
+
+// Forsyth's scoring constants, from "Linear-Speed Vertex Cache
+// Optimisation". The last triangle's vertices score a flat
+// forsythLastTriScore, so the next triangle doesn't just strip along
+static const float forsythCacheDecay = 1.5f;
+static const float forsythLastTriScore = 0.75f;
+static const float forsythValenceScale = 2.0f;
+static const float forsythValencePower = 0.5f;
+
+// -----------------------------------------------------------------------------
+// ACMR
+// -----------------------------------------------------------------------------
+
+float dmp::computeACMR(const std::vector<size_t> & idxs, size_t cacheSize)
+{
+  expect("whole triangles", idxs.size() % 3 == 0);
+  expect("cache not empty", cacheSize > 0);
+  if (idxs.empty()) return 0.0f;
+
+  // a ring of the last cacheSize misses; hits don't move anything
+  std::vector<size_t> fifo;
+  fifo.reserve(cacheSize);
+  size_t next = 0;
+  size_t misses = 0;
+  for (auto v : idxs)
+    {
+      if (std::find(fifo.begin(), fifo.end(), v) != fifo.end()) continue;
+      ++misses;
+      if (fifo.size() < cacheSize)
+        {
+          fifo.push_back(v);
+        }
+      else
+        {
+          fifo[next] = v;
+          next = (next + 1) % cacheSize;
+        }
+    }
+  return (float) misses / (float) (idxs.size() / 3);
+}
+
+// -----------------------------------------------------------------------------
+// Triangle order
+// -----------------------------------------------------------------------------
+
+static float vertexScore(int cachePos, size_t valence)
+{
+  // no triangles left to draw, so nothing gained by drawing near it
+  if (valence == 0) return -1.0f;
+
+  float score = 0.0f;
+  if (cachePos >= 0)
+    {
+      if (cachePos < 3)
+        {
+          score = forsythLastTriScore;
+        }
+      else
+        {
+          auto scale = 1.0f / (float) (dmp::meshCacheSize - 3);
+          score = powf(1.0f - (float) (cachePos - 3) * scale,
+                       forsythCacheDecay);
+        }
+    }
+
+  // lonely vertices first, so they don't get stranded
+  return score + forsythValenceScale
+    * powf((float) valence, -forsythValencePower);
+}
+
+void dmp::optimizeVertexCache(std::vector<size_t> & idxs, size_t numVerts)
+{
+  expect("whole triangles", idxs.size() % 3 == 0);
+  auto numTris = idxs.size() / 3;
+  if (numTris == 0) return;
+
+  // each vertex's triangles, in one array
+  std::vector<size_t> valence(numVerts, 0);
+  for (auto v : idxs)
+    {
+      expect("index in range", v < numVerts);
+      ++valence[v];
+    }
+  std::vector<size_t> firstTri(numVerts + 1, 0);
+  for (size_t v = 0; v < numVerts; ++v)
+    {
+      firstTri[v + 1] = firstTri[v] + valence[v];
+    }
+  std::vector<size_t> vertTris(idxs.size());
+  std::vector<size_t> filled(firstTri.begin(), firstTri.end() - 1);
+  for (size_t t = 0; t < numTris; ++t)
+    {
+      for (size_t k = 0; k < 3; ++k)
+        {
+          auto v = idxs[3 * t + k];
+          vertTris[filled[v]++] = t;
+        }
+    }
+
+  // valence counts only the triangles not yet drawn from here on
+  std::vector<int> cachePos(numVerts, -1);
+  std::vector<float> vertScore(numVerts);
+  for (size_t v = 0; v < numVerts; ++v)
+    {
+      vertScore[v] = vertexScore(-1, valence[v]);
+    }
+  std::vector<float> triScore(numTris);
+  std::vector<char> drawn(numTris, 0);
+  for (size_t t = 0; t < numTris; ++t)
+    {
+      triScore[t] = vertScore[idxs[3 * t]] + vertScore[idxs[3 * t + 1]]
+        + vertScore[idxs[3 * t + 2]];
+    }
+
+  // the cache holds a triangle more than its size, so that the vertices
+  // pushed out by the last one can be rescored
+  std::vector<size_t> cache;
+  std::vector<size_t> nextCache;
+  cache.reserve(meshCacheSize + 3);
+  nextCache.reserve(meshCacheSize + 3);
+
+  std::vector<size_t> out;
+  out.reserve(idxs.size());
+  size_t scanFrom = 0;
+  auto best = (size_t) -1;
+
+  for (size_t n = 0; n < numTris; ++n)
+    {
+      // nothing in the cache has a triangle left: start somewhere new,
+      // at the best of what remains
+      if (best == (size_t) -1)
+        {
+          while (drawn[scanFrom]) ++scanFrom;
+          best = scanFrom;
+          for (auto t = scanFrom; t < numTris; ++t)
+            {
+              if (!drawn[t] && triScore[t] > triScore[best]) best = t;
+            }
+        }
+
+      drawn[best] = 1;
+      for (size_t k = 0; k < 3; ++k)
+        {
+          auto v = idxs[3 * best + k];
+          out.push_back(v);
+
+          // take the triangle off v's list
+          auto begin = vertTris.begin() + (long) firstTri[v];
+          auto end = begin + (long) valence[v];
+          std::iter_swap(std::find(begin, end, best), end - 1);
+          --valence[v];
+        }
+
+      // the triangle's vertices to the front, most recent first
+      nextCache.clear();
+      auto pushNew = [&nextCache](size_t v)
+        {
+          if (std::find(nextCache.begin(), nextCache.end(), v)
+              == nextCache.end())
+            {
+              nextCache.push_back(v);
+            }
+        };
+      for (size_t k = 0; k < 3; ++k)
+        {
+          pushNew(idxs[3 * best + 2 - k]);
+        }
+      for (auto v : cache)
+        {
+          pushNew(v);
+        }
+      cache.swap(nextCache);
+
+      // rescore what's in the cache, and the triangles around it, and
+      // pick the best of those for next time
+      for (size_t i = 0; i < cache.size(); ++i)
+        {
+          auto v = cache[i];
+          cachePos[v] = (i < meshCacheSize) ? (int) i : -1;
+          vertScore[v] = vertexScore(cachePos[v], valence[v]);
+        }
+      best = (size_t) -1;
+      for (auto v : cache)
+        {
+          for (size_t i = 0; i < valence[v]; ++i)
+            {
+              auto t = vertTris[firstTri[v] + i];
+              triScore[t] = vertScore[idxs[3 * t]]
+                + vertScore[idxs[3 * t + 1]]
+                + vertScore[idxs[3 * t + 2]];
+              if (best == (size_t) -1 || triScore[t] > triScore[best])
+                {
+                  best = t;
+                }
+            }
+        }
+      if (cache.size() > meshCacheSize) cache.resize(meshCacheSize);
+    }
+
+  idxs.swap(out);
+}
+
+// -----------------------------------------------------------------------------
+// Vertex order
+// -----------------------------------------------------------------------------
+
+std::vector<size_t> dmp::optimizeVertexFetch(std::vector<size_t> & idxs,
+                                             size_t numVerts)
+{
+  auto unset = (size_t) -1;
+  std::vector<size_t> remap(numVerts, unset);
+  size_t next = 0;
+  for (auto & v : idxs)
+    {
+      expect("index in range", v < numVerts);
+      if (remap[v] == unset) remap[v] = next++;
+      v = remap[v];
+    }
+  for (auto & curr : remap)
+    {
+      if (curr == unset) curr = next++;
+    }
+  return remap;
+}
+
+dmp::MeshOptimizeStats dmp::optimizeMesh(std::vector<size_t> & idxs,
+                                         size_t numVerts,
+                                         std::vector<size_t> & remap)
+{
+  MeshOptimizeStats stats;
+  stats.acmrBefore = computeACMR(idxs);
+
+  // meshes exported as strips can already beat the greedy order; keep
+  // theirs then
+  auto ordered = idxs;
+  optimizeVertexCache(ordered, numVerts);
+  if (computeACMR(ordered) < stats.acmrBefore) idxs.swap(ordered);
+
+  remap = optimizeVertexFetch(idxs, numVerts);
+  stats.acmrAfter = computeACMR(idxs);
+  return stats;
+}
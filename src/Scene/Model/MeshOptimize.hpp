@@ -0,0 +1,54 @@
+#ifndef DMP_MESHOPTIMIZE_HPP
+#define DMP_MESHOPTIMIZE_HPP
+
+#include <vector>
+#include "../../util.hpp"
+
+namespace dmp
+{
+  // Post-transform cache entries assumed by the optimizer and the ACMR
+  const size_t meshCacheSize = 32;
+
+  struct MeshOptimizeStats
+  {
+    float acmrBefore = 0.0f;
+    float acmrAfter = 0.0f;
+  };
+
+  // Average cache misses per triangle: vertices transformed per triangle
+  // drawn through a FIFO post-transform cache of cacheSize vertices. 3 is
+  // no reuse at all; around 0.5 is as good as a big regular mesh gets
+  float computeACMR(const std::vector<size_t> & idxs,
+                    size_t cacheSize = meshCacheSize);
+
+  // Reorders the triangles of idxs so that each reuses the vertices of
+  // those just before it, by Forsyth's greedy scoring of an LRU cache
+  void optimizeVertexCache(std::vector<size_t> & idxs, size_t numVerts);
+
+  // Renumbers the vertices in the order idxs first uses them, so that
+  // fetches walk forward through memory. Returns remap, remap[old] = new;
+  // vertices no triangle uses go last, in their old order
+  std::vector<size_t> optimizeVertexFetch(std::vector<size_t> & idxs,
+                                          size_t numVerts);
+
+  // Both, in that order, keeping the triangle order idxs came in when
+  // optimizeVertexCache can't beat it
+  MeshOptimizeStats optimizeMesh(std::vector<size_t> & idxs,
+                                 size_t numVerts,
+                                 std::vector<size_t> & remap);
+
+  // Moves data[old] to data[remap[old]]
+  template <typename T>
+  void applyRemap(const std::vector<size_t> & remap, std::vector<T> & data)
+  {
+    expect("a new index per element", remap.size() == data.size());
+    std::vector<T> moved(data.size());
+    for (size_t i = 0; i < data.size(); ++i)
+      {
+        moved[remap[i]] = std::move(data[i]);
+      }
+    data.swap(moved);
+  }
+}
+
+#endif
@@ -121,6 +121,26 @@ void dmp::Morph::initNullMorph(const std::vector<glm::vec3> & verts,
   mValid = true;
 }
 
+void dmp::Morph::remap(const std::vector<size_t> & sources,
+                       size_t numSourceVerts)
+{
+  auto move = [&sources, numSourceVerts](std::map<size_t, glm::vec3> & m)
+    {
+      expect("morph index in range",
+             m.empty() || m.rbegin()->first < numSourceVerts);
+      std::map<size_t, glm::vec3> moved;
+      for (size_t i = 0; i < sources.size(); ++i)
+        {
+          auto curr = m.find(sources[i]);
+          if (curr != m.end()) moved.emplace_hint(moved.end(), i, curr->second);
+        }
+      m.swap(moved);
+    };
+
+  move(verts);
+  move(normals);
+}
+
 dmp::Morph::Morph(const Morph & lhs,
                   const Morph & rhs,
                   float t)
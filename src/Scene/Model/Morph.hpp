@@ -21,6 +21,12 @@ namespace dmp
           float t);
 
     operator bool() {return mValid;}
+
+    // Renumbers the morphed vertices: vertex i takes what was vertex
+    // sources[i], which may be what several take, e.g. by
+    // Skin::askSources. The morph indexes the numSourceVerts vertices
+    // sources draws from, e.g. Skin::askNumFileVerts
+    void remap(const std::vector<size_t> & sources, size_t numSourceVerts);
     void initNullMorph(const std::vector<glm::vec3> & verts,
                        const std::vector<glm::vec3> & normals,
                        Morph * morphs,
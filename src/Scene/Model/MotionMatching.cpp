@@ -0,0 +1,507 @@
+#include "MotionMatching.hpp"
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <limits>
+
+// rows per leaf. Small enough that leaves prune well, big enough that the
+// scan over one beats walking further down
+static const size_t mmLeafSize = 8;
+
+// features are compared this many floats at a time, a width the compiler
+// turns into vector code. Rows are padded to a multiple of it
+static const size_t mmBlock = 8;
+
+// how far ahead, in seconds, the trajectory points look
+static const float mmTrajectoryTimes[] = {1.0f / 3.0f, 2.0f / 3.0f, 1.0f};
+static const size_t mmTrajectoryLength =
+  sizeof(mmTrajectoryTimes) / sizeof(mmTrajectoryTimes[0]);
+
+// spreads below this are taken as no spread at all
+static const float mmMinSpread = 1e-6f;
+
+// The root's place on the ground, and the way it faces along the ground
+struct Heading
+{
+  glm::vec3 position;
+  glm::vec3 forward;
+};
+
+static Heading headingOf(const glm::mat4 & rootM)
+{
+  Heading h;
+  h.position = glm::vec3(rootM[3].x, 0.0f, rootM[3].z);
+  h.forward = glm::vec3(rootM[2].x, 0.0f, rootM[2].z);
+  auto l = glm::length(h.forward);
+  h.forward = (l < mmMinSpread) ? glm::vec3(0.0f, 0.0f, 1.0f) : h.forward / l;
+  return h;
+}
+
+// A world direction in h's frame: x right, y up, z forward
+static glm::vec3 toHeading(const Heading & h, const glm::vec3 & d)
+{
+  glm::vec3 right(h.forward.z, 0.0f, -h.forward.x);
+  return glm::vec3(glm::dot(d, right), d.y, glm::dot(d, h.forward));
+}
+
+// Squared distance between two padded rows, giving up a block at a time
+// once it passes bound
+static float distance(const float * a,
+                      const float * b,
+                      size_t stride,
+                      float bound)
+{
+  float sum = 0.0f;
+  for (size_t i = 0; i < stride; i += mmBlock)
+    {
+      float block = 0.0f;
+      for (size_t k = 0; k < mmBlock; ++k)
+        {
+          auto d = a[i + k] - b[i + k];
+          block += d * d;
+        }
+      sum += block;
+      if (sum >= bound) break;
+    }
+  return sum;
+}
+
+dmp::MotionDatabase::MotionDatabase(std::shared_ptr<const Rig> rig,
+                                    std::vector<size_t> joints,
+                                    float rateHz)
+{
+  initMotionDatabase(std::move(rig), std::move(joints), rateHz);
+}
+
+void dmp::MotionDatabase::initMotionDatabase(std::shared_ptr<const Rig> rig,
+                                             std::vector<size_t> joints,
+                                             float rateHz)
+{
+  expect("rig not null", rig);
+  expect("rate positive", rateHz > 0.0f);
+  mRig = std::move(rig);
+  mRate = rateHz;
+
+  auto n = mRig->askNumJoints();
+  if (joints.empty())
+    {
+      std::vector<char> hasChild(n, 0);
+      for (size_t i = 0; i < n; ++i)
+        {
+          auto parent = mRig->askParent(i);
+          if (parent >= 0) hasChild[(size_t) parent] = 1;
+        }
+      for (size_t i = 0; i < n; ++i)
+        {
+          if (!hasChild[i]) joints.push_back(i);
+        }
+    }
+  for (auto j : joints)
+    {
+      expect("feature joint in range", j < n);
+    }
+  mJoints = std::move(joints);
+
+  for (size_t i = 0; i < mmTrajectoryLength; ++i)
+    {
+      auto frames = (size_t) roundf(mmTrajectoryTimes[i] * mRate);
+      mTrajectoryFrames.push_back(std::max(frames, (size_t) 1));
+    }
+
+  mDims = 6 * mJoints.size() + 4 * mmTrajectoryLength;
+  mStride = (mDims + mmBlock - 1) / mmBlock * mmBlock;
+}
+
+size_t dmp::MotionDatabase::askTrajectoryLength() const
+{
+  return mmTrajectoryLength;
+}
+
+size_t dmp::MotionDatabase::addClip(const Animation & anim)
+{
+  auto numJoints = mJoints.size();
+  auto numFrames = std::max((size_t) ceilf(anim.askDuration() * mRate),
+                            (size_t) 1);
+
+  // one sample past each frame for velocities, and far enough past the
+  // last for its trajectory. Those past the end come from the clip's
+  // extrapolation
+  auto numSamples = numFrames + mTrajectoryFrames.back();
+  std::vector<glm::vec3> positions(numSamples * numJoints);
+  std::vector<Heading> headings(numSamples);
+
+  auto pose = anim.askRestPose();
+  expect("animation fits the rig",
+         pose.rotations.size() == mRig->askNumJoints());
+  std::vector<glm::mat4> Ms;
+  for (size_t s = 0; s < numSamples; ++s)
+    {
+      anim.evaluateAnimated((float) s / mRate, pose);
+      mRig->computeMs(pose, glm::mat4(), Ms);
+      headings[s] = headingOf(Ms[0]);
+      for (size_t j = 0; j < numJoints; ++j)
+        {
+          positions[s * numJoints + j] = glm::vec3(Ms[mJoints[j]][3]);
+        }
+    }
+
+  auto clip = mClipFirsts.size();
+  mClipFirsts.push_back(mClips.size());
+  mClipFrames.push_back(numFrames);
+
+  std::vector<float> row(mDims);
+  for (size_t f = 0; f < numFrames; ++f)
+    {
+      const auto & h = headings[f];
+      auto out = row.begin();
+      for (size_t j = 0; j < numJoints; ++j)
+        {
+          auto p = positions[f * numJoints + j];
+          auto next = positions[(f + 1) * numJoints + j];
+          auto local = toHeading(h, p - h.position);
+          auto velocity = toHeading(h, (next - p) * mRate);
+          out = std::copy(&local[0], &local[0] + 3, out);
+          out = std::copy(&velocity[0], &velocity[0] + 3, out);
+        }
+      for (auto ahead : mTrajectoryFrames)
+        {
+          const auto & future = headings[f + ahead];
+          auto local = toHeading(h, future.position - h.position);
+          auto facing = toHeading(h, future.forward);
+          *out++ = local.x;
+          *out++ = local.z;
+          *out++ = facing.x;
+          *out++ = facing.z;
+        }
+
+      mRaw.insert(mRaw.end(), row.begin(), row.end());
+      mClips.push_back(clip);
+      mTimes.push_back((float) f / mRate);
+    }
+
+  mNodes.clear();
+  return clip;
+}
+
+void dmp::MotionDatabase::build(const MotionWeights & weights)
+{
+  auto numFrames = mClips.size();
+  expect("database not empty", numFrames > 0);
+
+  mMeans.assign(mDims, 0.0f);
+  std::vector<float> variances(mDims, 0.0f);
+  for (size_t f = 0; f < numFrames; ++f)
+    {
+      for (size_t d = 0; d < mDims; ++d)
+        {
+          mMeans[d] += mRaw[f * mDims + d];
+        }
+    }
+  for (auto & m : mMeans)
+    {
+      m /= (float) numFrames;
+    }
+  for (size_t f = 0; f < numFrames; ++f)
+    {
+      for (size_t d = 0; d < mDims; ++d)
+        {
+          auto dev = mRaw[f * mDims + d] - mMeans[d];
+          variances[d] += dev * dev;
+        }
+    }
+
+  // each part is scaled by one spread across all of its dimensions, so
+  // that e.g. a joint's x and z keep their proportions. A part is count
+  // dimensions from first, repeated every every dimensions
+  mScales.assign(mDims, 0.0f);
+  auto scalePart = [&](size_t first,
+                       size_t count,
+                       size_t every,
+                       size_t repeats,
+                       float weight)
+    {
+      float variance = 0.0f;
+      for (size_t r = 0; r < repeats; ++r)
+        {
+          for (size_t k = 0; k < count; ++k)
+            {
+              variance += variances[first + r * every + k];
+            }
+        }
+      auto spread = sqrtf(variance / (float) (count * repeats * numFrames));
+      auto scale = weight / ((spread < mmMinSpread) ? 1.0f : spread);
+      for (size_t r = 0; r < repeats; ++r)
+        {
+          for (size_t k = 0; k < count; ++k)
+            {
+              mScales[first + r * every + k] = scale;
+            }
+        }
+    };
+  for (size_t j = 0; j < mJoints.size(); ++j)
+    {
+      scalePart(6 * j, 3, 0, 1, weights.positions);
+      scalePart(6 * j + 3, 3, 0, 1, weights.velocities);
+    }
+  auto trajectory = 6 * mJoints.size();
+  scalePart(trajectory, 2, 4, mmTrajectoryLength,
+            weights.trajectoryPositions);
+  scalePart(trajectory + 2, 2, 4, mmTrajectoryLength,
+            weights.trajectoryDirections);
+
+  std::vector<float> normalized(numFrames * mStride, 0.0f);
+  for (size_t f = 0; f < numFrames; ++f)
+    {
+      for (size_t d = 0; d < mDims; ++d)
+        {
+          normalized[f * mStride + d]
+            = (mRaw[f * mDims + d] - mMeans[d]) * mScales[d];
+        }
+    }
+
+  // the tree sorts frame indices; rows are then laid out in that order
+  mFeatures.swap(normalized);
+  std::vector<size_t> order(numFrames);
+  for (size_t f = 0; f < numFrames; ++f)
+    {
+      order[f] = f;
+    }
+  mNodes.clear();
+  buildNode(order, 0, numFrames);
+
+  normalized.assign(numFrames * mStride, 0.0f);
+  mRowFrames = order;
+  mFrameRows.resize(numFrames);
+  for (size_t r = 0; r < numFrames; ++r)
+    {
+      std::copy(&mFeatures[order[r] * mStride],
+                &mFeatures[order[r] * mStride] + mStride,
+                &normalized[r * mStride]);
+      mFrameRows[order[r]] = r;
+    }
+  mFeatures.swap(normalized);
+}
+
+size_t dmp::MotionDatabase::buildNode(std::vector<size_t> & order,
+                                      size_t begin,
+                                      size_t end)
+{
+  auto idx = mNodes.size();
+  mNodes.push_back({-1, 0.0f, 0, begin, end});
+  if (end - begin <= mmLeafSize) return idx;
+
+  // split the widest dimension at its median
+  int dim = -1;
+  float widest = mmMinSpread;
+  for (size_t d = 0; d < mDims; ++d)
+    {
+      auto lo = mFeatures[order[begin] * mStride + d];
+      auto hi = lo;
+      for (size_t i = begin + 1; i < end; ++i)
+        {
+          auto v = mFeatures[order[i] * mStride + d];
+          lo = std::min(lo, v);
+          hi = std::max(hi, v);
+        }
+      if (hi - lo > widest)
+        {
+          widest = hi - lo;
+          dim = (int) d;
+        }
+    }
+  if (dim < 0) return idx; // all the same
+
+  auto mid = begin + (end - begin) / 2;
+  auto at = [&](size_t f) {return mFeatures[f * mStride + (size_t) dim];};
+  std::nth_element(order.begin() + (long) begin,
+                   order.begin() + (long) mid,
+                   order.begin() + (long) end,
+                   [&](size_t lhs, size_t rhs) {return at(lhs) < at(rhs);});
+
+  mNodes[idx].dim = dim;
+  mNodes[idx].split = at(order[mid]);
+  buildNode(order, begin, mid);
+  auto right = buildNode(order, mid, end);
+  mNodes[idx].right = right;
+  return idx;
+}
+
+size_t dmp::MotionDatabase::askFrame(size_t clip, float t) const
+{
+  expect("clip in range", clip < mClipFirsts.size());
+  auto last = (float) (mClipFrames[clip] - 1);
+  auto f = glm::clamp(roundf(t * mRate), 0.0f, last);
+  return mClipFirsts[clip] + (size_t) f;
+}
+
+void dmp::MotionDatabase::askFeature(size_t frame,
+                                     std::vector<float> & query) const
+{
+  expect("database built", isBuilt());
+  expect("frame in range", frame < mFrameRows.size());
+  const auto * row = &mFeatures[mFrameRows[frame] * mStride];
+  query.assign(row, row + mStride);
+}
+
+void dmp::MotionDatabase::tellTrajectory
+(const std::vector<glm::vec2> & positions,
+ const std::vector<glm::vec2> & directions,
+ std::vector<float> & query) const
+{
+  expect("database built", isBuilt());
+  expect("one position per trajectory point",
+         positions.size() == mmTrajectoryLength);
+  expect("one direction per trajectory point",
+         directions.size() == mmTrajectoryLength);
+  expect("query from askFeature", query.size() == mStride);
+
+  auto d = 6 * mJoints.size();
+  for (size_t i = 0; i < mmTrajectoryLength; ++i)
+    {
+      const float raw[] = {positions[i].x, positions[i].y,
+                           directions[i].x, directions[i].y};
+      for (size_t k = 0; k < 4; ++k, ++d)
+        {
+          query[d] = (raw[k] - mMeans[d]) * mScales[d];
+        }
+    }
+}
+
+dmp::MotionMatch dmp::MotionDatabase::matchOf(size_t row, float cost) const
+{
+  auto frame = mRowFrames[row];
+  return {frame, mClips[frame], mTimes[frame], cost};
+}
+
+void dmp::MotionDatabase::searchNode(size_t node,
+                                     const float * query,
+                                     float bound,
+                                     float * offsets,
+                                     float & best,
+                                     size_t & bestRow) const
+{
+  if (bound >= best) return;
+
+  const auto & n = mNodes[node];
+  if (n.dim < 0)
+    {
+      for (auto r = n.begin; r < n.end; ++r)
+        {
+          auto cost = distance(query, &mFeatures[r * mStride], mStride, best);
+          if (cost < best)
+            {
+              best = cost;
+              bestRow = r;
+            }
+        }
+      return;
+    }
+
+  // the far cell is gap away along dim, wherever the query was along dim
+  // before. Counting every dimension's offset, not just this one's, is
+  // what lets the tree prune with this many dimensions
+  auto dim = (size_t) n.dim;
+  auto gap = query[dim] - n.split;
+  auto nearSide = (gap < 0.0f) ? node + 1 : n.right;
+  auto farSide = (gap < 0.0f) ? n.right : node + 1;
+  searchNode(nearSide, query, bound, offsets, best, bestRow);
+
+  auto old = offsets[dim];
+  offsets[dim] = gap;
+  searchNode(farSide, query, bound - old * old + gap * gap,
+             offsets, best, bestRow);
+  offsets[dim] = old;
+}
+
+dmp::MotionMatch dmp::MotionDatabase::search
+(const std::vector<float> & query) const
+{
+  expect("database built", isBuilt());
+  expect("query from askFeature", query.size() == mStride);
+
+  auto best = std::numeric_limits<float>::infinity();
+  size_t bestRow = 0;
+  std::vector<float> offsets(mDims, 0.0f);
+  searchNode(0, query.data(), 0.0f, offsets.data(), best, bestRow);
+  return matchOf(bestRow, best);
+}
+
+dmp::MotionMatch dmp::MotionDatabase::searchLinear
+(const std::vector<float> & query) const
+{
+  expect("database built", isBuilt());
+  expect("query from askFeature", query.size() == mStride);
+
+  auto best = std::numeric_limits<float>::infinity();
+  size_t bestRow = 0;
+  for (size_t r = 0; r < mRowFrames.size(); ++r)
+    {
+      auto cost = distance(query.data(), &mFeatures[r * mStride],
+                           mStride, best);
+      if (cost < best)
+        {
+          best = cost;
+          bestRow = r;
+        }
+    }
+  return matchOf(bestRow, best);
+}
+
+std::vector<dmp::MotionSearchTiming>
+dmp::benchmarkMotionSearch(std::shared_ptr<const Rig> rig,
+                           const Animation & anim,
+                           const std::vector<size_t> & sizes,
+                           size_t queries,
+                           float noise)
+{
+  using Clock = std::chrono::steady_clock;
+  expect("animation has length", anim.askDuration() > 0.0f);
+  expect("at least one query", queries > 0);
+  expect("noise not negative", noise >= 0.0f);
+
+  std::vector<MotionSearchTiming> timings;
+  std::mt19937 rng(0);
+  for (auto size : sizes)
+    {
+      MotionDatabase db(rig, {}, (float) size / anim.askDuration());
+      db.addClip(anim);
+      db.build();
+
+      std::uniform_int_distribution<size_t> pick(0, db.askNumFrames() - 1);
+      std::normal_distribution<float> jitter(0.0f,
+                                             std::max(noise, mmMinSpread));
+      std::vector<std::vector<float>> qs(queries);
+      for (auto & q : qs)
+        {
+          db.askFeature(pick(rng), q);
+          for (size_t d = 0; d < db.askNumFeatures(); ++d)
+            {
+              if (noise > 0.0f) q[d] += jitter(rng);
+            }
+        }
+
+      MotionSearchTiming timing;
+      timing.frames = db.askNumFrames();
+      std::vector<float> costs(queries);
+
+      auto start = Clock::now();
+      for (size_t i = 0; i < queries; ++i)
+        {
+          costs[i] = db.search(qs[i]).cost;
+        }
+      auto mid = Clock::now();
+      for (size_t i = 0; i < queries; ++i)
+        {
+          auto cost = db.searchLinear(qs[i]).cost;
+          timing.agree = timing.agree && cost == costs[i];
+        }
+      auto end = Clock::now();
+
+      timing.treeMicroseconds = std::chrono::duration<float, std::micro>
+        (mid - start).count() / (float) queries;
+      timing.linearMicroseconds = std::chrono::duration<float, std::micro>
+        (end - mid).count() / (float) queries;
+      timings.push_back(timing);
+    }
+  return timings;
+}
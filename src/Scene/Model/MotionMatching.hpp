@@ -0,0 +1,172 @@
+#ifndef DMP_MOTIONMATCHING_HPP
+#define DMP_MOTIONMATCHING_HPP
+
+#include <vector>
+#include <memory>
+#include <glm/glm.hpp>
+#include "Rig.hpp"
+#include "Animation.hpp"
+
+namespace dmp
+{
+  // How much each part of a feature counts in a search. Each part is first
+  // scaled to unit spread over the whole database, so these only trade the
+  // parts off against each other
+  struct MotionWeights
+  {
+    float positions = 1.0f;
+    float velocities = 1.0f;
+    float trajectoryPositions = 1.0f;
+    float trajectoryDirections = 1.5f;
+  };
+
+  // The frame of some clip that best matches a query. cost is the squared
+  // distance between their features
+  struct MotionMatch
+  {
+    size_t frame;
+    size_t clip;
+    float time;
+    float cost;
+  };
+
+  // Every frame of a set of clips, sampled at a fixed rate and described by
+  // a feature: where a few joints are and how they move, and where the root
+  // goes and faces over the next second. All of it is in the character's
+  // frame, the root on the ground facing +z, so that matches don't care
+  // where the character stands. Searched with a k-d tree over the
+  // normalized features
+  //
+  // A feature is, for each feature joint, position then velocity, then for
+  // each trajectory point, position on the ground then facing, each as
+  // (right, forward)
+  class MotionDatabase
+  {
+  public:
+    MotionDatabase() = delete;
+    MotionDatabase(const MotionDatabase &) = delete;
+    MotionDatabase & operator=(const MotionDatabase &) = delete;
+    MotionDatabase(MotionDatabase &&) = default;
+    MotionDatabase & operator=(MotionDatabase &&) = default;
+
+    // joints are the feature joints; empty picks every leaf joint, e.g. the
+    // feet and hands
+    MotionDatabase(std::shared_ptr<const Rig> rig,
+                   std::vector<size_t> joints,
+                   float rateHz);
+
+    // Samples anim from time 0 to its duration. Returns the clip's index.
+    // The database must be built again before the next search
+    size_t addClip(const Animation & anim);
+
+    // Normalizes the features and builds the search tree
+    void build(const MotionWeights & weights = MotionWeights());
+    bool isBuilt() const {return !mNodes.empty();}
+
+    size_t askNumFrames() const {return mClips.size();}
+    size_t askNumClips() const {return mClipFirsts.size();}
+    size_t askNumFeatures() const {return mDims;}
+    size_t askTrajectoryLength() const;
+
+    size_t askClip(size_t frame) const
+    {
+      expect("frame in range", frame < mClips.size());
+      return mClips[frame];
+    }
+    float askTime(size_t frame) const
+    {
+      expect("frame in range", frame < mTimes.size());
+      return mTimes[frame];
+    }
+
+    // The frame of clip nearest time t
+    size_t askFrame(size_t clip, float t) const;
+
+    // frame's normalized feature, the starting point of a query
+    void askFeature(size_t frame, std::vector<float> & query) const;
+
+    // Overwrites the trajectory part of query with where the character
+    // should be and face at each trajectory point, in its own frame as
+    // (right, forward)
+    void tellTrajectory(const std::vector<glm::vec2> & positions,
+                        const std::vector<glm::vec2> & directions,
+                        std::vector<float> & query) const;
+
+    MotionMatch search(const std::vector<float> & query) const;
+
+    // The same answer by checking every frame, for comparison
+    MotionMatch searchLinear(const std::vector<float> & query) const;
+  private:
+    // Inner nodes split rows [begin, end) at split along dim, the rows
+    // below it in the next node, the rest in node right. Leaves have dim -1
+    struct Node
+    {
+      int dim;
+      float split;
+      size_t right;
+      size_t begin;
+      size_t end;
+    };
+
+    void initMotionDatabase(std::shared_ptr<const Rig> rig,
+                            std::vector<size_t> joints,
+                            float rateHz);
+    size_t buildNode(std::vector<size_t> & order,
+                     size_t begin,
+                     size_t end);
+    // bound is the squared distance from query to node's cell, and
+    // offsets[d] the part of it along d
+    void searchNode(size_t node,
+                    const float * query,
+                    float bound,
+                    float * offsets,
+                    float & best,
+                    size_t & bestRow) const;
+    MotionMatch matchOf(size_t row, float cost) const;
+
+    std::shared_ptr<const Rig> mRig;
+    std::vector<size_t> mJoints;
+    float mRate;
+    std::vector<size_t> mTrajectoryFrames; // how far ahead each point is
+    size_t mDims;
+    size_t mStride; // mDims padded to a whole number of blocks
+
+    // per frame, in the order added: the raw feature, its clip and time
+    std::vector<float> mRaw;
+    std::vector<size_t> mClips;
+    std::vector<float> mTimes;
+    std::vector<size_t> mClipFirsts;
+    std::vector<size_t> mClipFrames;
+
+    // normalized features, value = (raw - mean) * scale. Rows are in tree
+    // order, so each leaf is one run of memory
+    std::vector<float> mMeans;
+    std::vector<float> mScales;
+    std::vector<float> mFeatures;
+    std::vector<size_t> mRowFrames;
+    std::vector<size_t> mFrameRows;
+    std::vector<Node> mNodes;
+  };
+
+  // Mean time per query of each search on a database of one clip, sampled
+  // finely enough to hold frames frames
+  struct MotionSearchTiming
+  {
+    size_t frames = 0;
+    float treeMicroseconds = 0.0f;
+    float linearMicroseconds = 0.0f;
+    bool agree = true; // both found matches of the same cost
+  };
+
+  // Times both searches for each database size in sizes, on queries that
+  // are random frames of anim moved off by noise, in normalized units, in
+  // every dimension. The further off, the less of the tree is pruned
+  std::vector<MotionSearchTiming>
+  benchmarkMotionSearch(std::shared_ptr<const Rig> rig,
+                        const Animation & anim,
+                        const std::vector<size_t> & sizes,
+                        size_t queries,
+                        float noise);
+}
+
+#endif
@@ -3,6 +3,7 @@
 
 #include <vector>
 #include <glm/glm.hpp>
+#include "../../Quaternion.hpp"
 
 namespace dmp
 {
@@ -11,6 +12,15 @@ namespace dmp
     glm::vec3 translation;
     std::vector<glm::vec3> rotations;
   };
+
+  // A Pose with each joint's rotation as a unit quaternion, within the
+  // joint's limits. Blends of these stay rigid, which blends of Euler
+  // angles or of matrices don't. Rig::toJointPose makes one
+  struct JointPose
+  {
+    glm::vec3 translation;
+    std::vector<Quaternion> rotations;
+  };
 }
 
 #endif
@@ -0,0 +1,62 @@
+#include "PoseCache.hpp"
+#include <boost/functional/hash.hpp>
+
+dmp::PoseCache::PoseCache(float quantum, size_t numMatrices)
+{
+  initPoseCache(quantum, numMatrices);
+}
+
+void dmp::PoseCache::initPoseCache(float quantum, size_t numMatrices)
+{
+  expect("quantum positive", quantum > 0.0f);
+  expect("slots hold at least one matrix", numMatrices > 0);
+
+  mQuantum = quantum;
+  mNumMatrices = numMatrices;
+}
+
+size_t dmp::PoseCache::KeyHash::operator()(const Key & k) const
+{
+  size_t h = 0;
+  boost::hash_combine(h, k.animation);
+  boost::hash_combine(h, k.tick);
+  return h;
+}
+
+void dmp::PoseCache::beginFrame()
+{
+  mIndex.clear();
+  mSlots.clear();
+  mFrameStats = {};
+}
+
+size_t dmp::PoseCache::acquire(const Animation & anim, float t)
+{
+  // Animation::evaluate wraps t into one loop the same way, so instances
+  // whole loops apart share a slot too
+  auto duration = anim.askDuration();
+  auto local = fmodf(t, duration);
+  if (local < 0.0f) local += duration;
+
+  Key k = {&anim, (int64_t) roundf(local / mQuantum)};
+
+  ++mFrameStats.lookups;
+  ++mTotalStats.lookups;
+
+  auto found = mIndex.find(k);
+  if (found != mIndex.end())
+    {
+      ++mFrameStats.hits;
+      ++mTotalStats.hits;
+      return found->second;
+    }
+
+  auto slot = mSlots.size();
+  mIndex[k] = slot;
+  mSlots.push_back(k);
+  if (mMatrices.size() < mSlots.size() * mNumMatrices)
+    {
+      mMatrices.resize(mSlots.size() * mNumMatrices);
+    }
+  return slot;
+}
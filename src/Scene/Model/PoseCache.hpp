@@ -0,0 +1,106 @@
+#ifndef DMP_POSECACHE_HPP
+#define DMP_POSECACHE_HPP
+
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+#include <glm/glm.hpp>
+#include "Animation.hpp"
+
+namespace dmp
+{
+  struct PoseCacheStats
+  {
+    size_t lookups = 0;
+    size_t hits = 0;
+
+    float hitRate() const
+    {
+      if (lookups == 0) return 0.0f;
+      return (float) hits / (float) lookups;
+    }
+  };
+
+  // Per frame storage for the matrices of every distinct (animation,
+  // quantized time) that was asked for. Users acquire a slot per instance,
+  // fill each slot once, then read it back for every instance that shares
+  // it. Acquiring is serial; filling and reading distinct slots can happen
+  // on any thread
+  class PoseCache
+  {
+  public:
+    PoseCache() = delete;
+    PoseCache(const PoseCache &) = delete;
+    PoseCache & operator=(const PoseCache &) = delete;
+    PoseCache(PoseCache &&) = default;
+    PoseCache & operator=(PoseCache &&) = default;
+
+    // quantum is the width in seconds of a time bucket, numMatrices the
+    // size of one slot
+    PoseCache(float quantum, size_t numMatrices);
+
+    // Drops every slot, keeping their storage
+    void beginFrame();
+
+    // The slot for anim at time t, added if this frame has not seen it
+    size_t acquire(const Animation & anim, float t);
+
+    size_t askNumSlots() const {return mSlots.size();}
+
+    // What a slot should be filled with: anim evaluated at this time.
+    // Every t that shares the slot maps to the same time
+    const Animation & askSlotAnimation(size_t slot) const
+    {
+      expect("slot in range", slot < mSlots.size());
+      return *mSlots[slot].animation;
+    }
+    float askSlotTime(size_t slot) const
+    {
+      expect("slot in range", slot < mSlots.size());
+      return (float) mSlots[slot].tick * mQuantum;
+    }
+
+    glm::mat4 * askMatrices(size_t slot)
+    {
+      expect("slot in range", slot < mSlots.size());
+      return &mMatrices[slot * mNumMatrices];
+    }
+    const glm::mat4 * askMatrices(size_t slot) const
+    {
+      expect("slot in range", slot < mSlots.size());
+      return &mMatrices[slot * mNumMatrices];
+    }
+
+    const PoseCacheStats & askFrameStats() const {return mFrameStats;}
+    const PoseCacheStats & askTotalStats() const {return mTotalStats;}
+  private:
+    struct Key
+    {
+      const Animation * animation;
+      int64_t tick;
+
+      bool operator==(const Key & other) const
+      {
+        return animation == other.animation && tick == other.tick;
+      }
+    };
+
+    struct KeyHash
+    {
+      size_t operator()(const Key & k) const;
+    };
+
+    void initPoseCache(float quantum, size_t numMatrices);
+
+    float mQuantum;
+    size_t mNumMatrices;
+    std::unordered_map<Key, size_t, KeyHash> mIndex;
+    std::vector<Key> mSlots;
+    std::vector<glm::mat4> mMatrices;
+
+    PoseCacheStats mFrameStats;
+    PoseCacheStats mTotalStats;
+  };
+}
+
+#endif
@@ -0,0 +1,794 @@
+#include "Ragdoll.hpp"
+#include <chrono>
+#include <limits>
+#include <algorithm>
+#include "../../JobSystem.hpp"
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/constants.hpp>
+
+// ragdolls per job. Each is a few hundred rows of work per substep
+static const size_t ragdollGrain = 1;
+
+// frames longer than this are split, so the joints hold at low frame rates
+static const float ragdollMaxStep = 1.0f / 60.0f;
+
+// fraction of joint or ground error fixed per substep
+static const float ragdollBeta = 0.2f;
+
+// ground contacts start this far above the plane, and this much
+// penetration is let be, so that resting bodies don't jitter
+static const float ragdollContactMargin = 0.02f;
+static const float ragdollSlop = 0.005f;
+
+static const float ragdollLinearDamping = 0.05f;
+static const float ragdollAngularDamping = 0.5f;
+
+// limits start pushing back this close to the end of their range, in
+// radians
+static const float ragdollLimitMargin = 0.2f;
+
+// joint friction: how fast a child stops turning relative to its parent.
+// Without it, limbs on free joints swing like pendulums for seconds
+static const float ragdollJointDamping = 4.0f;
+
+// below these speeds for ragdollSleepTime, a ragdoll goes to sleep
+static const float ragdollSleepLinear = 0.05f;
+static const float ragdollSleepAngular = 0.1f;
+static const float ragdollSleepTime = 0.5f;
+
+// no joint joins bodies whose masses differ by more than this
+static const float ragdollMaxMassRatio = 4.0f;
+
+// thinner boxes than this are thickened, to keep inertia sane
+static const float ragdollMinExtent = 0.02f;
+
+// benchmarkRagdoll: spacing, drop height above the ground and the
+// solver's iterations
+static const float ragdollBenchSpacing = 4.0f;
+static const float ragdollBenchHeight = 2.0f;
+static const size_t ragdollBenchIterations = 10;
+
+// r x v == skew(r) * v
+static glm::mat3 skew(const glm::vec3 & r)
+{
+  return glm::mat3(0.0f, r.z, -r.y,
+                   -r.z, 0.0f, r.x,
+                   r.y, -r.x, 0.0f);
+}
+
+dmp::Ragdoll::Ragdoll(std::shared_ptr<const Rig> rig, float density)
+{
+  initRagdoll(std::move(rig), density);
+}
+
+void dmp::Ragdoll::initRagdoll(std::shared_ptr<const Rig> rig, float density)
+{
+  expect("rig not null", rig);
+  expect("density positive", density > 0.0f);
+  mRig = std::move(rig);
+
+  auto n = mRig->askNumJoints();
+  mBodies.resize(n);
+  std::vector<glm::vec3> reachMins(n, glm::vec3(0.0f));
+  std::vector<glm::vec3> reachMaxs(n, glm::vec3(0.0f));
+  for (size_t i = 0; i < n; ++i)
+    {
+      auto & b = mBodies[i];
+      const auto & min = mRig->askBoxMin(i);
+      const auto & max = mRig->askBoxMax(i);
+
+      auto e = glm::max(max - min, glm::vec3(ragdollMinExtent));
+      auto mass = density * e.x * e.y * e.z;
+
+      b.com = 0.5f * (min + max);
+      b.invMass = 1.0f / mass;
+
+      // inertia as if the box reached out to the children it carries, like
+      // the bone it stands for. Boxes far smaller than their bones, such as
+      // the default ones, otherwise spin so freely that the joints can't
+      // hold them
+      reachMins[i] = glm::min(reachMins[i], min);
+      reachMaxs[i] = glm::max(reachMaxs[i], max);
+      auto parent = mRig->askParent(i);
+      if (parent >= 0)
+        {
+          auto & pMin = reachMins[(size_t) parent];
+          auto & pMax = reachMaxs[(size_t) parent];
+          pMin = glm::min(pMin, mRig->askOffset(i));
+          pMax = glm::max(pMax, mRig->askOffset(i));
+        }
+    }
+
+  // a light body between heavy ones, like a small neck box under a big
+  // head, gets pushed through its limits by them. Lighter sides of a joint
+  // are made heavier, down the tree and then back up
+  for (size_t i = 0; i < n; ++i)
+    {
+      auto parent = mRig->askParent(i);
+      if (parent < 0) continue;
+      auto maxInv = ragdollMaxMassRatio * mBodies[(size_t) parent].invMass;
+      mBodies[i].invMass = glm::min(mBodies[i].invMass, maxInv);
+    }
+  for (size_t k = n; k > 0; --k)
+    {
+      auto parent = mRig->askParent(k - 1);
+      if (parent < 0) continue;
+      auto maxInv = ragdollMaxMassRatio * mBodies[k - 1].invMass;
+      auto & invMass = mBodies[(size_t) parent].invMass;
+      invMass = glm::min(invMass, maxInv);
+    }
+
+  for (size_t i = 0; i < n; ++i)
+    {
+      auto & b = mBodies[i];
+      auto e = glm::max(reachMaxs[i] - reachMins[i],
+                        glm::vec3(ragdollMinExtent));
+      b.invInertia = 12.0f * b.invMass / glm::vec3(e.y * e.y + e.z * e.z,
+                                                   e.x * e.x + e.z * e.z,
+                                                   e.x * e.x + e.y * e.y);
+    }
+
+  mLimited.resize(n);
+  for (size_t i = 0; i < n; ++i)
+    {
+      auto inf = std::numeric_limits<float>::infinity();
+      const auto & lo = mRig->askRotMin(i);
+      const auto & hi = mRig->askRotMax(i);
+      mLimited[i] = lo.x > -inf || lo.y > -inf || lo.z > -inf
+        || hi.x < inf || hi.y < inf || hi.z < inf;
+    }
+
+  Pose rest;
+  rest.translation = glm::vec3();
+  rest.rotations.resize(n);
+  for (size_t i = 0; i < n; ++i)
+    {
+      rest.rotations[i] = mRig->askRestRotation(i);
+    }
+  tellPose(rest, glm::mat4());
+
+  mJointRows.reserve(n);
+  mAngleRows.reserve(6 * n);
+  mContactRows.reserve(8 * n);
+}
+
+void dmp::Ragdoll::place(const Pose & p,
+                         const glm::mat4 & M,
+                         std::vector<glm::vec3> & xs,
+                         std::vector<Quaternion> & qs) const
+{
+  auto n = mRig->askNumJoints();
+  expect("pose covers every joint", p.rotations.size() >= n);
+
+  // joint origins in xs first, then moved to the centers of mass
+  xs.resize(n);
+  qs.resize(n);
+  auto qM = toQuaternion(glm::mat3(M));
+  for (size_t i = 0; i < n; ++i)
+    {
+      auto rot = mRig->jointRotation(i, p.rotations[i]);
+      auto parent = mRig->askParent(i);
+      if (parent < 0)
+        {
+          qs[i] = qM * rot;
+          xs[i] = glm::vec3(M * glm::vec4(p.translation
+                                          + mRig->askOffset(i), 1.0f));
+        }
+      else
+        {
+          const auto & qp = qs[(size_t) parent];
+          qs[i] = qp * rot;
+          xs[i] = xs[(size_t) parent] + dmp::rotate(qp, mRig->askOffset(i));
+        }
+    }
+  for (size_t i = 0; i < n; ++i)
+    {
+      xs[i] += dmp::rotate(qs[i], mBodies[i].com);
+    }
+}
+
+void dmp::Ragdoll::tellPose(const Pose & p, const glm::mat4 & M)
+{
+  std::vector<glm::vec3> xs;
+  std::vector<Quaternion> qs;
+  place(p, M, xs, qs);
+
+  mEulers.resize(mBodies.size());
+  for (size_t i = 0; i < mBodies.size(); ++i)
+    {
+      mBodies[i].x = xs[i];
+      mBodies[i].q = qs[i];
+      mBodies[i].v = glm::vec3();
+      mBodies[i].w = glm::vec3();
+      mEulers[i] = mRig->clampRotation(i, p.rotations[i]);
+    }
+  mJointImpulses.assign(mBodies.size(), glm::vec3());
+  mAngleImpulses.assign(6 * mBodies.size(), 0.0f);
+  mContactImpulses.assign(8 * mBodies.size(), glm::vec3());
+  wake();
+}
+
+void dmp::Ragdoll::tellPose(const Pose & p,
+                            const Pose & previous,
+                            const glm::mat4 & M,
+                            float deltaT)
+{
+  expect("deltaT positive", deltaT > 0.0f);
+
+  tellPose(p, M);
+
+  std::vector<glm::vec3> xs;
+  std::vector<Quaternion> qs;
+  place(previous, M, xs, qs);
+
+  for (size_t i = 0; i < mBodies.size(); ++i)
+    {
+      auto & b = mBodies[i];
+      b.v = (b.x - xs[i]) / deltaT;
+
+      // the turn from last frame to this one, as an angular velocity
+      auto dq = b.q * conjugate(qs[i]);
+      if (dq.real < 0.0f) dq = -dq;
+      auto s = glm::length(dq.imaginary);
+      if (s < 1e-6f) continue;
+      auto angle = 2.0f * atan2f(s, dq.real);
+      b.w = dq.imaginary * (angle / (s * deltaT));
+    }
+}
+
+void dmp::Ragdoll::applyImpulse(size_t joint,
+                                const glm::vec3 & point,
+                                const glm::vec3 & impulse)
+{
+  expect("joint in range", joint < mBodies.size());
+
+  auto & b = mBodies[joint];
+  auto R = glm::mat3(rigidTransform(b.q, glm::vec3()));
+  auto invI = R * glm::mat3(b.invInertia.x, 0.0f, 0.0f,
+                            0.0f, b.invInertia.y, 0.0f,
+                            0.0f, 0.0f, b.invInertia.z) * glm::transpose(R);
+
+  b.v += b.invMass * impulse;
+  b.w += invI * glm::cross(point - b.x, impulse);
+  wake();
+}
+
+void dmp::Ragdoll::askPose(const glm::mat4 & M, Pose & out) const
+{
+  auto n = mBodies.size();
+
+  // the solver tracks every joint's angles as they move, so its forms are
+  // the ones within limits. Only the root, which turns against M rather
+  // than a parent, goes by what out already holds
+  bool haveRoot = out.rotations.size() == n;
+  out.rotations.resize(n);
+
+  for (size_t i = 0; i < n; ++i)
+    {
+      auto parent = mRig->askParent(i);
+      if (parent < 0)
+        {
+          const auto & near = haveRoot ? out.rotations[i] : mEulers[i];
+          auto qM = toQuaternion(glm::mat3(M));
+          auto origin = glm::inverse(M) * glm::vec4(jointOrigin(i), 1.0f);
+          out.translation = glm::vec3(origin) - mRig->askOffset(i);
+          out.rotations[i] = toEulerZYX(conjugate(qM) * mBodies[i].q, near);
+        }
+      else
+        {
+          const auto & qp = mBodies[(size_t) parent].q;
+          out.rotations[i] = toEulerZYX(conjugate(qp) * mBodies[i].q,
+                                        mEulers[i]);
+        }
+    }
+}
+
+void dmp::Ragdoll::blendPose(const Pose & animated,
+                             float weight,
+                             const glm::mat4 & M,
+                             Pose & out) const
+{
+  expect("out is not animated", &out != &animated);
+  expect("pose covers every joint",
+         animated.rotations.size() >= mBodies.size());
+
+  out.rotations.assign(animated.rotations.begin(),
+                       animated.rotations.begin() + (long) mBodies.size());
+  askPose(M, out);
+
+  out.translation = glm::mix(animated.translation, out.translation, weight);
+  for (size_t i = 0; i < mBodies.size(); ++i)
+    {
+      auto from = mRig->jointRotation(i, animated.rotations[i]);
+      auto to = eulerZYX(out.rotations[i]);
+      out.rotations[i] = toEulerZYX(nlerp(weight, from, to),
+                                    animated.rotations[i]);
+    }
+}
+
+void dmp::Ragdoll::computeMs(std::vector<glm::mat4> & Ms) const
+{
+  Ms.resize(mBodies.size());
+  for (size_t i = 0; i < mBodies.size(); ++i)
+    {
+      Ms[i] = rigidTransform(mBodies[i].q, jointOrigin(i));
+    }
+}
+
+// -----------------------------------------------------------------------------
+// RagdollSolver
+// -----------------------------------------------------------------------------
+
+dmp::RagdollSolver::RagdollSolver(size_t iterations, float groundHeight)
+{
+  initRagdollSolver(iterations, groundHeight);
+}
+
+void dmp::RagdollSolver::initRagdollSolver(size_t iterations,
+                                           float groundHeight)
+{
+  expect("at least one iteration", iterations > 0);
+
+  mIterations = iterations;
+  mGround = groundHeight;
+}
+
+dmp::RagdollStats dmp::RagdollSolver::step(std::vector<Ragdoll *> & ragdolls,
+                                           float deltaT,
+                                           JobSystem & jobs) const
+{
+  auto start = std::chrono::steady_clock::now();
+
+  RagdollStats stats;
+  stats.ragdolls = ragdolls.size();
+  std::vector<size_t> contacts(ragdolls.size(), 0);
+
+  // INVARIANT: each ragdoll is touched by exactly one job
+  jobs.parallelFor(ragdolls.size(), ragdollGrain,
+                   [&](size_t begin, size_t end)
+                   {
+                     for (size_t i = begin; i < end; ++i)
+                       {
+                         contacts[i] = stepOne(*ragdolls[i], deltaT);
+                       }
+                   });
+
+  for (size_t i = 0; i < ragdolls.size(); ++i)
+    {
+      stats.contacts += contacts[i];
+      if (ragdolls[i]->isAsleep()) ++stats.asleep;
+    }
+  stats.microseconds = std::chrono::duration<float, std::micro>
+    (std::chrono::steady_clock::now() - start).count();
+  return stats;
+}
+
+size_t dmp::RagdollSolver::stepOne(Ragdoll & ragdoll, float deltaT) const
+{
+  if (ragdoll.isAsleep() || deltaT <= 0.0f) return 0;
+
+  auto count = (size_t) ceilf(deltaT / ragdollMaxStep);
+  auto h = deltaT / (float) count;
+
+  size_t contacts = 0;
+  for (size_t i = 0; i < count && !ragdoll.isAsleep(); ++i)
+    {
+      contacts = substep(ragdoll, h);
+    }
+  return contacts;
+}
+
+size_t dmp::RagdollSolver::substep(Ragdoll & ragdoll, float h) const
+{
+  const auto & rig = *ragdoll.mRig;
+  auto & bodies = ragdoll.mBodies;
+  auto n = bodies.size();
+
+  auto linearDamp = 1.0f / (1.0f + h * ragdollLinearDamping);
+  auto angularDamp = 1.0f / (1.0f + h * ragdollAngularDamping);
+  for (auto & b : bodies)
+    {
+      b.v = (b.v + mGravity * h) * linearDamp;
+      b.w *= angularDamp;
+
+      auto R = glm::mat3(rigidTransform(b.q, glm::vec3()));
+      b.invInertiaW = R * glm::mat3(b.invInertia.x, 0.0f, 0.0f,
+                                    0.0f, b.invInertia.y, 0.0f,
+                                    0.0f, 0.0f, b.invInertia.z)
+        * glm::transpose(R);
+    }
+
+  // ball joints: each child's joint origin stays on its parent's offset
+  auto & jointRows = ragdoll.mJointRows;
+  auto & angleRows = ragdoll.mAngleRows;
+  jointRows.clear();
+  angleRows.clear();
+  for (size_t i = 0; i < n; ++i)
+    {
+      auto parent = rig.askParent(i);
+      if (parent < 0) continue;
+
+      auto & A = bodies[(size_t) parent];
+      auto & B = bodies[i];
+
+      auto Kw = A.invInertiaW + B.invInertiaW;
+      auto friction = glm::inverse(Kw) * (B.w - A.w)
+        * glm::min(ragdollJointDamping * h, 1.0f);
+      A.w += A.invInertiaW * friction;
+      B.w -= B.invInertiaW * friction;
+
+      Ragdoll::JointRow row;
+      row.a = (size_t) parent;
+      row.b = i;
+      row.rA = rotate(A.q, rig.askOffset(i) - A.com);
+      row.rB = rotate(B.q, -B.com);
+
+      auto sA = skew(row.rA);
+      auto sB = skew(row.rB);
+      auto K = glm::mat3(A.invMass + B.invMass)
+        - sA * A.invInertiaW * sA
+        - sB * B.invInertiaW * sB;
+      row.invK = glm::inverse(K);
+      row.bias = -(ragdollBeta / h) * ((B.x + row.rB) - (A.x + row.rA));
+      row.impulse = ragdoll.mJointImpulses[i];
+      jointRows.push_back(row);
+
+      // tracked every substep, so angles stay continuous for askPose too
+      auto & e = ragdoll.mEulers[i];
+      e = toEulerZYX(conjugate(A.q) * B.q, e);
+      if (!ragdoll.mLimited[i]) continue;
+
+      // limits: each Euler angle near an end of its range gets a row along
+      // the axis that angle turns about. It may close the gap this substep,
+      // not cross it, so fast limbs stop at the limit instead of going past
+      // and being pulled back
+
+      auto qz = A.q * Quaternion(e.z, RotationAxis::Z);
+      auto qzy = qz * Quaternion(e.y, RotationAxis::Y);
+      glm::vec3 axes[3] = {rotate(qzy, {1.0f, 0.0f, 0.0f}),
+                           rotate(qz, {0.0f, 1.0f, 0.0f}),
+                           rotate(A.q, {0.0f, 0.0f, 1.0f})};
+      const auto & lo = rig.askRotMin(i);
+      const auto & hi = rig.askRotMax(i);
+      for (int k = 0; k < 3; ++k)
+        {
+          for (int side = 0; side < 2; ++side)
+            {
+              // how far inside the limit, negative once past it
+              auto gap = (side == 0) ? e[k] - lo[k] : hi[k] - e[k];
+              if (gap > ragdollLimitMargin) continue;
+
+              Ragdoll::AngleRow angle;
+              angle.a = (size_t) parent;
+              angle.b = i;
+              angle.slot = 6 * i + 2 * (size_t) k + (size_t) side;
+              angle.axis = (side == 0) ? axes[k] : -axes[k];
+              angle.mass = 1.0f / glm::dot(angle.axis,
+                                           (A.invInertiaW + B.invInertiaW)
+                                           * angle.axis);
+              angle.gap = glm::max(gap, 0.0f) / h;
+              angle.bias = (ragdollBeta / h) * glm::max(-gap, 0.0f);
+              angle.impulse = ragdoll.mAngleImpulses[angle.slot];
+              angle.fix = 0.0f;
+              angleRows.push_back(angle);
+            }
+        }
+    }
+
+  // ground contacts at the box corners
+  const glm::vec3 up = {0.0f, 1.0f, 0.0f};
+  const glm::vec3 tangents[2] = {{1.0f, 0.0f, 0.0f}, {0.0f, 0.0f, 1.0f}};
+  auto & contactRows = ragdoll.mContactRows;
+  contactRows.clear();
+  for (size_t i = 0; i < n; ++i)
+    {
+      const auto & b = bodies[i];
+      const auto & min = rig.askBoxMin(i);
+      const auto & max = rig.askBoxMax(i);
+      auto origin = ragdoll.jointOrigin(i);
+
+      for (int c = 0; c < 8; ++c)
+        {
+          glm::vec3 corner = {(c & 1) ? max.x : min.x,
+                              (c & 2) ? max.y : min.y,
+                              (c & 4) ? max.z : min.z};
+          auto p = origin + rotate(b.q, corner);
+          auto depth = mGround - p.y;
+          if (depth < -ragdollContactMargin) continue;
+
+          auto k = [&](const glm::vec3 & dir)
+            {
+              auto rxd = glm::cross(p - b.x, dir);
+              return 1.0f / (b.invMass
+                             + glm::dot(rxd, b.invInertiaW * rxd));
+            };
+
+          const auto & last = ragdoll.mContactImpulses[8 * i + (size_t) c];
+
+          Ragdoll::ContactRow row;
+          row.body = i;
+          row.slot = 8 * i + (size_t) c;
+          row.r = p - b.x;
+          row.normalMass = k(up);
+          row.tangentMass[0] = k(tangents[0]);
+          row.tangentMass[1] = k(tangents[1]);
+          row.bias = (ragdollBeta / h) * glm::max(depth - ragdollSlop, 0.0f);
+          row.impulse = last.x;
+          row.friction[0] = last.y;
+          row.friction[1] = last.z;
+          row.fix = 0.0f;
+          contactRows.push_back(row);
+        }
+    }
+
+  // warm start: last substep's impulses are most of this one's
+  for (const auto & row : angleRows)
+    {
+      bodies[row.a].w -= bodies[row.a].invInertiaW * row.axis * row.impulse;
+      bodies[row.b].w += bodies[row.b].invInertiaW * row.axis * row.impulse;
+    }
+  for (const auto & row : contactRows)
+    {
+      auto & b = bodies[row.body];
+      auto P = up * row.impulse
+        + tangents[0] * row.friction[0]
+        + tangents[1] * row.friction[1];
+      b.v += b.invMass * P;
+      b.w += b.invInertiaW * glm::cross(row.r, P);
+    }
+  for (const auto & row : jointRows)
+    {
+      auto & A = bodies[row.a];
+      auto & B = bodies[row.b];
+      A.v -= A.invMass * row.impulse;
+      A.w -= A.invInertiaW * glm::cross(row.rA, row.impulse);
+      B.v += B.invMass * row.impulse;
+      B.w += B.invInertiaW * glm::cross(row.rB, row.impulse);
+    }
+
+  for (size_t iter = 0; iter < mIterations; ++iter)
+    {
+      for (auto & row : contactRows)
+        {
+          auto & b = bodies[row.body];
+
+          auto speed = glm::dot(b.v + glm::cross(b.w, row.r), up);
+          auto old = row.impulse;
+          row.impulse = glm::max(old - row.normalMass * speed, 0.0f);
+          auto P = up * (row.impulse - old);
+          b.v += b.invMass * P;
+          b.w += b.invInertiaW * glm::cross(row.r, P);
+
+          auto limit = mFriction * row.impulse;
+          for (int t = 0; t < 2; ++t)
+            {
+              auto slide = glm::dot(b.v + glm::cross(b.w, row.r),
+                                    tangents[t]);
+              auto was = row.friction[t];
+              row.friction[t] = glm::clamp(was - row.tangentMass[t] * slide,
+                                           -limit, limit);
+              auto F = tangents[t] * (row.friction[t] - was);
+              b.v += b.invMass * F;
+              b.w += b.invInertiaW * glm::cross(row.r, F);
+            }
+        }
+
+      for (auto & row : angleRows)
+        {
+          auto & A = bodies[row.a];
+          auto & B = bodies[row.b];
+
+          auto speed = glm::dot(B.w - A.w, row.axis);
+          auto old = row.impulse;
+          row.impulse = glm::max(old - row.mass * (speed + row.gap), 0.0f);
+          auto lambda = row.impulse - old;
+
+          A.w -= A.invInertiaW * row.axis * lambda;
+          B.w += B.invInertiaW * row.axis * lambda;
+        }
+
+      // joints last, they matter most to how it looks. Sweeping leaves to
+      // root and back in turn carries impulses both ways along the tree
+      for (size_t j = 0; j < jointRows.size(); ++j)
+        {
+          auto & row = (iter & 1) ? jointRows[jointRows.size() - 1 - j]
+            : jointRows[j];
+          auto & A = bodies[row.a];
+          auto & B = bodies[row.b];
+
+          auto drift = (B.v + glm::cross(B.w, row.rB))
+            - (A.v + glm::cross(A.w, row.rA));
+          auto lambda = -(row.invK * drift);
+          row.impulse += lambda;
+
+          A.v -= A.invMass * lambda;
+          A.w -= A.invInertiaW * glm::cross(row.rA, lambda);
+          B.v += B.invMass * lambda;
+          B.w += B.invInertiaW * glm::cross(row.rB, lambda);
+        }
+    }
+
+  // drift is fixed apart, with velocities that move the bodies this substep
+  // and are then forgotten. Fed into the real velocities, the correction
+  // would keep resting bodies creeping, and they'd never sleep
+  for (auto & b : bodies)
+    {
+      b.vFix = glm::vec3();
+      b.wFix = glm::vec3();
+    }
+  for (size_t iter = 0; iter < mIterations; ++iter)
+    {
+      for (auto & row : contactRows)
+        {
+          auto & b = bodies[row.body];
+
+          auto speed = glm::dot(b.vFix + glm::cross(b.wFix, row.r), up);
+          auto old = row.fix;
+          row.fix = glm::max(old + row.normalMass * (row.bias - speed), 0.0f);
+          auto P = up * (row.fix - old);
+          b.vFix += b.invMass * P;
+          b.wFix += b.invInertiaW * glm::cross(row.r, P);
+        }
+
+      for (auto & row : angleRows)
+        {
+          auto & A = bodies[row.a];
+          auto & B = bodies[row.b];
+
+          auto speed = glm::dot(B.wFix - A.wFix, row.axis);
+          auto old = row.fix;
+          row.fix = glm::max(old + row.mass * (row.bias - speed), 0.0f);
+          auto lambda = row.fix - old;
+
+          A.wFix -= A.invInertiaW * row.axis * lambda;
+          B.wFix += B.invInertiaW * row.axis * lambda;
+        }
+
+      for (size_t j = 0; j < jointRows.size(); ++j)
+        {
+          const auto & row = (iter & 1) ? jointRows[jointRows.size() - 1 - j]
+            : jointRows[j];
+          auto & A = bodies[row.a];
+          auto & B = bodies[row.b];
+
+          auto drift = (B.vFix + glm::cross(B.wFix, row.rB))
+            - (A.vFix + glm::cross(A.wFix, row.rA));
+          auto lambda = row.invK * (row.bias - drift);
+
+          A.vFix -= A.invMass * lambda;
+          A.wFix -= A.invInertiaW * glm::cross(row.rA, lambda);
+          B.vFix += B.invMass * lambda;
+          B.wFix += B.invInertiaW * glm::cross(row.rB, lambda);
+        }
+    }
+
+  for (const auto & row : jointRows)
+    {
+      ragdoll.mJointImpulses[row.b] = row.impulse;
+    }
+  std::fill(ragdoll.mAngleImpulses.begin(), ragdoll.mAngleImpulses.end(),
+            0.0f);
+  for (const auto & row : angleRows)
+    {
+      ragdoll.mAngleImpulses[row.slot] = row.impulse;
+    }
+  std::fill(ragdoll.mContactImpulses.begin(), ragdoll.mContactImpulses.end(),
+            glm::vec3());
+  for (const auto & row : contactRows)
+    {
+      ragdoll.mContactImpulses[row.slot] = {row.impulse,
+                                            row.friction[0],
+                                            row.friction[1]};
+    }
+
+  float maxV = 0.0f;
+  float maxW = 0.0f;
+  for (auto & b : bodies)
+    {
+      b.x += (b.v + b.vFix) * h;
+
+      // q += h/2 * (0, w) * q, then back onto the unit sphere
+      auto w = b.w + b.wFix;
+      Quaternion dq;
+      dq.real = -0.5f * h * glm::dot(w, b.q.imaginary);
+      dq.imaginary = 0.5f * h * (b.q.real * w
+                                 + glm::cross(w, b.q.imaginary));
+      b.q = b.q + dq;
+
+      maxV = glm::max(maxV, glm::dot(b.v, b.v));
+      maxW = glm::max(maxW, glm::dot(b.w, b.w));
+    }
+
+  if (maxV < ragdollSleepLinear * ragdollSleepLinear
+      && maxW < ragdollSleepAngular * ragdollSleepAngular)
+    {
+      ragdoll.mStillTime += h;
+    }
+  else
+    {
+      ragdoll.mStillTime = 0.0f;
+    }
+
+  if (ragdoll.mStillTime > ragdollSleepTime)
+    {
+      ragdoll.mAsleep = true;
+      for (auto & b : bodies)
+        {
+          b.v = glm::vec3();
+          b.w = glm::vec3();
+        }
+    }
+
+  return contactRows.size();
+}
+
+// -----------------------------------------------------------------------------
+// Benchmark
+// -----------------------------------------------------------------------------
+
+dmp::RagdollTiming dmp::benchmarkRagdoll(std::shared_ptr<const Rig> rig,
+                                         size_t count,
+                                         float seconds,
+                                         size_t numWorkers)
+{
+  expect("at least one ragdoll", count > 0);
+  expect("at least two seconds", seconds >= 2.0f);
+
+  Pose rest;
+  rest.translation = glm::vec3(0.0f);
+  for (size_t i = 0; i < rig->askNumJoints(); ++i)
+    {
+      rest.rotations.push_back(rig->askRestRotation(i));
+    }
+
+  // a square grid above the ground, each tilted a golden ratio turn on
+  // from the one before so they land differently
+  auto side = (size_t) ceilf(sqrtf((float) count));
+  std::vector<Ragdoll> ragdolls;
+  ragdolls.reserve(count);
+  std::vector<Ragdoll *> batch;
+  for (size_t i = 0; i < count; ++i)
+    {
+      glm::vec3 pos = {ragdollBenchSpacing * (float) (i % side),
+                       ragdollBenchHeight,
+                       ragdollBenchSpacing * (float) (i / side)};
+      auto turn = glm::two_pi<float>() * fmodf((float) i * 0.618034f, 1.0f);
+      glm::vec3 axis = {cosf(turn), 0.0f, sinf(turn)};
+      auto M = glm::translate(glm::mat4(), pos)
+        * glm::rotate(glm::mat4(), 0.5f * sinf(3.0f * turn), axis);
+
+      ragdolls.emplace_back(rig);
+      ragdolls.back().tellPose(rest, M);
+      batch.push_back(&ragdolls.back());
+    }
+
+  RagdollSolver solver(ragdollBenchIterations, 0.0f);
+  JobSystem jobs(numWorkers);
+
+  auto deltaT = 1.0f / 60.0f;
+  auto frames = (size_t) (seconds * 60.0f);
+  size_t second = 60;
+
+  RagdollTiming timing;
+  timing.ragdolls = count;
+  timing.threads = jobs.askNumThreads();
+  for (size_t f = 0; f < frames; ++f)
+    {
+      auto stats = solver.step(batch, deltaT, jobs);
+      if (f < second)
+        {
+          timing.fallingMicroseconds += stats.microseconds;
+        }
+      if (f >= frames - second)
+        {
+          timing.settledMicroseconds += stats.microseconds;
+          timing.contacts += (float) stats.contacts;
+        }
+      timing.asleep = stats.asleep;
+    }
+
+  timing.fallingMicroseconds /= (float) second;
+  timing.settledMicroseconds /= (float) second;
+  timing.contacts /= (float) second;
+  return timing;
+}
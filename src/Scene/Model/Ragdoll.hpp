@@ -0,0 +1,214 @@
+#ifndef DMP_RAGDOLL_HPP
+#define DMP_RAGDOLL_HPP
+
+#include <vector>
+#include <memory>
+#include <glm/glm.hpp>
+#include "Rig.hpp"
+#include "Pose.hpp"
+#include "../../Quaternion.hpp"
+
+namespace dmp
+{
+  class JobSystem;
+
+  // One rigid body per joint of a Rig, shaped like the joint's bone box and
+  // held to its parent by a ball joint within the joint's rotation limits.
+  // Starts from an animated pose, and gives back poses that blend with
+  // animation. Bodies don't collide with each other, only with the ground
+  class Ragdoll
+  {
+  public:
+    Ragdoll() = delete;
+    Ragdoll(const Ragdoll &) = delete;
+    Ragdoll & operator=(const Ragdoll &) = delete;
+    Ragdoll(Ragdoll &&) = default;
+    Ragdoll & operator=(Ragdoll &&) = default;
+
+    // density is mass per unit volume of bone box
+    Ragdoll(std::shared_ptr<const Rig> rig, float density = 1.0f);
+
+    // Puts every body where p under M puts its joint, at rest. M must be
+    // rigid
+    void tellPose(const Pose & p, const glm::mat4 & M);
+
+    // The same, but moving as the character did going from previous to p
+    // in deltaT, so that it keeps its momentum as it goes limp
+    void tellPose(const Pose & p,
+                  const Pose & previous,
+                  const glm::mat4 & M,
+                  float deltaT);
+
+    // An impulse at a world point, on joint's body
+    void applyImpulse(size_t joint,
+                      const glm::vec3 & point,
+                      const glm::vec3 & impulse);
+
+    bool isAsleep() const {return mAsleep;}
+    void wake() {mAsleep = false; mStillTime = 0.0f;}
+
+    // The pose that puts each joint where its body is, under M
+    void askPose(const glm::mat4 & M, Pose & out) const;
+
+    // Each joint weight of the way from animated to the ragdoll: 0 is all
+    // animation, 1 all ragdoll
+    void blendPose(const Pose & animated,
+                   float weight,
+                   const glm::mat4 & M,
+                   Pose & out) const;
+
+    // World matrices of every joint, as Rig::computeMs gives them
+    void computeMs(std::vector<glm::mat4> & Ms) const;
+
+    const Rig & askRig() const {return *mRig;}
+  private:
+    friend class RagdollSolver;
+
+    struct Body
+    {
+      glm::vec3 x; // center of mass, world
+      Quaternion q; // the joint frame's rotation, world
+      glm::vec3 v;
+      glm::vec3 w;
+      glm::vec3 com; // center of mass in the joint frame
+      float invMass;
+      glm::vec3 invInertia; // about com, in the joint frame
+      glm::mat3 invInertiaW; // the same in world axes, as of this step
+      glm::vec3 vFix; // drift correction, this substep only
+      glm::vec3 wFix;
+    };
+
+    // solver rows, kept here so ragdolls step in parallel without
+    // allocating
+    struct JointRow
+    {
+      size_t a;
+      size_t b;
+      glm::vec3 rA;
+      glm::vec3 rB;
+      glm::mat3 invK;
+      glm::vec3 bias;
+      glm::vec3 impulse;
+    };
+    struct AngleRow
+    {
+      size_t a;
+      size_t b;
+      size_t slot; // into mAngleImpulses
+      glm::vec3 axis; // b turning along this, relative to a, moves away
+      float mass;
+      float gap; // speed allowed toward the limit
+      float bias; // speed that undoes going past it
+      float impulse;
+      float fix; // impulse on the drift correction
+    };
+    struct ContactRow
+    {
+      size_t body;
+      size_t slot; // into mContactImpulses
+      glm::vec3 r;
+      float normalMass;
+      float tangentMass[2];
+      float bias;
+      float impulse;
+      float fix;
+      float friction[2];
+    };
+
+    void initRagdoll(std::shared_ptr<const Rig> rig, float density);
+    void place(const Pose & p,
+               const glm::mat4 & M,
+               std::vector<glm::vec3> & xs,
+               std::vector<Quaternion> & qs) const;
+    glm::vec3 jointOrigin(size_t i) const
+    {
+      return mBodies[i].x - rotate(mBodies[i].q, mBodies[i].com);
+    }
+
+    std::shared_ptr<const Rig> mRig;
+    std::vector<Body> mBodies;
+    std::vector<glm::vec3> mEulers; // each joint's angles as of last step
+    std::vector<char> mLimited; // joints with any finite limit
+
+    bool mAsleep = false;
+    float mStillTime = 0.0f;
+
+    std::vector<JointRow> mJointRows;
+    std::vector<AngleRow> mAngleRows;
+    std::vector<ContactRow> mContactRows;
+
+    // last substep's impulses, to start the next one from. Joints by child
+    // joint, limits by joint, axis and end, contacts by body and box corner
+    // (normal, then the two frictions)
+    std::vector<glm::vec3> mJointImpulses;
+    std::vector<float> mAngleImpulses;
+    std::vector<glm::vec3> mContactImpulses;
+  };
+
+  struct RagdollStats
+  {
+    size_t ragdolls = 0;
+    size_t asleep = 0;
+    size_t contacts = 0;
+    float microseconds = 0.0f;
+  };
+
+  // Sequential impulse stepping for batches of ragdolls. Each ragdoll is
+  // its own island, so a batch spreads across a JobSystem one ragdoll per
+  // job. Ragdolls that stay still long enough sleep and cost nothing until
+  // woken
+  class RagdollSolver
+  {
+  public:
+    RagdollSolver() = delete;
+    RagdollSolver(const RagdollSolver &) = delete;
+    RagdollSolver & operator=(const RagdollSolver &) = delete;
+    RagdollSolver(RagdollSolver &&) = default;
+    RagdollSolver & operator=(RagdollSolver &&) = default;
+
+    // The ground is the plane y = groundHeight
+    RagdollSolver(size_t iterations, float groundHeight);
+
+    void tellGravity(const glm::vec3 & gravity) {mGravity = gravity;}
+    void tellGround(float height) {mGround = height;}
+    void tellFriction(float friction) {mFriction = friction;}
+
+    RagdollStats step(std::vector<Ragdoll *> & ragdolls,
+                      float deltaT,
+                      JobSystem & jobs) const;
+
+    // One ragdoll, on this thread. Returns the number of ground contacts
+    size_t stepOne(Ragdoll & ragdoll, float deltaT) const;
+  private:
+    void initRagdollSolver(size_t iterations, float groundHeight);
+    size_t substep(Ragdoll & ragdoll, float h) const;
+
+    size_t mIterations;
+    glm::vec3 mGravity = {0.0f, -9.8f, 0.0f};
+    float mGround;
+    float mFriction = 0.6f;
+  };
+
+  // Mean time per frame of stepping a pile of ragdolls, while they all
+  // fall and once most have settled
+  struct RagdollTiming
+  {
+    size_t ragdolls = 0;
+    size_t threads = 0;
+    float fallingMicroseconds = 0.0f; // the first second
+    float settledMicroseconds = 0.0f; // the last second
+    float contacts = 0.0f; // per frame, over the last second
+    size_t asleep = 0; // at the end
+  };
+
+  // Drops count ragdolls of rig, in its rest pose and tilted a different
+  // way each, onto the ground and steps them seconds seconds at 60 frames
+  // a second. numWorkers is as for JobSystem, 0 for one per hardware
+  // thread
+  RagdollTiming benchmarkRagdoll(std::shared_ptr<const Rig> rig,
+                                 size_t count,
+                                 float seconds,
+                                 size_t numWorkers = 0);
+}
+
+#endif
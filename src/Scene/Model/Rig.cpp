@@ -0,0 +1,326 @@
+#include "Rig.hpp"
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <functional>
+#include <algorithm>
+#include <boost/tokenizer.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+static void parseFloatTriple(boost::tokenizer<boost::char_separator<char>>::iterator & iter,
+                             boost::tokenizer<boost::char_separator<char>>::iterator & end,
+                             float & x, float & y, float & z,
+                             std::string prefix)
+{
+  ++iter;
+  x = stof(*iter);
+  ++iter;
+  y = stof(*iter);
+  ++iter;
+  z = stof(*iter);
+  ++iter;
+  expect("Parse error: garbage trailing " + prefix,
+         iter == end || (*iter)[0] == '#');
+}
+
+static void parseFloatMinMax(boost::tokenizer<boost::char_separator<char>>::iterator & iter,
+                             boost::tokenizer<boost::char_separator<char>>::iterator & end,
+                             float & min, float & max,
+                             std::string prefix)
+{
+  ++iter;
+  min = stof(*iter);
+  ++iter;
+  max = stof(*iter);
+  ++iter;
+  expect("Parse error: garbage trailing " + prefix,
+         iter == end || (*iter)[0] == '#');
+}
+
+static std::unique_ptr<dmp::Balljoint> parse(std::string currName,
+                                             std::string currCtor,
+                                             std::vector<std::string>::iterator & begin,
+                                             std::vector<std::string>::iterator & end)
+{
+  using namespace boost;
+
+  using namespace dmp;
+
+  auto retval = std::make_unique<Balljoint>();
+  retval->name = currName;
+
+  char_separator<char> sep(" \t\r\n");
+
+  if (currCtor == "balljoint")
+    {
+
+      while (begin != end)
+        {
+          tokenizer<char_separator<char>> tokens(*begin, sep);
+          ++begin;
+          auto iter = tokens.begin();
+          auto tend = tokens.end();
+
+          if (iter == tokens.end()) continue;
+          else if ((*iter)[0] == '#') continue;
+          else if (*iter == "}") break;
+          else if (*iter == "offset")
+            {
+              parseFloatTriple(iter, tend, retval->offsetx,
+                               retval->offsety, retval->offsetz, "offset");
+            }
+          else if (*iter == "boxmin")
+            {
+              parseFloatTriple(iter, tend, retval->boxminx,
+                               retval->boxminy, retval->boxminz, "boxmin");
+            }
+          else if (*iter == "boxmax")
+            {
+              parseFloatTriple(iter, tend, retval->boxmaxx,
+                               retval->boxmaxy, retval->boxmaxz, "boxmax");
+            }
+          else if (*iter == "rotxlimit")
+            {
+              parseFloatMinMax(iter, tend, retval->rotxmin,
+                               retval->rotxmax, "rotxlimit");
+            }
+          else if (*iter == "rotylimit")
+            {
+              parseFloatMinMax(iter, tend, retval->rotymin,
+                               retval->rotymax, "rotylimit");
+            }
+          else if (*iter == "rotzlimit")
+            {
+              parseFloatMinMax(iter, tend, retval->rotzmin,
+                               retval->rotzmax, "rotzlimit");
+            }
+          else if (*iter == "pose")
+            {
+              parseFloatTriple(iter, tend, retval->posex,
+                               retval->posey,
+                               retval->posez, "pose");
+
+              //retval->posex = 0.0f;
+              //retval->posey = 0.0f;
+              //retval->posez = 0.0f;
+            }
+          else if (*iter == "balljoint")
+            {
+
+              ++iter;
+              auto name = *iter;
+              ++iter;
+              retval->children.emplace_back(parse(name, "balljoint",
+                                                  begin, end));
+            }
+        }
+      return retval;
+    }
+  impossible("mismatched { braces } in skel file!");
+}
+
+// static void printSkel(dmp::Balljoint * bj, std::string padding)
+// {
+//   auto pad = padding + "  ";
+//   std::cerr << padding << "Balljoint " << bj->name << " {" << std::endl;
+//   std::cerr << pad << "offset = " << bj->offsetx
+//             << " " << bj->offsety << " " << bj->offsetz << std::endl;
+//   std::cerr << pad << "boxmin = " << bj->boxminx
+//             << " " << bj->boxminy << " " << bj->boxminz << std::endl;
+//   std::cerr << pad << "boxmax = " << bj->boxmaxx
+//             << " " << bj->boxmaxy << " " << bj->boxmaxz << std::endl;
+//   std::cerr << pad << "pose = " << bj->posex
+//             << " " << bj->posey << " " << bj->posez << std::endl;
+//   std::cerr << pad << "rotmin = " << bj->rotxmin
+//             << " " << bj->rotymin << " " << bj->rotzmin << std::endl;
+//   std::cerr << pad << "rotmax = " << bj->rotxmax
+//             << " " << bj->rotymax << " " << bj->rotzmax << std::endl;
+//   for (auto & curr : bj->children)
+//     {
+//       printSkel(curr.get(), pad);
+//     }
+//   std::cerr << padding << "}" << std::endl;
+// }
+
+dmp::Rig::Rig(const std::string & skelPath)
+{
+  initRig(skelPath);
+}
+
+void dmp::Rig::initRig(const std::string & skelPath)
+{
+  using namespace std;
+  using namespace boost;
+
+  ifstream file(skelPath, ios::in);
+  string line;
+  std::vector<std::string> lines;
+
+  expect("opened skelPath", file.is_open());
+
+  while (getline(file, line))
+    {
+      lines.push_back(line);
+    }
+
+  file.close();
+
+  expect("skel file not empty", !lines.empty());
+  auto iter = lines.begin();
+
+  line = *iter;
+  ++iter;
+
+  char_separator<char> sep(" \t\r\n");
+  tokenizer<char_separator<char>> tokens(line, sep);
+  auto tokIter = tokens.begin();
+
+  std::unique_ptr<Balljoint> ast;
+  if (tokIter != tokens.end() && *tokIter == "balljoint")
+    {
+      ++tokIter;
+      auto lend = lines.end();
+      auto name = *tokIter;
+      ast = parse(name, "balljoint",
+                  iter, lend);
+    }
+  else
+    {
+      impossible("parse error: invalid root");
+    }
+
+  // the tree is only needed to get here
+  std::function<void(const Balljoint *, int)> flatten
+    = [&](const Balljoint * bj, int parent)
+    {
+      auto idx = (int) mParents.size();
+      mNames.push_back(bj->name);
+      mParents.push_back(parent);
+      mOffsets.push_back({bj->offsetx, bj->offsety, bj->offsetz});
+      mRotMins.push_back({bj->rotxmin, bj->rotymin, bj->rotzmin});
+      mRotMaxs.push_back({bj->rotxmax, bj->rotymax, bj->rotzmax});
+      mBoxMins.push_back({bj->boxminx, bj->boxminy, bj->boxminz});
+      mBoxMaxs.push_back({bj->boxmaxx, bj->boxmaxy, bj->boxmaxz});
+      mRestRotations.push_back({bj->posex, bj->posey, bj->posez});
+      for (const auto & curr : bj->children)
+        {
+          flatten(curr.get(), idx);
+        }
+    };
+  flatten(ast.get(), -1);
+}
+
+std::shared_ptr<const dmp::Rig> dmp::Rig::load(const std::string & skelPath)
+{
+  // weak, so a rig goes away with its last user
+  static std::mutex cacheMutex;
+  static std::map<std::string, std::weak_ptr<const Rig>> cache;
+
+  std::lock_guard<std::mutex> lock(cacheMutex);
+  auto found = cache[skelPath].lock();
+  if (found) return found;
+
+  auto rig = std::make_shared<const Rig>(skelPath);
+  cache[skelPath] = rig;
+  return rig;
+}
+
+int dmp::Rig::findJoint(const std::string & name) const
+{
+  auto found = std::find(mNames.begin(), mNames.end(), name);
+  if (found == mNames.end()) return -1;
+  return (int) (found - mNames.begin());
+}
+
+void dmp::Rig::computeMs(const Pose & p,
+                         const glm::mat4 & M,
+                         std::vector<glm::mat4> & Ms) const
+{
+  expect("pose covers every joint", p.rotations.size() >= mParents.size());
+
+  Ms.resize(mParents.size());
+  auto root = M * glm::translate(glm::mat4(), p.translation);
+
+  // depth first order puts every parent before its children
+  for (size_t i = 0; i < mParents.size(); ++i)
+    {
+      const auto & parentM = (mParents[i] < 0) ? root
+        : Ms[(size_t) mParents[i]];
+      Ms[i] = parentM * localTransform(i, p.rotations[i]);
+    }
+}
+
+void dmp::Rig::toJointPose(const Pose & p, JointPose & out) const
+{
+  expect("pose covers every joint", p.rotations.size() >= mParents.size());
+
+  out.translation = p.translation;
+  out.rotations.resize(mParents.size());
+  for (size_t i = 0; i < mParents.size(); ++i)
+    {
+      out.rotations[i] = jointRotation(i, p.rotations[i]);
+    }
+}
+
+void dmp::Rig::computeMs(const JointPose & p,
+                         const glm::mat4 & M,
+                         std::vector<glm::mat4> & Ms) const
+{
+  expect("pose covers every joint", p.rotations.size() >= mParents.size());
+
+  Ms.resize(mParents.size());
+  auto root = M * glm::translate(glm::mat4(), p.translation);
+
+  for (size_t i = 0; i < mParents.size(); ++i)
+    {
+      const auto & parentM = (mParents[i] < 0) ? root
+        : Ms[(size_t) mParents[i]];
+      Ms[i] = parentM * rigidTransform(p.rotations[i], mOffsets[i]);
+    }
+}
+
+std::unique_ptr<dmp::Balljoint> dmp::Rig::makeAST() const
+{
+  std::unique_ptr<Balljoint> root;
+  std::vector<Balljoint *> nodes(mParents.size());
+
+  // parents come first, and children were flattened in file order, so
+  // appending in index order rebuilds the same tree
+  for (size_t i = 0; i < mParents.size(); ++i)
+    {
+      auto bj = std::make_unique<Balljoint>();
+      bj->name = mNames[i];
+      bj->offsetx = mOffsets[i].x;
+      bj->offsety = mOffsets[i].y;
+      bj->offsetz = mOffsets[i].z;
+      bj->boxminx = mBoxMins[i].x;
+      bj->boxminy = mBoxMins[i].y;
+      bj->boxminz = mBoxMins[i].z;
+      bj->boxmaxx = mBoxMaxs[i].x;
+      bj->boxmaxy = mBoxMaxs[i].y;
+      bj->boxmaxz = mBoxMaxs[i].z;
+      bj->rotxmin = mRotMins[i].x;
+      bj->rotymin = mRotMins[i].y;
+      bj->rotzmin = mRotMins[i].z;
+      bj->rotxmax = mRotMaxs[i].x;
+      bj->rotymax = mRotMaxs[i].y;
+      bj->rotzmax = mRotMaxs[i].z;
+      bj->posex = mRestRotations[i].x;
+      bj->posey = mRestRotations[i].y;
+      bj->posez = mRestRotations[i].z;
+      bj->rotateDirty = false;
+      nodes[i] = bj.get();
+
+      if (mParents[i] < 0)
+        {
+          expect("one root", !root);
+          root = std::move(bj);
+        }
+      else
+        {
+          nodes[(size_t) mParents[i]]->children.push_back(std::move(bj));
+        }
+    }
+
+  return root;
+}
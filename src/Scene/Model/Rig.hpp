@@ -0,0 +1,164 @@
+#ifndef DMP_RIG_HPP
+#define DMP_RIG_HPP
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <limits>
+#include <glm/glm.hpp>
+#include "Pose.hpp"
+#include "../../Quaternion.hpp"
+#include "../../util.hpp"
+
+namespace dmp
+{
+  struct Balljoint
+  {
+    std::string name;
+
+    float offsetx = 0.0f;
+    float offsety = 0.0f;
+    float offsetz = 0.0f;
+    float boxminx = -0.1f;
+    float boxminy = -0.1f;
+    float boxminz = -0.1f;
+    float boxmaxx = 0.1f;
+    float boxmaxy = 0.1f;
+    float boxmaxz = 0.1f;
+    float rotxmin = -std::numeric_limits<float>::infinity();
+    float rotymin = -std::numeric_limits<float>::infinity();
+    float rotzmin = -std::numeric_limits<float>::infinity();
+    float rotxmax = std::numeric_limits<float>::infinity();
+    float rotymax = std::numeric_limits<float>::infinity();
+    float rotzmax = std::numeric_limits<float>::infinity();
+    float posex = 0.0f;
+    float posey = 0.0f;
+    float posez = 0.0f;
+
+    std::vector<std::unique_ptr<Balljoint>> children;
+
+    bool rotateDirty = true;
+  };
+
+  // Everything in a .skel file that no pose changes: the hierarchy,
+  // offsets, limits and boxes. Joints are flattened depth first, so every
+  // parent comes before its children, in the same order as a Pose. Built
+  // once per file and shared, read only, by everything posing it
+  class Rig
+  {
+  public:
+    Rig() = delete;
+    Rig(const Rig &) = delete;
+    Rig & operator=(const Rig &) = delete;
+    Rig(Rig &&) = default;
+    Rig & operator=(Rig &&) = default;
+
+    // Parses skelPath. Prefer load, which parses each file once
+    Rig(const std::string & skelPath);
+
+    // The rig for skelPath, shared with every other user of that file
+    // still holding it. Safe from any thread
+    static std::shared_ptr<const Rig> load(const std::string & skelPath);
+
+    size_t askNumJoints() const {return mParents.size();}
+    const std::string & askName(size_t i) const
+    {
+      expect("joint in range", i < mNames.size());
+      return mNames[i];
+    }
+    int askParent(size_t i) const
+    {
+      expect("joint in range", i < mParents.size());
+      return mParents[i];
+    }
+    const glm::vec3 & askOffset(size_t i) const
+    {
+      expect("joint in range", i < mOffsets.size());
+      return mOffsets[i];
+    }
+    const glm::vec3 & askBoxMin(size_t i) const
+    {
+      expect("joint in range", i < mBoxMins.size());
+      return mBoxMins[i];
+    }
+    const glm::vec3 & askBoxMax(size_t i) const
+    {
+      expect("joint in range", i < mBoxMaxs.size());
+      return mBoxMaxs[i];
+    }
+
+    // The pose given in the file
+    const glm::vec3 & askRestRotation(size_t i) const
+    {
+      expect("joint in range", i < mRestRotations.size());
+      return mRestRotations[i];
+    }
+
+    // Rotation limits; infinite where the file gives none
+    const glm::vec3 & askRotMin(size_t i) const
+    {
+      expect("joint in range", i < mRotMins.size());
+      return mRotMins[i];
+    }
+    const glm::vec3 & askRotMax(size_t i) const
+    {
+      expect("joint in range", i < mRotMaxs.size());
+      return mRotMaxs[i];
+    }
+
+    // The index of the joint called name, or -1
+    int findJoint(const std::string & name) const;
+
+    // Euler angles rot, within joint i's limits
+    glm::vec3 clampRotation(size_t i, const glm::vec3 & rot) const
+    {
+      expect("joint in range", i < mRotMins.size());
+      return glm::clamp(rot, mRotMins[i], mRotMaxs[i]);
+    }
+
+    // Joint i's rotation for Euler angles rot, within its limits
+    Quaternion jointRotation(size_t i, const glm::vec3 & rot) const
+    {
+      return eulerZYX(clampRotation(i, rot));
+    }
+
+    // Joint i's transform into its parent's frame for Euler angles rot
+    glm::mat4 localTransform(size_t i, const glm::vec3 & rot) const
+    {
+      return rigidTransform(jointRotation(i, rot), mOffsets[i]);
+    }
+
+    // Forward kinematics for p under M: one world matrix per joint in Ms.
+    // The root translation of p is applied
+    void computeMs(const Pose & p,
+                   const glm::mat4 & M,
+                   std::vector<glm::mat4> & Ms) const;
+
+    // p with every joint's rotation as jointRotation gives it. out keeps
+    // its storage
+    void toJointPose(const Pose & p, JointPose & out) const;
+
+    // Forward kinematics for a JointPose, as computeMs for the Pose it came
+    // from
+    void computeMs(const JointPose & p,
+                   const glm::mat4 & M,
+                   std::vector<glm::mat4> & Ms) const;
+
+    // A new, editable joint tree with the file's values, for things like
+    // the dof window that work on Balljoints
+    std::unique_ptr<Balljoint> makeAST() const;
+  private:
+    void initRig(const std::string & skelPath);
+
+    std::vector<std::string> mNames;
+    std::vector<int> mParents; // -1 for the root
+    std::vector<glm::vec3> mOffsets;
+    std::vector<glm::vec3> mRotMins;
+    std::vector<glm::vec3> mRotMaxs;
+    std::vector<glm::vec3> mBoxMins;
+    std::vector<glm::vec3> mBoxMaxs;
+    std::vector<glm::vec3> mRestRotations;
+  };
+}
+
+#endif
@@ -0,0 +1,390 @@
+#include "Simplify.hpp"
+#include <algorithm>
+#include <cstring>
+#include <unordered_map>
+#include "Skin.hpp"
+#include "MeshOptimize.hpp"
+
+// a collapse between weights further apart than this, summed over the
+// bones, would tear the skin as it bends
+static const float simplifyMaxWeightDelta = 0.5f;
+
+// how far a collapse between weights a whole weight apart counts as
+// moving the surface, as a fraction of the mesh's size
+static const float simplifyWeightError = 0.05f;
+
+// a collapse may turn a triangle no further than this cosine
+static const float simplifyMinFlipCos = 0.2f;
+
+// -----------------------------------------------------------------------------
+// Quadrics
+// -----------------------------------------------------------------------------
+
+namespace
+{
+  // The sum of squared distances to planes, each weighted by the area of
+  // the triangle it came from, as the upper half of a symmetric 4x4
+  struct Quadric
+  {
+    double a2 = 0, ab = 0, ac = 0, ad = 0;
+    double b2 = 0, bc = 0, bd = 0;
+    double c2 = 0, cd = 0;
+    double d2 = 0;
+    double area = 0;
+
+    void addPlane(const glm::vec3 & n, float d, float w)
+    {
+      a2 += w * n.x * n.x; ab += w * n.x * n.y; ac += w * n.x * n.z;
+      ad += w * n.x * d;
+      b2 += w * n.y * n.y; bc += w * n.y * n.z; bd += w * n.y * d;
+      c2 += w * n.z * n.z; cd += w * n.z * d;
+      d2 += w * d * d;
+      area += w;
+    }
+
+    Quadric & operator+=(const Quadric & q)
+    {
+      a2 += q.a2; ab += q.ab; ac += q.ac; ad += q.ad;
+      b2 += q.b2; bc += q.bc; bd += q.bd;
+      c2 += q.c2; cd += q.cd;
+      d2 += q.d2;
+      area += q.area;
+      return *this;
+    }
+
+    // squared distance to the planes at p, summed by area
+    double at(const glm::vec3 & p) const
+    {
+      double x = p.x;
+      double y = p.y;
+      double z = p.z;
+      return x * x * a2 + y * y * b2 + z * z * c2
+        + 2.0 * (x * y * ab + x * z * ac + y * z * bc)
+        + 2.0 * (x * ad + y * bd + z * cd) + d2;
+    }
+  };
+
+  struct PositionHash
+  {
+    size_t operator()(const glm::vec3 & p) const
+    {
+      uint32_t bits[3];
+      std::memcpy(bits, &p[0], sizeof(float));
+      std::memcpy(bits + 1, &p[1], sizeof(float));
+      std::memcpy(bits + 2, &p[2], sizeof(float));
+      return (bits[0] * 73856093u) ^ (bits[1] * 19349663u)
+        ^ (bits[2] * 83492791u);
+    }
+  };
+
+  struct Collapse
+  {
+    double cost;
+    size_t from;
+    size_t to;
+  };
+}
+
+static bool sameWeights(const dmp::SkinWeight & a, const dmp::SkinWeight & b)
+{
+  return a.count == b.count
+    && std::equal(a.index, a.index + a.count, b.index)
+    && std::equal(a.weight, a.weight + a.count, b.weight);
+}
+
+// Summed over every bone either binds, from 0 to 2
+static float weightDelta(const dmp::SkinWeight & a, const dmp::SkinWeight & b)
+{
+  float delta = 0.0f;
+  for (size_t k = 0; k < a.count; ++k)
+    {
+      auto other = 0.0f;
+      for (size_t j = 0; j < b.count; ++j)
+        {
+          if (b.index[j] == a.index[k]) other = b.askWeight(j);
+        }
+      delta += fabsf(a.askWeight(k) - other);
+    }
+  for (size_t j = 0; j < b.count; ++j)
+    {
+      auto bound = std::find(a.index, a.index + a.count, b.index[j]);
+      if (bound == a.index + a.count) delta += b.askWeight(j);
+    }
+  return delta;
+}
+
+// -----------------------------------------------------------------------------
+// Simplification
+// -----------------------------------------------------------------------------
+
+std::vector<size_t> dmp::simplifyMesh(const SimplifyMesh & mesh,
+                                      const std::vector<size_t> & idxs,
+                                      size_t targetTris,
+                                      float maxError)
+{
+  expect("whole triangles", idxs.size() % 3 == 0);
+  expect("positions given", mesh.positions || mesh.numVerts == 0);
+  auto n = mesh.numVerts;
+  const auto * pos = mesh.positions;
+  if (idxs.size() / 3 <= targetTris) return idxs;
+
+  // vertices at one position are one point of the surface: a class. Its
+  // first vertex stands for it
+  std::unordered_map<glm::vec3, size_t, PositionHash> classAt;
+  std::vector<size_t> cls(n);
+  std::vector<size_t> rep;
+  for (size_t v = 0; v < n; ++v)
+    {
+      auto found = classAt.emplace(pos[v], rep.size());
+      if (found.second) rep.push_back(v);
+      cls[v] = found.first->second;
+    }
+  auto numClasses = rep.size();
+
+  std::vector<std::vector<size_t>> members(numClasses);
+  for (size_t v = 0; v < n; ++v)
+    {
+      members[cls[v]].push_back(v);
+    }
+
+  // copies that differ in anything make a seam; seams stay put
+  auto sameAttributes = [&mesh](size_t a, size_t b)
+    {
+      if (mesh.normals && mesh.normals[a] != mesh.normals[b]) return false;
+      if (mesh.texCoords && mesh.texCoords[a] != mesh.texCoords[b])
+        {
+          return false;
+        }
+      if (mesh.weights && !sameWeights(mesh.weights[a], mesh.weights[b]))
+        {
+          return false;
+        }
+      return true;
+    };
+  std::vector<char> locked(numClasses, 0);
+  for (size_t v = 0; v < n; ++v)
+    {
+      auto c = cls[v];
+      if ((mesh.locked && mesh.locked[v]) || !sameAttributes(v, rep[c]))
+        {
+          locked[c] = 1;
+        }
+    }
+
+  // borders and non-manifold edges stay too, so no holes open
+  std::vector<std::pair<size_t, size_t>> edges;
+  for (size_t t = 0; t < idxs.size(); t += 3)
+    {
+      for (size_t k = 0; k < 3; ++k)
+        {
+          expect("index in range", idxs[t + k] < n);
+          auto a = cls[idxs[t + k]];
+          auto b = cls[idxs[t + (k + 1) % 3]];
+          if (a != b) edges.emplace_back(std::min(a, b), std::max(a, b));
+        }
+    }
+  std::sort(edges.begin(), edges.end());
+  for (size_t i = 0; i < edges.size();)
+    {
+      auto j = i;
+      while (j < edges.size() && edges[j] == edges[i]) ++j;
+      if (j - i != 2)
+        {
+          locked[edges[i].first] = 1;
+          locked[edges[i].second] = 1;
+        }
+      i = j;
+    }
+
+  // every class's quadric, from the planes of the triangles around it
+  std::vector<Quadric> quadrics(numClasses);
+  glm::vec3 lo = pos[idxs[0]];
+  glm::vec3 hi = lo;
+  for (size_t t = 0; t < idxs.size(); t += 3)
+    {
+      const auto & p0 = pos[idxs[t]];
+      const auto & p1 = pos[idxs[t + 1]];
+      const auto & p2 = pos[idxs[t + 2]];
+      auto normal = glm::cross(p1 - p0, p2 - p0);
+      auto length = glm::length(normal);
+      for (size_t k = 0; k < 3; ++k)
+        {
+          lo = glm::min(lo, pos[idxs[t + k]]);
+          hi = glm::max(hi, pos[idxs[t + k]]);
+        }
+      if (length == 0.0f) continue;
+
+      normal /= length;
+      auto d = -glm::dot(normal, p0);
+      for (size_t k = 0; k < 3; ++k)
+        {
+          quadrics[cls[idxs[t + k]]].addPlane(normal, d, 0.5f * length);
+        }
+    }
+  auto size = glm::length(hi - lo);
+  auto maxCost = (double) (maxError * size) * (double) (maxError * size);
+  auto weightCost = simplifyWeightError * size;
+
+  // the vertex of to that a vertex of from becomes: the copy whose normal
+  // and texcoords are nearest, when to is a seam
+  auto target = [&](size_t from, size_t to)
+    {
+      auto u = rep[from];
+      auto best = rep[to];
+      auto bestDist = -1.0f;
+      for (auto v : members[to])
+        {
+          auto dist = 0.0f;
+          if (mesh.normals)
+            {
+              auto dn = mesh.normals[u] - mesh.normals[v];
+              dist += glm::dot(dn, dn);
+            }
+          if (mesh.texCoords)
+            {
+              auto dt = mesh.texCoords[u] - mesh.texCoords[v];
+              dist += glm::dot(dt, dt);
+            }
+          if (bestDist < 0.0f || dist < bestDist)
+            {
+              best = v;
+              bestDist = dist;
+            }
+        }
+      return best;
+    };
+
+  // in passes: rank every collapse, then make the cheapest that don't
+  // touch anything a collapse this pass already changed
+  auto tris = idxs;
+  auto numTris = tris.size() / 3;
+  std::vector<std::vector<size_t>> around(numClasses);
+  std::vector<Collapse> collapses;
+  std::vector<char> touched(numClasses);
+  while (numTris > targetTris)
+    {
+      for (auto & curr : around) curr.clear();
+      edges.clear();
+      for (size_t t = 0; t < tris.size(); t += 3)
+        {
+          for (size_t k = 0; k < 3; ++k)
+            {
+              auto a = cls[tris[t + k]];
+              auto b = cls[tris[t + (k + 1) % 3]];
+              around[a].push_back(t);
+              if (a < b) edges.emplace_back(a, b);
+              else edges.emplace_back(b, a);
+            }
+        }
+      std::sort(edges.begin(), edges.end());
+      edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+
+      collapses.clear();
+      for (const auto & e : edges)
+        {
+          for (size_t dir = 0; dir < 2; ++dir)
+            {
+              auto from = dir ? e.second : e.first;
+              auto to = dir ? e.first : e.second;
+              if (locked[from]) continue;
+
+              auto q = quadrics[from];
+              q += quadrics[to];
+              auto cost = (q.area > 0.0) ? q.at(pos[rep[to]]) / q.area : 0.0;
+              if (mesh.weights)
+                {
+                  auto delta = weightDelta(mesh.weights[rep[from]],
+                                           mesh.weights[rep[to]]);
+                  if (delta > simplifyMaxWeightDelta) continue;
+                  cost += (double) (delta * weightCost)
+                    * (double) (delta * weightCost);
+                }
+              if (cost <= maxCost) collapses.push_back({cost, from, to});
+            }
+        }
+      std::sort(collapses.begin(), collapses.end(),
+                [](const Collapse & lhs, const Collapse & rhs)
+                {
+                  return lhs.cost < rhs.cost;
+                });
+
+      std::fill(touched.begin(), touched.end(), 0);
+      size_t made = 0;
+      for (const auto & c : collapses)
+        {
+          if (numTris <= targetTris) break;
+          if (touched[c.from] || touched[c.to]) continue;
+
+          // no triangle that survives may turn over
+          const auto & p = pos[rep[c.to]];
+          auto flips = false;
+          size_t lost = 0;
+          for (auto t : around[c.from])
+            {
+              glm::vec3 before[3];
+              glm::vec3 after[3];
+              auto hasTo = false;
+              for (size_t k = 0; k < 3; ++k)
+                {
+                  auto v = tris[t + k];
+                  before[k] = pos[v];
+                  after[k] = (cls[v] == c.from) ? p : pos[v];
+                  if (cls[v] == c.to) hasTo = true;
+                }
+              if (hasTo)
+                {
+                  ++lost;
+                  continue;
+                }
+              auto n0 = glm::cross(before[1] - before[0],
+                                   before[2] - before[0]);
+              auto n1 = glm::cross(after[1] - after[0],
+                                   after[2] - after[0]);
+              if (glm::dot(n0, n1)
+                  <= simplifyMinFlipCos * glm::length(n0) * glm::length(n1))
+                {
+                  flips = true;
+                  break;
+                }
+            }
+          if (flips) continue;
+
+          auto v = target(c.from, c.to);
+          for (auto t : around[c.from])
+            {
+              for (size_t k = 0; k < 3; ++k)
+                {
+                  if (cls[tris[t + k]] != c.from) continue;
+                  tris[t + k] = v;
+                }
+              for (size_t k = 0; k < 3; ++k)
+                {
+                  touched[cls[tris[t + k]]] = 1;
+                }
+            }
+          quadrics[c.to] += quadrics[c.from];
+          touched[c.from] = 1;
+          touched[c.to] = 1;
+          numTris -= lost;
+          ++made;
+        }
+      if (made == 0) break;
+
+      // drop the triangles the collapses flattened
+      size_t kept = 0;
+      for (size_t t = 0; t < tris.size(); t += 3)
+        {
+          auto a = cls[tris[t]];
+          auto b = cls[tris[t + 1]];
+          auto c = cls[tris[t + 2]];
+          if (a == b || b == c || c == a) continue;
+          for (size_t k = 0; k < 3; ++k) tris[kept + k] = tris[t + k];
+          kept += 3;
+        }
+      tris.resize(kept);
+      numTris = kept / 3;
+    }
+
+  optimizeVertexCache(tris, n);
+  return tris;
+}
@@ -0,0 +1,41 @@
+#ifndef DMP_SIMPLIFY_HPP
+#define DMP_SIMPLIFY_HPP
+
+#include <vector>
+#include <glm/glm.hpp>
+#include "../../util.hpp"
+
+namespace dmp
+{
+  struct SkinWeight;
+
+  // A mesh as simplifyMesh sees it. Only positions are needed; whatever
+  // else is given, vertices that differ in it are kept apart
+  struct SimplifyMesh
+  {
+    size_t numVerts = 0;
+    const glm::vec3 * positions = nullptr;
+    const glm::vec3 * normals = nullptr;
+    const glm::vec2 * texCoords = nullptr;
+    const SkinWeight * weights = nullptr;
+    const char * locked = nullptr; // never collapsed, e.g. morphed
+  };
+
+  // Collapses edges of idxs, cheapest quadric error first, until at most
+  // targetTris triangles are left or the next collapse would move the
+  // surface by more than maxError times the mesh's size. Vertices only
+  // ever collapse onto a neighbour, so the result indexes the same
+  // vertices and every attribute stays as it was.
+  //
+  // Vertices at the same position are one vertex of the surface. Those
+  // whose copies differ in normal, texcoords or weights sit on a seam, and
+  // stay put, as do locked vertices and the mesh's borders. A collapse
+  // between vertices whose weights differ costs more, and one between
+  // very different weights is never made
+  std::vector<size_t> simplifyMesh(const SimplifyMesh & mesh,
+                                   const std::vector<size_t> & idxs,
+                                   size_t targetTris,
+                                   float maxError);
+}
+
+#endif
@@ -1,290 +1,125 @@
 #include "Skeleton.hpp"
-#include <iostream>
-#include <fstream>
-#include <boost/tokenizer.hpp>
-#include <limits>
 #include <functional>
 #include "../../util.hpp"
 #include "../Graph.hpp"
-#include <glm/gtx/transform.hpp>
 
-static void parseFloatTriple(boost::tokenizer<boost::char_separator<char>>::iterator & iter,
-                             boost::tokenizer<boost::char_separator<char>>::iterator & end,
-                             float & x, float & y, float & z,
-                             std::string prefix)
+dmp::SkeletonInstance::SkeletonInstance(std::shared_ptr<const Rig> rig)
 {
-  ++iter;
-  x = stof(*iter);
-  ++iter;
-  y = stof(*iter);
-  ++iter;
-  z = stof(*iter);
-  ++iter;
-  expect("Parse error: garbage trailing " + prefix,
-         iter == end || (*iter)[0] == '#');
+  initSkeletonInstance(std::move(rig));
 }
 
-static void parseFloatMinMax(boost::tokenizer<boost::char_separator<char>>::iterator & iter,
-                             boost::tokenizer<boost::char_separator<char>>::iterator & end,
-                             float & min, float & max,
-                             std::string prefix)
+void dmp::SkeletonInstance::initSkeletonInstance(std::shared_ptr<const Rig> rig)
 {
-  ++iter;
-  min = stof(*iter);
-  ++iter;
-  max = stof(*iter);
-  ++iter;
-  expect("Parse error: garbage trailing " + prefix,
-         iter == end || (*iter)[0] == '#');
-}
+  expect("rig not null", rig);
+  mRig = std::move(rig);
 
-std::function<bool(glm::mat4 &, float)> dmp::Skeleton::makeXformFn(dmp::Balljoint * bj,
-                                                                   bool * dirty)
-{
-  expect("balljoint pointer not null", bj);
-  expect("dirty point not null", dirty);
-  return [=](glm::mat4 & M, float deltaT)
+  auto numJoints = mRig->askNumJoints();
+  mEulers.resize(numJoints);
+  for (size_t i = 0; i < numJoints; ++i)
     {
-      if (!bj->rotateDirty) return false;
-
-      float x = glm::clamp(bj->posex, bj->rotxmin, bj->rotxmax);
-      float y = glm::clamp(bj->posey, bj->rotymin, bj->rotymax);
-      float z = glm::clamp(bj->posez, bj->rotzmin, bj->rotzmax);
-
-      //ifDebug(std::cerr << "pose <x, y, z> = <" << x << ", " << y << ", " << z << ">" << std::endl);
-      auto rotx = glm::rotate(glm::mat4(),
-                              x,
-                              glm::vec3(1.0f, 0.0f, 0.0f));
-      auto roty = glm::rotate(glm::mat4(),
-                              y,
-                              glm::vec3(0.0f, 1.0f, 0.0f));
-      auto rotz = glm::rotate(glm::mat4(),
-                              z,
-                              glm::vec3(0.0f, 0.0f, 1.0f));
-      M = rotz * roty * rotx;
-      bj->rotateDirty = false;
-      (*dirty) = true;
-      return true;
-    };
+      mEulers[i] = mRig->askRestRotation(i);
+    }
+  mLocals.resize(numJoints);
+  mLocalDirty.assign(numJoints, true);
+  mWorldDirty.assign(numJoints, true);
+  mMs.resize(numJoints);
 }
 
-std::unique_ptr<dmp::Balljoint> dmp::Skeleton::parse(std::string currName,
-                                                     std::string currCtor,
-                                                     std::vector<std::string>::iterator & begin,
-                                                     std::vector<std::string>::iterator & end)
+void dmp::SkeletonInstance::applyPose(const Pose & p)
 {
-  using namespace boost;
+  expect("pose covers every joint", p.rotations.size() >= mEulers.size());
 
-  auto retval = std::make_unique<Balljoint>();
-  retval->name = currName;
-
-  char_separator<char> sep(" \t\r\n");
-
-  if (currCtor == "balljoint")
+  for (size_t i = 0; i < mEulers.size(); ++i)
     {
+      // compared against what was last applied, so slow drift still lands
+      if (roughEq(p.rotations[i].x, mEulers[i].x)
+          && roughEq(p.rotations[i].y, mEulers[i].y)
+          && roughEq(p.rotations[i].z, mEulers[i].z)) continue;
 
-      while (begin != end)
-        {
-          tokenizer<char_separator<char>> tokens(*begin, sep);
-          ++begin;
-          auto iter = tokens.begin();
-          auto tend = tokens.end();
-
-          if (iter == tokens.end()) continue;
-          else if ((*iter)[0] == '#') continue;
-          else if (*iter == "}") break;
-          else if (*iter == "offset")
-            {
-              parseFloatTriple(iter, tend, retval->offsetx,
-                               retval->offsety, retval->offsetz, "offset");
-            }
-          else if (*iter == "boxmin")
-            {
-              parseFloatTriple(iter, tend, retval->boxminx,
-                               retval->boxminy, retval->boxminz, "boxmin");
-            }
-          else if (*iter == "boxmax")
-            {
-              parseFloatTriple(iter, tend, retval->boxmaxx,
-                               retval->boxmaxy, retval->boxmaxz, "boxmax");
-            }
-          else if (*iter == "rotxlimit")
-            {
-              parseFloatMinMax(iter, tend, retval->rotxmin,
-                               retval->rotxmax, "rotxlimit");
-            }
-          else if (*iter == "rotylimit")
-            {
-              parseFloatMinMax(iter, tend, retval->rotymin,
-                               retval->rotymax, "rotylimit");
-            }
-          else if (*iter == "rotzlimit")
-            {
-              parseFloatMinMax(iter, tend, retval->rotzmin,
-                               retval->rotzmax, "rotzlimit");
-            }
-          else if (*iter == "pose")
-            {
-              parseFloatTriple(iter, tend, retval->posex,
-                               retval->posey,
-                               retval->posez, "pose");
-
-              //retval->posex = 0.0f;
-              //retval->posey = 0.0f;
-              //retval->posez = 0.0f;
-            }
-          else if (*iter == "balljoint")
-            {
-
-              ++iter;
-              auto name = *iter;
-              ++iter;
-              retval->children.emplace_back(parse(name, "balljoint",
-                                                  begin, end));
-            }
-        }
-      return retval;
+      tellJointRotation(i, p.rotations[i]);
     }
-  impossible("mismatched { braces } in skel file!");
 }
 
-// static void printSkel(dmp::Balljoint * bj, std::string padding)
-// {
-//   auto pad = padding + "  ";
-//   std::cerr << padding << "Balljoint " << bj->name << " {" << std::endl;
-//   std::cerr << pad << "offset = " << bj->offsetx
-//             << " " << bj->offsety << " " << bj->offsetz << std::endl;
-//   std::cerr << pad << "boxmin = " << bj->boxminx
-//             << " " << bj->boxminy << " " << bj->boxminz << std::endl;
-//   std::cerr << pad << "boxmax = " << bj->boxmaxx
-//             << " " << bj->boxmaxy << " " << bj->boxmaxz << std::endl;
-//   std::cerr << pad << "pose = " << bj->posex
-//             << " " << bj->posey << " " << bj->posez << std::endl;
-//   std::cerr << pad << "rotmin = " << bj->rotxmin
-//             << " " << bj->rotymin << " " << bj->rotzmin << std::endl;
-//   std::cerr << pad << "rotmax = " << bj->rotxmax
-//             << " " << bj->rotymax << " " << bj->rotzmax << std::endl;
-//   for (auto & curr : bj->children)
-//     {
-//       printSkel(curr.get(), pad);
-//     }
-//   std::cerr << padding << "}" << std::endl;
-// }
-
-void dmp::Skeleton::initSkeleton(std::string skelPath)
+void dmp::SkeletonInstance::applyPose(const Pose & p,
+                                      const std::vector<size_t> & joints)
 {
-  using namespace std;
-  using namespace boost;
-
-  ifstream file(skelPath, ios::in);
-  string line;
-  std::vector<std::string> lines;
-
-  expect("opened skelPath", file.is_open());
-
-  while (getline(file, line))
+  for (auto i : joints)
     {
-      lines.push_back(line);
-    }
-
-  file.close();
-
-  auto iter = lines.begin();
+      expect("joint index in range", i < mEulers.size());
+      expect("pose covers joint", i < p.rotations.size());
 
-  line = *iter;
-  ++iter;
+      if (roughEq(p.rotations[i].x, mEulers[i].x)
+          && roughEq(p.rotations[i].y, mEulers[i].y)
+          && roughEq(p.rotations[i].z, mEulers[i].z)) continue;
 
-  char_separator<char> sep(" \t\r\n");
-  tokenizer<char_separator<char>> tokens(line, sep);
-  auto tokIter = tokens.begin();
-
-  if (*tokIter == "balljoint")
-    {
-      ++tokIter;
-      auto lend = lines.end();
-      auto name = *tokIter;
-      mAST = parse(name, "balljoint",
-                   iter, lend);
+      tellJointRotation(i, p.rotations[i]);
     }
-  else
-    {
-      impossible("parse error: invalid root");
-    }
-  //ifDebug(printSkel(mRoot.get(), ""));
 }
 
-dmp::Bone::Bone(Balljoint * bj,
-                bool * dirty,
-                std::vector<dmp::Object *> & objs,
-                std::vector<dmp::Object *> & objCache,
-                size_t matIdx,
-                size_t texIdx,
-                std::vector<glm::mat4>::iterator & invBBegin,
-                std::vector<glm::mat4>::iterator & invBEnd)
+void dmp::SkeletonInstance::tellJointRotation(size_t i, const glm::vec3 & rot)
 {
-  initBone(bj, dirty, objs, objCache,
-           matIdx, texIdx, invBBegin, invBEnd);
+  expect("joint in range", i < mEulers.size());
+  mEulers[i] = rot;
+  mLocalDirty[i] = true;
 }
 
-void dmp::Bone::initBone(Balljoint * bj,
-                         bool * dirty,
-                         std::vector<dmp::Object *> & objs,
-                         std::vector<dmp::Object *> & objCache,
-                         size_t matIdx,
-                         size_t texIdx,
-                         std::vector<glm::mat4>::iterator & invBBegin,
-                         std::vector<glm::mat4>::iterator & invBEnd)
+void dmp::SkeletonInstance::update(const glm::mat4 & M, bool dirty)
 {
-  expect("bj not null", bj);
-  expect("dirty not null", dirty);
-
-  glm::vec4 min = {bj->boxminx, bj->boxminy, bj->boxminz, 1.0f};
-  glm::vec4 max = {bj->boxmaxx, bj->boxmaxy, bj->boxmaxz, 1.0f};
-  glm::vec4 off = {bj->offsetx, bj->offsety, bj->offsetz, 0.0f};
-  mObj = std::make_unique<Object>(Cube, min, max, matIdx, texIdx);
-
-  if (invBBegin != invBEnd) mObj->hide();
-
-  objs.push_back(mObj.get());
-  objCache.push_back(mObj.get());
-
-  mOffset = glm::translate(glm::mat4(), glm::vec3(off));
-  mTransformFn = Skeleton::makeXformFn(bj, dirty);
-
-  expect("successfully created transform fn", mTransformFn);
-
-  if (invBBegin != invBEnd)
+  // one pass in depth first order; every parent is final before its
+  // children read it
+  for (size_t i = 0; i < mEulers.size(); ++i)
     {
-      mInvB = *invBBegin;
-      ++invBBegin;
-    }
+      auto parent = mRig->askParent(i);
+      bool worldDirty = (parent < 0) ? dirty : mWorldDirty[(size_t) parent];
 
-  for (auto & curr : bj->children)
-    {
-      expect("child not null", curr);
+      if (mLocalDirty[i])
+        {
+          mLocals[i] = mRig->localTransform(i, mEulers[i]);
+          mLocalDirty[i] = false;
+          mDirty = true;
+          worldDirty = true;
+        }
 
-      mChildren.emplace_back(std::make_unique<Bone>(curr.get(), dirty, objs,
-                                                    objCache, matIdx, texIdx,
-                                                    invBBegin, invBEnd));
+      const auto & parentM = (parent < 0) ? M : mMs[(size_t) parent];
+      mMs[i] = parentM * mLocals[i];
+      mWorldDirty[i] = worldDirty;
     }
 }
 
-void dmp::Bone::update(float deltaT, glm::mat4 M, bool dirty,
-                std::vector<glm::mat4> & Ms)
+void dmp::Skeleton::initSkeleton(std::string skelPath)
+{
+  mRig = Rig::load(skelPath);
+  mInstance = std::make_unique<SkeletonInstance>(mRig);
+  mInvBs.assign(mRig->askNumJoints(), glm::mat4());
+}
+
+dmp::Balljoint * dmp::Skeleton::getAST()
 {
-  expect("transform fn valid", mTransformFn);
-  bool outDirty = mTransformFn(mRotation, deltaT) || dirty;
-  auto outM = M * mOffset * mRotation;
-  Ms.push_back(outM);
+  if (mAST) return mAST.get();
 
-  expect("mObj not null", mObj);
+  mAST = mRig->makeAST();
 
-  if (outDirty) mObj->setM(outM * mInvB);
+  std::function<void(Balljoint *)> flatten = [&](Balljoint * bj)
+    {
+      mJoints.push_back(bj);
+      for (auto & curr : bj->children)
+        {
+          flatten(curr.get());
+        }
+    };
+  flatten(mAST.get());
+  expect("tree matches rig", mJoints.size() == mRig->askNumJoints());
 
-  for (auto & curr : mChildren)
+  // start the window from the pose we have, not the file's
+  for (size_t i = 0; i < mJoints.size(); ++i)
     {
-      curr->update(deltaT, outM, outDirty, Ms);
+      const auto & rot = mInstance->askJointRotation(i);
+      mJoints[i]->posex = rot.x;
+      mJoints[i]->posey = rot.y;
+      mJoints[i]->posez = rot.z;
     }
+
+  return mAST.get();
 }
 
 void dmp::Skeleton::makeBones(std::vector<Object *> & objs,
@@ -293,20 +128,37 @@ void dmp::Skeleton::makeBones(std::vector<Object *> & objs,
                               std::vector<glm::mat4>::iterator & invBBegin,
                               std::vector<glm::mat4>::iterator & invBEnd)
 {
-  expect("ast not null", mAST);
-  mRoot = std::make_unique<Bone>(mAST.get(),
-                                 &mDirty,
-                                 objs,
-                                 mSkeletonObjects,
-                                 matIdx,
-                                 texIdx,
-                                 invBBegin,
-                                 invBEnd);
+  expect("bones not made yet", mBoneObjects.empty());
+
+  // with bindings, the boxes are only there to be shown on request
+  bool hidden = invBBegin != invBEnd;
+
+  for (size_t i = 0; i < mRig->askNumJoints(); ++i)
+    {
+      glm::vec4 min = glm::vec4(mRig->askBoxMin(i), 1.0f);
+      glm::vec4 max = glm::vec4(mRig->askBoxMax(i), 1.0f);
+      mBoneObjects.push_back(std::make_unique<Object>(Cube, min, max,
+                                                      matIdx, texIdx));
+      if (hidden) mBoneObjects.back()->hide();
+      objs.push_back(mBoneObjects.back().get());
+
+      if (invBBegin != invBEnd)
+        {
+          mInvBs[i] = *invBBegin;
+          ++invBBegin;
+        }
+    }
+
+  // the new boxes need placing, even if nothing moves
+  for (size_t i = 0; i < mRig->askNumJoints(); ++i)
+    {
+      mInstance->tellJointRotation(i, mInstance->askJointRotation(i));
+    }
 }
 
 void dmp::Skeleton::show()
 {
-  for (auto & curr : mSkeletonObjects)
+  for (auto & curr : mBoneObjects)
     {
       curr->show();
     }
@@ -314,61 +166,53 @@ void dmp::Skeleton::show()
 
 void dmp::Skeleton::hide()
 {
-  for (auto & curr : mSkeletonObjects)
+  for (auto & curr : mBoneObjects)
     {
       curr->hide();
     }
 }
 
-
 void dmp::Skeleton::update(float deltaT, glm::mat4 M, bool dirty)
 {
-  mMs.clear();
-  if (mRoot) mRoot->update(deltaT, M, dirty, mMs);
-}
-
-const std::vector<glm::mat4> & dmp::Skeleton::getMs() const
-{
-  return mMs;
-}
-
-static void applyPoseImpl(dmp::Balljoint * bj,
-                          std::vector<glm::vec3>::const_iterator & curr,
-                          std::vector<glm::vec3>::const_iterator & end)
-{
-  using namespace dmp;
-
-  expect("range valid", curr != end);
-
-  bj->rotateDirty = bj->rotateDirty || !(roughEq(curr->x, bj->posex)
-                                         && roughEq(curr->y, bj->posey)
-                                         && roughEq(curr->z, bj->posez));
-
-  bj->posex = curr->x;
-  bj->posey = curr->y;
-  bj->posez = curr->z;
+  // the dof window edits the Balljoints directly
+  for (size_t i = 0; i < mJoints.size(); ++i)
+    {
+      auto * bj = mJoints[i];
+      if (!bj->rotateDirty) continue;
 
-  //std::cerr << "pose = <"
-  //          << bj->posex << ", "
-  //          << bj->posey << ", "
-  //          << bj->posez << ", "
-  //          << bj->rotateDirty << ">" << std::endl;;
+      mInstance->tellJointRotation(i, {bj->posex, bj->posey, bj->posez});
+      bj->rotateDirty = false;
+    }
 
+  mInstance->update(M, dirty);
 
-  safeIncr(curr, end);
+  if (mBoneObjects.empty()) return;
 
-  for (auto & child : bj->children)
+  const auto & Ms = mInstance->getMs();
+  for (size_t i = 0; i < mBoneObjects.size(); ++i)
     {
-      applyPoseImpl(child.get(), curr, end);
+      if (mInstance->askWorldDirty(i))
+        {
+          mBoneObjects[i]->setM(Ms[i] * mInvBs[i]);
+        }
     }
 }
 
-void dmp::Skeleton::applyPose(const Pose & p)
+void dmp::Skeleton::bakePose(const Pose & p)
 {
-  auto b = p.rotations.begin();
-  auto e = p.rotations.end();
+  expect("pose covers every joint",
+         p.rotations.size() >= mRig->askNumJoints());
 
-  // TODO: root translation
+  for (size_t i = 0; i < mRig->askNumJoints(); ++i)
+    {
+      mInstance->tellJointRotation(i, p.rotations[i]);
+    }
 
-  applyPoseImpl(mAST.get(), b, e);
+  // the dof window reads the Balljoints, so it learns the baked pose too
+  for (size_t i = 0; i < mJoints.size(); ++i)
+    {
+      mJoints[i]->posex = p.rotations[i].x;
+      mJoints[i]->posey = p.rotations[i].y;
+      mJoints[i]->posez = p.rotations[i].z;
+    }
 }
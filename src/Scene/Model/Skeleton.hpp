@@ -7,76 +7,69 @@
 #include <memory>
 #include "../Object.hpp"
 #include "Pose.hpp"
+#include "Rig.hpp"
 
 namespace dmp
 {
-  struct Balljoint
-  {
-    std::string name;
-
-    float offsetx = 0.0f;
-    float offsety = 0.0f;
-    float offsetz = 0.0f;
-    float boxminx = -0.1f;
-    float boxminy = -0.1f;
-    float boxminz = -0.1f;
-    float boxmaxx = 0.1f;
-    float boxmaxy = 0.1f;
-    float boxmaxz = 0.1f;
-    float rotxmin = -std::numeric_limits<float>::infinity();
-    float rotymin = -std::numeric_limits<float>::infinity();
-    float rotzmin = -std::numeric_limits<float>::infinity();
-    float rotxmax = std::numeric_limits<float>::infinity();
-    float rotymax = std::numeric_limits<float>::infinity();
-    float rotzmax = std::numeric_limits<float>::infinity();
-    float posex = 0.0f;
-    float posey = 0.0f;
-    float posez = 0.0f;
-
-    std::vector<std::unique_ptr<Balljoint>> children;
-
-    bool rotateDirty = true;
-  };
-
-  class Bone
+  // One character's pose on a shared Rig: the applied joint rotations and
+  // the world matrices they give, nothing else
+  class SkeletonInstance
   {
   public:
-    Bone() = delete;
-    Bone(const Bone &) = delete;
-    Bone & operator=(const Bone &) = delete;
-    Bone(Bone &&) = default;
-    Bone & operator=(Bone &&) = default;
-
-    Bone(Balljoint * bj,
-         bool * dirty,
-         std::vector<dmp::Object *> & objs,
-         std::vector<dmp::Object *> & objCache,
-         size_t matIdx,
-         size_t texIdx,
-         std::vector<glm::mat4>::iterator & invBBegin,
-         std::vector<glm::mat4>::iterator & invBEnd);
-
-    void update(float deltaT, glm::mat4 M, bool dirty,
-                std::vector<glm::mat4> & Ms);
+    SkeletonInstance() = delete;
+    SkeletonInstance(const SkeletonInstance &) = delete;
+    SkeletonInstance & operator=(const SkeletonInstance &) = delete;
+    SkeletonInstance(SkeletonInstance &&) = default;
+    SkeletonInstance & operator=(SkeletonInstance &&) = default;
+
+    // Starts in the rig's rest pose
+    SkeletonInstance(std::shared_ptr<const Rig> rig);
+
+    const Rig & askRig() const {return *mRig;}
+    size_t askNumJoints() const {return mEulers.size();}
+
+    void applyPose(const Pose & p);
+
+    // Applies only the listed joints (indices into p.rotations)
+    void applyPose(const Pose & p, const std::vector<size_t> & joints);
+
+    // Sets joint i even if rot is roughly what it already has
+    void tellJointRotation(size_t i, const glm::vec3 & rot);
+    const glm::vec3 & askJointRotation(size_t i) const
+    {
+      expect("joint in range", i < mEulers.size());
+      return mEulers[i];
+    }
+
+    // Forward kinematics under M, rebuilding only the joints whose
+    // rotation changed. dirty says M changed since the last update
+    void update(const glm::mat4 & M, bool dirty);
+
+    const std::vector<glm::mat4> & getMs() const {return mMs;}
+
+    // Whether joint i's world matrix moved in the last update
+    bool askWorldDirty(size_t i) const
+    {
+      expect("joint in range", i < mWorldDirty.size());
+      return mWorldDirty[i];
+    }
+
+    // Whether any joint's rotation has ever changed
+    bool isDirty() const {return mDirty;}
   private:
-    void initBone(Balljoint * bj,
-                  bool * dirty,
-                  std::vector<dmp::Object *> & objs,
-                  std::vector<dmp::Object *> & objCache,
-                  size_t matIdx,
-                  size_t texIdx,
-                  std::vector<glm::mat4>::iterator & invBBegin,
-                  std::vector<glm::mat4>::iterator & invBEnd);
-
-    std::unique_ptr<Object> mObj;
-    std::vector<std::unique_ptr<Bone>> mChildren;
-
-    glm::mat4 mInvB;
-    glm::mat4 mOffset;
-    std::function<bool(glm::mat4 &, float)> mTransformFn;
-    glm::mat4 mRotation;
+    void initSkeletonInstance(std::shared_ptr<const Rig> rig);
+
+    std::shared_ptr<const Rig> mRig;
+    std::vector<glm::vec3> mEulers; // the applied pose
+    std::vector<glm::mat4> mLocals; // the rig's local transform of mEulers
+    std::vector<bool> mLocalDirty; // mEulers changed since mLocals
+    std::vector<bool> mWorldDirty;
+    std::vector<glm::mat4> mMs; // world, as of the last update
+    bool mDirty = true;
   };
 
+  // A SkeletonInstance with what the interactive viewer puts around it:
+  // a box per bone, and a Balljoint tree for the dof window to edit
   class Skeleton
   {
   public:
@@ -86,6 +79,7 @@ namespace dmp
     Skeleton(Skeleton &&) = default;
     Skeleton & operator=(Skeleton &&) = default;
 
+    // The rig comes from Rig::load, so skeletons of the same file share it
     Skeleton(std::string skelPath)
     {
       initSkeleton(skelPath);
@@ -99,35 +93,58 @@ namespace dmp
 
     ~Skeleton() {}
 
-    Balljoint * getAST()
-    {
-      expect("Skeleton AST not null", mRoot);
-      return mAST.get();
-    }
+    // Built on first use, with the current pose. Edits to it, flagged with
+    // rotateDirty, are picked up by update
+    Balljoint * getAST();
 
     void show();
     void hide();
 
     void update(float deltaT, glm::mat4 M, bool dirty);
 
-    bool isDirty() const {return mDirty;}
-    static std::function<bool(glm::mat4 &, float)> makeXformFn(dmp::Balljoint * bj,
-                                                               bool * dirty);
-    const std::vector<glm::mat4> & getMs() const;
-    void applyPose(const Pose & p);
+    bool isDirty() const {return mInstance->isDirty();}
+    const std::vector<glm::mat4> & getMs() const {return mInstance->getMs();}
+    void applyPose(const Pose & p) {mInstance->applyPose(p);}
+    const glm::vec3 & askJointRotation(size_t i) const
+    {
+      return mInstance->askJointRotation(i);
+    }
+
+    // Applies only the listed joints (indices into p.rotations)
+    void applyPose(const Pose & p, const std::vector<size_t> & joints)
+    {
+      mInstance->applyPose(p, joints);
+    }
+
+    // Writes every joint of p once. Joints that are never applied again
+    // keep this as their rest transform
+    void bakePose(const Pose & p);
+
+    // Forward kinematics for p under M, without touching the skeleton's own
+    // state, so any number of threads can run it at once. Ms gets one world
+    // matrix per joint, in the same order as getMs(). Unlike update, the
+    // root translation of p is applied here
+    void computeMs(const Pose & p,
+                   const glm::mat4 & M,
+                   std::vector<glm::mat4> & Ms) const
+    {
+      mRig->computeMs(p, M, Ms);
+    }
+    size_t askNumJoints() const {return mRig->askNumJoints();}
+    const std::shared_ptr<const Rig> & askRig() const {return mRig;}
   private:
-    std::unique_ptr<Bone> mRoot;
-    std::unique_ptr<Balljoint> mAST;
     void initSkeleton(std::string skelPath);
 
-    std::unique_ptr<Balljoint> parse(std::string currName,
-                                     std::string currCtor,
-                                     std::vector<std::string>::iterator & begin,
-                                     std::vector<std::string>::iterator & end);
+    std::shared_ptr<const Rig> mRig;
+    std::unique_ptr<SkeletonInstance> mInstance;
 
-    std::vector<Object *> mSkeletonObjects;
-    std::vector<glm::mat4> mMs;
-    bool mDirty = true;
+    // the dof window's tree, and its nodes by joint. Empty until getAST
+    std::unique_ptr<Balljoint> mAST;
+    std::vector<Balljoint *> mJoints;
+
+    // one box per joint, empty until makeBones
+    std::vector<std::unique_ptr<Object>> mBoneObjects;
+    std::vector<glm::mat4> mInvBs; // identity unless makeBones got some
   };
 }
 
@@ -2,11 +2,16 @@
 
 #include <iostream>
 #include <fstream>
+#include <algorithm>
+#include <cmath>
 #include "../../util.hpp"
 #include "../Object.hpp"
 #include "../Graph.hpp"
 #include "Morph.hpp"
 #include "parsing.hpp"
+#include "Simplify.hpp"
+#include "AnimationLOD.hpp"
+#include "../../Quaternion.hpp"
 
 #include <glm/gtx/string_cast.hpp>
 
@@ -24,6 +29,13 @@ static const char * tokMaterial = "material";
 static const char * tokTexture = "texture";
 static const char * tokOpenBrace = "{";
 
+// levels of detail, the full mesh among them, and how far any may move
+// the surface as a fraction of the skin's size. A level that can't get
+// below skinLODMinDrop of the one before isn't worth its indices
+static const size_t skinMaxLODs = 4;
+static const float skinLODError = 0.05f;
+static const float skinLODMinDrop = 0.85f;
+
 static void parsePositions(dmp::SkinData & data,
                            TokenIterator & iter,
                            TokenIterator & end)
@@ -74,6 +86,34 @@ static void parseNormals(dmp::SkinData & data,
   dmp::parseField<dmp::SkinData>(data, iter, end, tokNormals, t, f);
 }
 
+// Quantizes the count influences in index and weight, at most
+// maxSkinInfluences of them, so the weights sum to exactly one. What
+// rounding loses goes to the heaviest
+static dmp::SkinWeight packSkinWeight(const size_t * index,
+                                      const float * weight,
+                                      size_t count)
+{
+  dmp::SkinWeight w = {};
+  w.count = (uint8_t) count;
+
+  float sum = 0.0f;
+  for (size_t k = 0; k < count; ++k) sum += weight[k];
+  expect("skin weights sum above 0", sum > 0.0f);
+
+  long total = 0;
+  size_t heaviest = 0;
+  for (size_t k = 0; k < count; ++k)
+    {
+      expect("skin weight index fits", index[k] <= UINT16_MAX);
+      w.index[k] = (uint16_t) index[k];
+      w.weight[k] = (uint16_t) lroundf(weight[k] / sum * 65535.0f);
+      total += w.weight[k];
+      if (weight[k] > weight[heaviest]) heaviest = k;
+    }
+  w.weight[heaviest] = (uint16_t) (w.weight[heaviest] + (65535 - total));
+  return w;
+}
+
 static void parseSkinWeights(dmp::SkinData & data,
                              TokenIterator & iter,
                              TokenIterator & end)
@@ -92,22 +132,38 @@ static void parseSkinWeights(dmp::SkinData & data,
                TokenIterator & end)
     {
       auto count = stoi(*iter);
-      expect("count not negative", count >= 0);
-      dmp::SkinWeight w = {};
-      w.count = (size_t) count;
-      w.index.resize(w.count);
-      w.weight.resize(w.count);
+      expect("count above 0", count > 0);
+
+      // past maxSkinInfluences, the lightest influence gives way
+      size_t index[dmp::maxSkinInfluences];
+      float weight[dmp::maxSkinInfluences];
+      size_t kept = 0;
 
       safeIncr(iter, end); // advance to index
-      for (size_t i = 0; i < w.count; ++i)
+      for (int i = 0; i < count; ++i)
         {
-          w.index[i] = (size_t) stoi(*iter);
+          auto idx = (size_t) stoi(*iter);
           safeIncr(iter, end); // advance to weight
-          w.weight[i] = stof(*iter);
+          auto wt = stof(*iter);
           safeIncr(iter, end) // advance to next index or }
+
+          if (kept < dmp::maxSkinInfluences)
+            {
+              index[kept] = idx;
+              weight[kept] = wt;
+              ++kept;
+              continue;
+            }
+          auto lightest = (size_t) (std::min_element(weight, weight + kept)
+                                    - weight);
+          if (wt > weight[lightest])
+            {
+              index[lightest] = idx;
+              weight[lightest] = wt;
+            }
         }
 
-      data.weights.push_back(w);
+      data.weights.push_back(packSkinWeight(index, weight, kept));
     };
 
   dmp::parseField<dmp::SkinData>(data, iter, end, tokSkinweights, t, f);
@@ -259,7 +315,7 @@ static void parseTexFile(dmp::SkinData & data,
       for (size_t j = 0; j < data.weights[data.idxs[i]].count; ++j)
         {
           std::cerr << "   " << data.weights[data.idxs[i]].index[j] << " <-> "
-                    << data.weights[data.idxs[i]].weight[j] << std::endl;
+                    << data.weights[data.idxs[i]].askWeight(j) << std::endl;
         }
       std::cerr << "}" << std::endl;
     }
@@ -275,8 +331,10 @@ static void parseTexFile(dmp::SkinData & data,
     }
     }*/
 
-void dmp::Skin::initSkin(const std::string & skinPath)
+void dmp::Skin::initSkin(const std::string & skinPath, size_t maxBones)
 {
+  expect("parts fit in ObjectConstants", maxBones <= maxPaletteBones);
+
   mSkinData = {};
   mSkinData.filename = skinPath;
 
@@ -333,127 +391,700 @@ void dmp::Skin::initSkin(const std::string & skinPath)
   expect("|verts| = |texCoords|",
          mSkinData.verts.size() == mSkinData.texCoords.size());
 
-  expect("all SkinWeights vectors have same length",
-         [&s=mSkinData](){
-           for (const auto & curr : s.weights)
-             {
-               if (curr.index.size() != curr.count)
-                 {
-                   return false;
-                 }
-               else if (curr.count != curr.weight.size())
-                 {
-                   return false;
-                 }
-             }
-           return true;
-         }());
-
-  for (size_t i = 0; i < mSkinData.weights.size(); ++i)
-    {
-      for (size_t j = 0; j < mSkinData.weights[i].index.size(); ++j)
+  expect("a skin weight per vertex",
+         mSkinData.weights.size() == mSkinData.verts.size());
+
+  for (const auto & curr : mSkinData.weights)
+    {
+      for (size_t j = 0; j < curr.count; ++j)
         {
           expect("Skin weight index valid",
-                 mSkinData.weights[i].index[j] < mSkinData.invBindings.size());
+                 curr.index[j] < mSkinData.invBindings.size());
+        }
+    }
+
+  // triangles in vertex cache order, then vertices in the order they use
+  // them, every per-vertex array alike
+  std::vector<size_t> remap;
+  mNumFileVerts = mSkinData.verts.size();
+  mMeshStats = optimizeMesh(mSkinData.idxs, mSkinData.verts.size(), remap);
+  applyRemap(remap, mSkinData.verts);
+  applyRemap(remap, mSkinData.normals);
+  applyRemap(remap, mSkinData.texCoords);
+  applyRemap(remap, mSkinData.weights);
+
+  ifDebug(std::cerr << skinPath << ": ACMR " << mMeshStats.acmrBefore
+          << " in file order, " << mMeshStats.acmrAfter << " optimized"
+          << std::endl);
+
+  // then into parts the palette can hold, each keeping that order
+  mSources = splitPalette(mSkinData, maxBones, mParts);
+  std::vector<size_t> fileVert(remap.size());
+  for (size_t i = 0; i < remap.size(); ++i) fileVert[remap[i]] = i;
+  for (auto & curr : mSources) curr = fileVert[curr];
+
+  // a box per bone around every vertex it moves at all
+  mBoneBounds.assign(mSkinData.invBindings.size(), AABB());
+  for (size_t i = 0; i < mSkinData.verts.size(); ++i)
+    {
+      const auto & weight = mSkinData.weights[i];
+      for (size_t j = 0; j < weight.count; ++j)
+        {
+          if (weight.weight[j] == 0) continue;
+          mBoneBounds[weight.index[j]].add(mSkinData.verts[i]);
         }
     }
+
+  ifDebug(if (mParts.size() > 1)
+            {
+              std::cerr << skinPath << ": " << mSkinData.invBindings.size()
+                        << " bones in " << mParts.size() << " parts, "
+                        << mSkinData.verts.size() - remap.size()
+                        << " vertices copied" << std::endl;
+            });
 }
 
+// -----------------------------------------------------------------------------
+// Palette splitting
+// -----------------------------------------------------------------------------
+
+// Replaces data with data[sources[0]], data[sources[1]], ...
+template <typename T>
+static void gatherVerts(const std::vector<size_t> & sources,
+                        std::vector<T> & data)
+{
+  std::vector<T> out;
+  out.reserve(sources.size());
+  for (auto v : sources) out.push_back(data[v]);
+  data.swap(out);
+}
+
+std::vector<size_t> dmp::splitPalette(SkinData & data,
+                                      size_t maxBones,
+                                      std::vector<SkinPart> & parts)
+{
+  auto numVerts = data.verts.size();
+  auto numBones = data.invBindings.size();
+  auto numTris = data.idxs.size() / 3;
+  expect("whole triangles", data.idxs.size() % 3 == 0);
+  expect("a triangle's bones fit a part", maxBones >= 3 * maxSkinInfluences);
+
+  parts.clear();
+  std::vector<size_t> sources(numVerts);
+  for (size_t i = 0; i < numVerts; ++i) sources[i] = i;
+
+  if (numBones <= maxBones)
+    {
+      parts.resize(1);
+      parts[0].numVerts = numVerts;
+      parts[0].idxs = data.idxs;
+      for (size_t b = 0; b < numBones; ++b) parts[0].bones.push_back(b);
+      return sources;
+    }
+
+  // a part at a time: every triangle left that fits the bones so far. A
+  // triangle's bones are every influence of its vertices, weighted or not,
+  // so none of them is ever missing from its part's palette
+  std::vector<char> taken(numTris, 0);
+  std::vector<char> inPart(numBones);
+  size_t left = numTris;
+  std::vector<std::vector<size_t>> partTris;
+  while (left > 0)
+    {
+      std::fill(inPart.begin(), inPart.end(), 0);
+      size_t partBones = 0;
+      partTris.emplace_back();
+      for (size_t t = 0; t < numTris; ++t)
+        {
+          if (taken[t]) continue;
+
+          size_t added[3 * maxSkinInfluences];
+          size_t numAdded = 0;
+          for (size_t k = 0; k < 3; ++k)
+            {
+              const auto & w = data.weights[data.idxs[3 * t + k]];
+              for (size_t j = 0; j < w.count; ++j)
+                {
+                  auto b = w.index[j];
+                  if (inPart[b]
+                      || std::find(added, added + numAdded, b)
+                      != added + numAdded) continue;
+                  added[numAdded++] = b;
+                }
+            }
+          if (partBones + numAdded > maxBones) continue;
+
+          for (size_t j = 0; j < numAdded; ++j) inPart[added[j]] = 1;
+          partBones += numAdded;
+          partTris.back().push_back(t);
+          taken[t] = 1;
+          --left;
+        }
+
+      parts.emplace_back();
+      for (size_t b = 0; b < numBones; ++b)
+        {
+          if (inPart[b]) parts.back().bones.push_back(b);
+        }
+    }
+  if (parts.empty()) parts.resize(1);
+
+  // each part's vertices in the order its triangles use them, a copy of
+  // any another part used first
+  auto unset = (size_t) -1;
+  std::vector<size_t> local(numVerts);
+  std::vector<char> used(numVerts, 0);
+  sources.clear();
+  for (size_t p = 0; p < partTris.size(); ++p)
+    {
+      auto & part = parts[p];
+      part.firstVert = sources.size();
+      std::fill(local.begin(), local.end(), unset);
+      for (auto t : partTris[p])
+        {
+          for (size_t k = 0; k < 3; ++k)
+            {
+              auto v = data.idxs[3 * t + k];
+              if (local[v] == unset)
+                {
+                  local[v] = sources.size() - part.firstVert;
+                  sources.push_back(v);
+                  used[v] = 1;
+                }
+              part.idxs.push_back(local[v]);
+            }
+        }
+      part.numVerts = sources.size() - part.firstVert;
+    }
+
+  // no triangle uses these, but morphs and the cpu skinner still see them
+  for (size_t v = 0; v < numVerts; ++v)
+    {
+      if (used[v]) continue;
+      sources.push_back(v);
+      ++parts.back().numVerts;
+    }
+
+  gatherVerts(sources, data.verts);
+  gatherVerts(sources, data.normals);
+  gatherVerts(sources, data.texCoords);
+  gatherVerts(sources, data.weights);
+
+  data.idxs.clear();
+  for (const auto & part : parts)
+    {
+      for (auto i : part.idxs) data.idxs.push_back(part.firstVert + i);
+    }
+
+  return sources;
+}
+
+// -----------------------------------------------------------------------------
+// Objects
+// -----------------------------------------------------------------------------
+
 void dmp::Skin::insertInScene(std::vector<Object *> & objs,
                               size_t matIdx,
                               size_t texIdx)
 {
-  std::vector<ObjectVertex> verts;
-  verts.reserve(mSkinData.verts.size());
-  for (size_t i = 0; i < mSkinData.verts.size(); ++i)
+  buildParts(matIdx, texIdx);
+  for (auto & curr : mParts)
     {
-      auto weight = mSkinData.weights[i];
-      expect("We support max 4 weights", weight.count <= 4);
-      expect("there must be > 0 weights", weight.count > 0);
-      int idxs[4] = {-1, -1, -1, -1};
-      glm::vec4 wvals = {0.0f, 0.0f, 0.0f, 0.0f};
+      objs.push_back(curr.object.get());
+    }
+}
 
-      for (int j = 0; j < (int) weight.count; ++j)
+void dmp::Skin::buildObjects(size_t matIdx, size_t texIdx)
+{
+  buildParts(matIdx, texIdx);
+}
+
+void dmp::Skin::buildParts(size_t matIdx, size_t texIdx)
+{
+  expect("skin objects not built yet", !isBuilt());
+
+  std::vector<int> slot(mSkinData.invBindings.size());
+  for (auto & part : mParts)
+    {
+      std::fill(slot.begin(), slot.end(), -1);
+      for (size_t j = 0; j < part.bones.size(); ++j)
         {
-          idxs[j] = (int) weight.index[j];
-          wvals[j] = weight.weight[j];
+          slot[part.bones[j]] = (int) j;
         }
 
-      ObjectVertex v = {mSkinData.verts[i],
-                        mSkinData.normals[i],
-                        mSkinData.texCoords[i],
-                        wvals,
-                        {idxs[0], idxs[1], idxs[2], idxs[3]}};
-      verts.push_back(v);
+      std::vector<ObjectVertex> verts;
+      verts.reserve(part.numVerts);
+      for (auto i = part.firstVert; i < part.firstVert + part.numVerts; ++i)
+        {
+          const auto & weight = mSkinData.weights[i];
+          int idxs[4] = {-1, -1, -1, -1};
+          glm::vec4 wvals = {0.0f, 0.0f, 0.0f, 0.0f};
+
+          // only vertices no triangle draws have bones outside the part
+          for (int j = 0; j < (int) weight.count; ++j)
+            {
+              idxs[j] = slot[weight.index[j]];
+              if (idxs[j] >= 0) wvals[j] = weight.askWeight((size_t) j);
+            }
+
+          ObjectVertex v = {mSkinData.verts[i],
+                            mSkinData.normals[i],
+                            mSkinData.texCoords[i],
+                            wvals,
+                            {idxs[0], idxs[1], idxs[2], idxs[3]}};
+          verts.push_back(v);
+        }
+      std::vector<GLuint> idxs;
+      idxs.reserve(part.idxs.size());
+      for (const auto & curr : part.idxs)
+        {
+          idxs.push_back((GLuint) curr);
+        }
+
+      part.object = std::make_unique<Object>(verts,
+                                             idxs,
+                                             GL_TRIANGLES,
+                                             matIdx,
+                                             texIdx,
+                                             GL_DYNAMIC_DRAW);
+      part.object->show();
+
+      std::vector<glm::vec3> positions(mSkinData.verts.begin()
+                                       + (long) part.firstVert,
+                                       mSkinData.verts.begin()
+                                       + (long) (part.firstVert
+                                                 + part.numVerts));
+      glm::vec3 center;
+      float radius;
+      AnimationLOD::boundingSphere(positions, center, radius);
+      part.object->tellBounds(center, radius);
+      if (!part.lods.empty()) tellPartLODs(part);
     }
-  std::vector<GLuint> idxs;
-  idxs.reserve(mSkinData.idxs.size());
-  for (const auto & curr : mSkinData.idxs)
+}
+
+// -----------------------------------------------------------------------------
+// Levels of detail
+// -----------------------------------------------------------------------------
+
+void dmp::Skin::buildLODs(const std::vector<char> & locked)
+{
+  expect("a lock per vertex, or none",
+         locked.empty() || locked.size() == mSkinData.verts.size());
+
+  for (auto & part : mParts)
     {
-      idxs.push_back((GLuint) curr);
-    }
+      // the part's slice of every array
+      SimplifyMesh mesh;
+      mesh.numVerts = part.numVerts;
+      mesh.positions = mSkinData.verts.data() + part.firstVert;
+      mesh.normals = mSkinData.normals.data() + part.firstVert;
+      if (mIsTextured)
+        {
+          mesh.texCoords = mSkinData.texCoords.data() + part.firstVert;
+        }
+      mesh.weights = mSkinData.weights.data() + part.firstVert;
+      if (!locked.empty()) mesh.locked = locked.data() + part.firstVert;
 
-  mObject = std::make_unique<Object>(verts,
-                                     idxs,
-                                     GL_TRIANGLES,
-                                     matIdx,
-                                     texIdx,
-                                     GL_DYNAMIC_DRAW);
-  mObject->show();
+      // each level from the full mesh, so errors don't pile up
+      part.lods.clear();
+      auto numTris = part.idxs.size() / 3;
+      auto last = numTris;
+      for (size_t i = 1; i < skinMaxLODs; ++i)
+        {
+          auto level = simplifyMesh(mesh,
+                                    part.idxs,
+                                    numTris >> i,
+                                    skinLODError);
+          if ((float) level.size() / 3.0f > skinLODMinDrop * (float) last)
+            {
+              break;
+            }
+          last = level.size() / 3;
+          part.lods.push_back(std::move(level));
+        }
 
-  objs.push_back(mObject.get());
+      ifDebug(std::cerr << mSkinData.filename << ": LOD triangles "
+              << numTris;
+              for (const auto & curr : part.lods)
+                {
+                  std::cerr << ", " << curr.size() / 3;
+                }
+              std::cerr << std::endl);
 
+      if (part.object) tellPartLODs(part);
+    }
+}
+
+void dmp::Skin::tellPartLODs(SkinPart & part)
+{
+  std::vector<std::vector<GLuint>> levels;
+  levels.emplace_back(part.idxs.begin(), part.idxs.end());
+  for (const auto & curr : part.lods)
+    {
+      levels.emplace_back(curr.begin(), curr.end());
+    }
+  part.object->tellLODs(levels);
+}
+
+void dmp::Skin::freeObject()
+{
+  for (auto & curr : mParts)
+    {
+      if (curr.object) curr.object->freeObject();
+    }
 }
 
 void dmp::Skin::hide()
 {
-  if (mObject) mObject->hide();
+  for (auto & curr : mParts)
+    {
+      if (curr.object) curr.object->hide();
+    }
 }
 
 void dmp::Skin::show()
 {
-  if (mObject) mObject->show();
+  for (auto & curr : mParts)
+    {
+      if (curr.object) curr.object->show();
+    }
 }
 
 void dmp::Skin::update(float deltaT,
                        glm::mat4 M,
                        bool dirty)
 {
-  if (mObject) mObject->setM(M);
+  for (auto & curr : mParts)
+    {
+      if (curr.object) curr.object->setM(M);
+    }
+}
+
+void dmp::Skin::updateParts(const std::function<void(DynamicVertex * data,
+                                                     size_t first,
+                                                     size_t count)> & fn)
+{
+  for (auto & part : mParts)
+    {
+      part.object->updateVertices([&part, &fn](DynamicVertex * data,
+                                               size_t numElems)
+                                  {
+                                    expect("a vertex per part vertex",
+                                           numElems == part.numVerts);
+                                    fn(data, part.firstVert, numElems);
+                                  });
+    }
+}
+
+void dmp::Skin::writeVertices(const std::function<void(DynamicVertex *)> & fn)
+{
+  if (mParts.size() == 1)
+    {
+      updateParts([&fn](DynamicVertex * data, size_t, size_t) {fn(data);});
+      return;
+    }
+
+  mSplitVerts.resize(mSkinData.verts.size());
+  fn(mSplitVerts.data());
+  updateParts([this](DynamicVertex * data, size_t first, size_t count)
+              {
+                std::copy(mSplitVerts.begin() + (long) first,
+                          mSplitVerts.begin() + (long) (first + count),
+                          data);
+              });
 }
 
+// -----------------------------------------------------------------------------
+// Palette
+// -----------------------------------------------------------------------------
+
 void dmp::Skin::tellBindingMats(const std::vector<glm::mat4> & m)
 {
   expect("bone Ms has same length as binding Ms",
          m.size() == mSkinData.invBindings.size());
-  expect("object not null", mObject);
+  expect("skin objects built", isBuilt());
+
+  // m is in world space; the shader puts the skin there with the object's
+  // M, so the palette stops at model space
+  mPalette.resize(m.size());
+  computePalette(m, mPalette.data());
+  updateBounds();
+  auto toModel = glm::inverse(mParts[0].object->getM());
+  for (auto & curr : mPalette)
+    {
+      curr = toModel * curr;
+    }
 
-  std::vector<glm::mat4> outToObj(0);
-  outToObj.reserve(m.size());
+  // once per frame, so neither the shader nor the cpu converts per vertex
+  if (mMode == SkinningMode::dualQuaternion)
+    {
+      mDualPalette.resize(2 * mPalette.size());
+      toDualPalette(mPalette.data(), mPalette.size(), mDualPalette.data());
+    }
+
+  if (mCPUSkinner)
+    {
+      writeVertices([this](DynamicVertex * data) {skinVertices(data);});
+    }
+  else
+    {
+      tellObjectPalette();
+    }
+}
+
+void dmp::Skin::tellObjectPalette()
+{
+  if (mPalette.empty()) return;
+  for (auto & part : mParts)
+    {
+      if (mMode == SkinningMode::dualQuaternion)
+        {
+          mPartDualPalette.clear();
+          for (auto b : part.bones)
+            {
+              mPartDualPalette.push_back(mDualPalette[2 * b]);
+              mPartDualPalette.push_back(mDualPalette[2 * b + 1]);
+            }
+          part.object->tellBindingDualQuats(mPartDualPalette);
+        }
+      else
+        {
+          mPartPalette.clear();
+          for (auto b : part.bones)
+            {
+              mPartPalette.push_back(mPalette[b]);
+            }
+          part.object->tellBindingMats(mPartPalette);
+        }
+    }
+}
+
+void dmp::Skin::skinVertices(DynamicVertex * data)
+{
+  if (mPalette.empty()) return;
+  if (mMode == SkinningMode::dualQuaternion)
+    {
+      mCPUSkinner->skinDual(mDualPalette.data(), data, *mJobs);
+    }
+  else
+    {
+      mCPUSkinner->skin(mPalette.data(), data, *mJobs);
+    }
+}
+
+void dmp::Skin::skinOnCPU(JobSystem * jobs)
+{
+  expect("skin objects built", isBuilt());
+
+  if (!jobs)
+    {
+      if (!mCPUSkinner) return;
+      writeVertices([this](DynamicVertex * data)
+                    {
+                      mCPUSkinner->writeRest(data);
+                    });
+      mCPUSkinner.reset();
+      mJobs = nullptr;
+      for (auto & curr : mParts) curr.object->tellSkinned(true);
+      tellObjectPalette();
+      return;
+    }
+
+  mJobs = jobs;
+  if (mCPUSkinner) return;
+
+  // the buffers hold the rest mesh, with any morphs applied so far
+  mCPUSkinner = std::make_unique<CPUSkinner>(*this);
+  updateParts([this](DynamicVertex * data, size_t first, size_t count)
+              {
+                for (size_t i = 0; i < count; ++i)
+                  {
+                    mCPUSkinner->tellRest(first + i,
+                                          data[i].position,
+                                          data[i].askNormal());
+                  }
+              });
+  writeVertices([this](DynamicVertex * data) {skinVertices(data);});
+  for (auto & curr : mParts)
+    {
+      curr.object->clearBindingMats();
+      curr.object->tellSkinned(false);
+    }
+}
+
+void dmp::Skin::computePalette(const std::vector<glm::mat4> & m,
+                               glm::mat4 * out) const
+{
+  expect("bone Ms has same length as binding Ms",
+         m.size() == mSkinData.invBindings.size());
 
   for (size_t i = 0; i < m.size(); ++i)
     {
-      outToObj.push_back(m[i] * mSkinData.invBindings[i]);
+      out[i] = m[i] * mSkinData.invBindings[i];
     }
+}
 
-  mObject->tellBindingMats(outToObj);
+void dmp::toDualPalette(const glm::mat4 * palette,
+                        size_t count,
+                        glm::vec4 * out)
+{
+  for (size_t i = 0; i < count; ++i)
+    {
+      auto dq = toDualQuaternion(palette[i]);
+      out[2 * i] = {dq.real.imaginary, dq.real.real};
+      out[2 * i + 1] = {dq.dual.imaginary, dq.dual.real};
+    }
 }
 
 void dmp::Skin::applyMorph(const Morph & morph)
 {
-  auto f = [&morph](ObjectVertex * data,
-                    size_t numElems)
+  for (const auto & curr : morph.verts)
+    {
+      expect("morph index in range", curr.first < mSkinData.verts.size());
+      expect("Morph has correspoinding normal",
+             morph.normals.find(curr.first) != morph.normals.end());
+
+      // the boxes only ever grow, so a blend between morphs stays inside
+      const auto & weight = mSkinData.weights[curr.first];
+      for (size_t j = 0; j < weight.count; ++j)
+        {
+          if (weight.weight[j] == 0) continue;
+          mBoneBounds[weight.index[j]].add(curr.second);
+        }
+    }
+
+  if (mCPUSkinner)
     {
+      // the buffers hold the skinned mesh, which the morph just moved
       for (const auto & curr : morph.verts)
         {
-          expect("morph index in range", curr.first < numElems);
-          auto normal = morph.normals.find(curr.first);
-          expect("Morph has correspoinding normal",
-                 normal != morph.normals.end());
-          data[curr.first].position = curr.second;
-          data[curr.first].normal = morph.normals.at(curr.first);
+          mCPUSkinner->tellRest(curr.first,
+                                curr.second,
+                                morph.normals.find(curr.first)->second);
+        }
+      writeVertices([this](DynamicVertex * data) {skinVertices(data);});
+      return;
+    }
+
+  // each part takes the morphed vertices in its slice
+  auto f = [&morph](DynamicVertex * data,
+                    size_t first,
+                    size_t count)
+    {
+      auto end = morph.verts.lower_bound(first + count);
+      for (auto curr = morph.verts.lower_bound(first); curr != end; ++curr)
+        {
+          auto & v = data[curr->first - first];
+          v.position = curr->second;
+          v.tellNormal(morph.normals.find(curr->first)->second);
         }
     };
 
-  mObject->updateVertices(f);
+  updateParts(f);
+}
+
+// -----------------------------------------------------------------------------
+// Bounds
+// -----------------------------------------------------------------------------
+
+dmp::AABB dmp::Skin::computeBounds(const glm::mat4 * palette) const
+{
+  // every vertex is a blend of where its bones put it, and each of those
+  // is in that bone's box
+  AABB box;
+  for (size_t i = 0; i < mBoneBounds.size(); ++i)
+    {
+      box.add(mBoneBounds[i].transformed(palette[i]));
+    }
+  return box;
+}
+
+void dmp::Skin::updateBounds()
+{
+  mPosedBounds.resize(mBoneBounds.size());
+  mWorldBounds = {};
+  for (size_t i = 0; i < mBoneBounds.size(); ++i)
+    {
+      mPosedBounds[i] = mBoneBounds[i].transformed(mPalette[i]);
+      mWorldBounds.add(mPosedBounds[i]);
+    }
+
+  if (mParts.size() == 1)
+    {
+      mParts[0].object->tellWorldBounds(mWorldBounds);
+      return;
+    }
+  for (auto & part : mParts)
+    {
+      AABB box;
+      for (auto b : part.bones) box.add(mPosedBounds[b]);
+      part.object->tellWorldBounds(box);
+    }
+}
+
+// -----------------------------------------------------------------------------
+// Checks
+// -----------------------------------------------------------------------------
+
+dmp::PaletteSplitCheck dmp::checkPaletteSplit(const std::string & skinPath,
+                                              size_t maxBones)
+{
+  Skin whole(skinPath);
+  Skin split(skinPath, maxBones);
+  expect("both from one file",
+         whole.askNumFileVerts() == split.askNumFileVerts());
+
+  PaletteSplitCheck check;
+  check.parts = split.askNumParts();
+  check.verts = split.askVerts().size();
+  check.copies = check.verts - split.askNumFileVerts();
+
+  size_t wholeTris = 0;
+  size_t splitTris = 0;
+  for (size_t p = 0; p < whole.askNumParts(); ++p)
+    {
+      wholeTris += whole.askPart(p).idxs.size() / 3;
+    }
+  for (size_t p = 0; p < split.askNumParts(); ++p)
+    {
+      splitTris += split.askPart(p).idxs.size() / 3;
+      check.mostBones = std::max(check.mostBones,
+                                 split.askPart(p).bones.size());
+    }
+  check.agree = wholeTris == splitTris && check.mostBones <= maxBones;
+
+  // a morph of every 3rd vertex of the file, onto each
+  Morph file;
+  for (size_t v = 0; v < whole.askNumFileVerts(); v += 3)
+    {
+      file.verts[v] = glm::vec3((float) v, 1.0f, 0.0f);
+      file.normals[v] = glm::vec3(0.0f, 1.0f, 0.0f);
+    }
+  auto wholeMorph = file;
+  auto splitMorph = file;
+  wholeMorph.remap(whole.askSources(), whole.askNumFileVerts());
+  splitMorph.remap(split.askSources(), split.askNumFileVerts());
+  check.morphed = splitMorph.verts.size();
+
+  // every split vertex, copies too, is the whole skin's vertex of the same
+  // source
+  std::vector<size_t> wholeOf(whole.askNumFileVerts());
+  for (size_t i = 0; i < whole.askSources().size(); ++i)
+    {
+      wholeOf[whole.askSources()[i]] = i;
+    }
+  for (size_t i = 0; i < check.verts; ++i)
+    {
+      auto w = wholeOf[split.askSources()[i]];
+      auto s = splitMorph.verts.find(i);
+      auto m = wholeMorph.verts.find(w);
+      if (split.askVerts()[i] != whole.askVerts()[w]
+          || split.askNormals()[i] != whole.askNormals()[w]
+          || (s == splitMorph.verts.end()) != (m == wholeMorph.verts.end())
+          || (s != splitMorph.verts.end() && s->second != m->second))
+        {
+          check.agree = false;
+        }
+    }
+  return check;
 }
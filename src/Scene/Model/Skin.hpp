@@ -2,12 +2,16 @@
 #define DMP_SKIN_HPP
 
 #include <vector>
+#include <cstdint>
 #include <string>
 #include <glm/glm.hpp>
 #include <boost/tokenizer.hpp>
 #include <iostream>
 #include <GL/glew.h>
 #include <memory>
+#include <functional>
+#include "CPUSkinning.hpp"
+#include "MeshOptimize.hpp"
 
 namespace dmp
 {
@@ -15,14 +19,40 @@ namespace dmp
   class Object;
   class Model;
   class Morph;
+  class JobSystem;
 
+  // as many influences as a vertex carries to the shader
+  const size_t maxSkinInfluences = 4;
+
+  // A vertex's bone influences, packed: the weights are unorm16 that sum
+  // to exactly one. Influences past count have index 0 and weight 0
   struct SkinWeight
   {
-    size_t count;
-    std::vector<GLuint> index;
-    std::vector<float> weight;
+    uint16_t index[maxSkinInfluences];
+    uint16_t weight[maxSkinInfluences];
+    uint8_t count;
+
+    float askWeight(size_t k) const
+    {
+      return (float) weight[k] * (1.0f / 65535.0f);
+    }
   };
 
+  enum class SkinningMode
+  {
+    // blends the bones' matrices
+    linear,
+    // blends them as dual quaternions, which keeps the volume that linear
+    // blends lose at twisting joints, in half the palette
+    dualQuaternion
+  };
+
+  // Packs count rigid palette matrices as dual quaternions, two vec4s
+  // each, laid out as ObjectConstants::DQ()
+  void toDualPalette(const glm::mat4 * palette,
+                     size_t count,
+                     glm::vec4 * out);
+
   struct SkinData
   {
     std::string filename;
@@ -35,6 +65,27 @@ namespace dmp
     std::string texFile;
   };
 
+  // A piece of a skin drawn as one object, with a palette of its own.
+  // Its vertices are a contiguous slice of the skin's
+  struct SkinPart
+  {
+    size_t firstVert = 0;
+    size_t numVerts = 0;
+    std::vector<size_t> idxs; // triangles, indexing the slice
+    std::vector<size_t> bones; // palette slot -> binding, ascending
+    std::vector<std::vector<size_t>> lods; // coarser idxs, from buildLODs
+    std::unique_ptr<Object> object;
+  };
+
+  // Splits data's triangles into parts that each bind at most maxBones
+  // bones, keeping their order. Rewrites data's vertices part by part,
+  // copying those that parts share, so that each part's are one slice.
+  // Returns sources: vertex i is now what was vertex sources[i]. Data
+  // binding no more than maxBones bones is one part, left as it is
+  std::vector<size_t> splitPalette(SkinData & data,
+                                   size_t maxBones,
+                                   std::vector<SkinPart> & parts);
+
   class Skin
   {
   public:
@@ -44,12 +95,24 @@ namespace dmp
     Skin(Skin &&) = default;
     Skin & operator=(Skin &&) = default;
 
-    Skin(const std::string & skinPath) {initSkin(skinPath);}
+    // Parts bind at most maxBones bones each, which must be between the
+    // bones of one triangle, 3 * maxSkinInfluences, and maxPaletteBones.
+    // Fewer than the skin needs splits it, e.g. to exercise parts
+    Skin(const std::string & skinPath, size_t maxBones = maxPaletteBones)
+    {
+      initSkin(skinPath, maxBones);
+    }
 
     void insertInScene(std::vector<Object *> & objs,
                        size_t matIdx,
                        size_t texIdx);
 
+    // Creates the skin's Objects, one per part, without putting them in
+    // the scene, for users that draw them themselves. Part i's is
+    // askPart(i).object
+    void buildObjects(size_t matIdx, size_t texIdx);
+    void freeObject();
+
     const std::string & askTexturePath() const {return mSkinData.texFile;}
     const std::vector<glm::mat4> & askBindings() const
     {
@@ -63,20 +126,131 @@ namespace dmp
     {
       return mSkinData.normals;
     }
+    const std::vector<SkinWeight> & askWeights() const
+    {
+      return mSkinData.weights;
+    }
+
+    // Vertices are reordered at load for the vertex cache and fetches, and
+    // copied where palette parts share them. Vertex i here is vertex
+    // askSources()[i] of the file; morphs, which index the file, need
+    // remapping
+    const std::vector<size_t> & askSources() const {return mSources;}
+    size_t askNumFileVerts() const {return mNumFileVerts;}
+    const MeshOptimizeStats & askMeshStats() const {return mMeshStats;}
 
+    // One unless the skin binds more bones than a part may
+    size_t askNumParts() const {return mParts.size();}
+    const SkinPart & askPart(size_t i) const {return mParts[i];}
+
+    // Simplifies every part into up to three coarser levels of detail,
+    // each about half the triangles of the last, that its object draws by
+    // size on screen. Vertices where locked is set, e.g. those a morph
+    // moves, are never collapsed. Before or after the objects are built
+    void buildLODs(const std::vector<char> & locked = {});
+
+    // boneM are the bones' world matrices. Call after update, which places
+    // the skin in the world
     void tellBindingMats(const std::vector<glm::mat4> & boneM);
 
+    // Writes boneM[i] * invB[i] for every binding to out, which must have
+    // room for askBindings().size() matrices. Safe to call from many threads
+    void computePalette(const std::vector<glm::mat4> & boneM,
+                        glm::mat4 * out) const;
+
+    // A bind space box per binding around the vertices it moves, grown by
+    // every morph applied since
+    const std::vector<AABB> & askBoneBounds() const {return mBoneBounds;}
+
+    // The box around the skin posed by palette, as computePalette writes
+    // it, from the bone boxes alone. Holds every vertex blended linearly;
+    // dual quaternion blends may bulge past it by a hair. Safe to call
+    // from many threads
+    AABB computeBounds(const glm::mat4 * palette) const;
+
+    // The world box as of the last tellBindingMats. Each part's object
+    // gets the box of its bones
+    const AABB & askWorldBounds() const {return mWorldBounds;}
+
+    // How the palette blends, on the GPU and the CPU alike. Takes effect
+    // at the next tellBindingMats
+    void tellSkinningMode(SkinningMode mode) {mMode = mode;}
+    SkinningMode askSkinningMode() const {return mMode;}
+
+    // From now on, skins on the CPU across jobs, writing the skinned
+    // vertices into the object's buffer, which then draws unskinned.
+    // nullptr goes back to skinning in the shader. jobs must outlive the
+    // skin or the next call. Needs the object built
+    void skinOnCPU(JobSystem * jobs);
+    bool isSkinnedOnCPU() const {return mCPUSkinner != nullptr;}
+
     void update(float deltaT, glm::mat4 M, bool dirty);
     void hide();
     void show();
     void applyMorph(const Morph & morph);
   private:
-    void initSkin(const std::string & skinPath);
+    void initSkin(const std::string & skinPath, size_t maxBones);
+
+    void buildParts(size_t matIdx, size_t texIdx);
+    bool isBuilt() const {return mParts.front().object != nullptr;}
+    void tellPartLODs(SkinPart & part);
+
+    // Hands each part its slots of the last palette, or skins data with it
+    void tellObjectPalette();
+    void skinVertices(DynamicVertex * data);
+
+    // Calls fn with each part's mapped vertex buffer, and the skin vertex
+    // its first vertex is
+    void updateParts(const std::function<void(DynamicVertex * data,
+                                              size_t first,
+                                              size_t count)> & fn);
+
+    // Calls fn to write every skin vertex, then sends them to the parts.
+    // One part is written in place; more go through mSplitVerts
+    void writeVertices(const std::function<void(DynamicVertex * data)> & fn);
+
+    // Moves the bone boxes by the world palette in mPalette
+    void updateBounds();
 
     SkinData mSkinData;
+    std::vector<size_t> mSources;
+    size_t mNumFileVerts = 0;
+    std::vector<AABB> mBoneBounds;
+    std::vector<AABB> mPosedBounds; // the above, by the last palette
+    AABB mWorldBounds;
+    MeshOptimizeStats mMeshStats;
     bool mIsTextured = false;
-    std::unique_ptr<Object> mObject;
+    std::vector<SkinPart> mParts;
+    std::vector<DynamicVertex> mSplitVerts;
+
+    // the last palette, in model space, and as dual quaternions when in
+    // that mode
+    std::vector<glm::mat4> mPalette;
+    std::vector<glm::vec4> mDualPalette;
+    std::vector<glm::mat4> mPartPalette; // one part's slots of the above
+    std::vector<glm::vec4> mPartDualPalette;
+    SkinningMode mMode = SkinningMode::linear;
+    std::unique_ptr<CPUSkinner> mCPUSkinner;
+    JobSystem * mJobs = nullptr;
   };
+
+  // A skin loaded whole and split into parts of at most some bones,
+  // compared vertex by vertex through their sources
+  struct PaletteSplitCheck
+  {
+    size_t parts = 0;
+    size_t mostBones = 0; // in any one part
+    size_t verts = 0;
+    size_t copies = 0; // split vertices past the file's
+    size_t morphed = 0; // split vertices a morph of every 3rd moves
+    bool agree = true; // same triangles, vertices and morph both ways
+  };
+
+  // Splits skinPath's palette into parts of at most maxBones bones, and
+  // checks its triangles, vertices and a morph remapped onto it against the
+  // whole skin's
+  PaletteSplitCheck checkPaletteSplit(const std::string & skinPath,
+                                      size_t maxBones);
 }
 
 #endif
@@ -1,6 +1,7 @@
 #include "Object.hpp"
 
 #include <algorithm>
+#include <cmath>
 #include <glm/gtc/matrix_transform.hpp>
 #include "Model.hpp"
 
@@ -50,78 +51,124 @@ dmp::Object::Object(std::vector<ObjectVertex> verts,
   initObject(&verts, &idxs);
 }
 
+// Splits verts into the dynamic and static streams
+static void packVertices(const std::vector<dmp::ObjectVertex> & verts,
+                         std::vector<dmp::DynamicVertex> & dynamic,
+                         std::vector<dmp::StaticVertex> & fixed)
+{
+  dynamic.resize(verts.size());
+  fixed.resize(verts.size());
+  for (size_t i = 0; i < verts.size(); ++i)
+    {
+      const auto & v = verts[i];
+      dynamic[i].position = v.position;
+      dynamic[i].tellNormal(v.normal);
+
+      fixed[i].texCoords = glm::packHalf2x16(v.texCoords);
+      for (int k = 0; k < 4; ++k)
+        {
+          auto bone = v.idxs[k] >= 0;
+          expect("bone index in the palette",
+                 v.idxs[k] < (int) dmp::maxPaletteBones);
+          fixed[i].idxs[k] = bone ? (uint16_t) v.idxs[k] : 0;
+          fixed[i].weights[k] = bone
+            ? (uint16_t) lroundf(glm::clamp(v.weights[k], 0.0f, 1.0f)
+                                 * 65535.0f)
+            : 0;
+        }
+    }
+}
+
 void dmp::Object::initObject(std::vector<ObjectVertex> * verts,
                              std::vector<GLuint> * idxs)
 {
   clearBindingMats();
+  mNumVerts = verts->size();
+  mSkinned = std::any_of(verts->begin(), verts->end(),
+                         [](const ObjectVertex & v)
+                         {
+                           return v.idxs.x >= 0 && v.weights.x > 0.0f;
+                         });
+
+  std::vector<DynamicVertex> dynamic;
+  std::vector<StaticVertex> fixed;
+  packVertices(*verts, dynamic, fixed);
+
   glGenVertexArrays(1,&mVAO);
   glGenBuffers(1, &mVBO);
+  glGenBuffers(1, &mStaticVBO);
   if (mHasIndices) glGenBuffers(1, &mEBO);
 
   expectNoErrors("Gen Buffers and Arrays");
   glBindVertexArray(mVAO);
 
-  glBindBuffer(GL_ARRAY_BUFFER, mVBO);
-  glBufferData(GL_ARRAY_BUFFER,
-               verts->size() * sizeof(ObjectVertex),
-               verts->data(),
-               mDrawMode);
-
   drawCount = (GLsizei) verts->size();
 
-  expectNoErrors("Upload Vertex data");
-
   if (mHasIndices)
     {
       glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mEBO);
-      glBufferData(GL_ELEMENT_ARRAY_BUFFER,
-                   idxs->size() * sizeof(GLuint),
-                   idxs->data(),
-                   mDrawMode);
-
+      uploadIndices(*idxs);
       drawCount = (GLsizei) idxs->size();
 
       expectNoErrors("Upload Index data");
     }
 
+  // position and normal, the stream updateVertices rewrites
+  glBindBuffer(GL_ARRAY_BUFFER, mVBO);
+  glBufferData(GL_ARRAY_BUFFER,
+               dynamic.size() * sizeof(DynamicVertex),
+               dynamic.data(),
+               mDrawMode);
+
+  expectNoErrors("Upload dynamic vertex data");
+
   glEnableVertexAttribArray(0);
   glVertexAttribPointer(0,        // index
                         3,        // number of components
                         GL_FLOAT, // what is the type of this thing?
                         GL_FALSE, // normalize [intMin, intMax] to [-1,1]?
-                        sizeof(ObjectVertex), // how much space between things?
-                        (GLvoid *) 0);        // offset of this thing
+                        sizeof(DynamicVertex), // how much space between things?
+                        (GLvoid *) 0);         // offset of this thing
 
   glEnableVertexAttribArray(1);
   glVertexAttribPointer(1,
-                        3,
-                        GL_FLOAT,
-                        GL_FALSE,
-                        sizeof(ObjectVertex),
-                        (GLvoid *) offsetof(ObjectVertex, normal));
+                        4,
+                        GL_INT_2_10_10_10_REV,
+                        GL_TRUE,
+                        sizeof(DynamicVertex),
+                        (GLvoid *) offsetof(DynamicVertex, normal));
+
+  // everything else, uploaded once
+  glBindBuffer(GL_ARRAY_BUFFER, mStaticVBO);
+  glBufferData(GL_ARRAY_BUFFER,
+               fixed.size() * sizeof(StaticVertex),
+               fixed.data(),
+               GL_STATIC_DRAW);
+
+  expectNoErrors("Upload static vertex data");
 
   glEnableVertexAttribArray(2);
   glVertexAttribPointer(2,
                         2,
-                        GL_FLOAT,
+                        GL_HALF_FLOAT,
                         GL_FALSE,
-                        sizeof(ObjectVertex),
-                        (GLvoid *) offsetof(ObjectVertex, texCoords));
+                        sizeof(StaticVertex),
+                        (GLvoid *) offsetof(StaticVertex, texCoords));
 
   glEnableVertexAttribArray(3);
   glVertexAttribPointer(3,
                         4,
-                        GL_FLOAT,
-                        GL_FALSE,
-                        sizeof(ObjectVertex),
-                        (GLvoid *) offsetof(ObjectVertex, weights));
+                        GL_UNSIGNED_SHORT,
+                        GL_TRUE,
+                        sizeof(StaticVertex),
+                        (GLvoid *) offsetof(StaticVertex, weights));
 
   glEnableVertexAttribArray(4);
   glVertexAttribIPointer(4,
                          4,
-                         GL_INT,
-                         sizeof(ObjectVertex),
-                         (GLvoid *) offsetof(ObjectVertex, idxs));
+                         GL_UNSIGNED_SHORT,
+                         sizeof(StaticVertex),
+                         (GLvoid *) offsetof(StaticVertex, idxs));
 
   expectNoErrors("Set vertex attributes");
 
@@ -132,6 +179,52 @@ void dmp::Object::initObject(std::vector<ObjectVertex> * verts,
   mValid = true;
 }
 
+void dmp::Object::uploadIndices(const std::vector<GLuint> & idxs)
+{
+  // every index fits in a short for all but the biggest meshes
+  if (mNumVerts <= 65536)
+    {
+      std::vector<GLushort> shorts(idxs.begin(), idxs.end());
+      mIndexType = GL_UNSIGNED_SHORT;
+      glBufferData(GL_ELEMENT_ARRAY_BUFFER,
+                   shorts.size() * sizeof(GLushort),
+                   shorts.data(),
+                   GL_STATIC_DRAW);
+    }
+  else
+    {
+      mIndexType = GL_UNSIGNED_INT;
+      glBufferData(GL_ELEMENT_ARRAY_BUFFER,
+                   idxs.size() * sizeof(GLuint),
+                   idxs.data(),
+                   GL_STATIC_DRAW);
+    }
+}
+
+void dmp::Object::tellLODs(const std::vector<std::vector<GLuint>> & levels)
+{
+  expect("Object valid", mValid);
+  expect("LODs need indices", mHasIndices);
+  expect("a level at least", !levels.empty());
+
+  // one buffer, the levels one after the other
+  std::vector<GLuint> all;
+  mLODs.clear();
+  for (const auto & curr : levels)
+    {
+      mLODs.emplace_back(all.size(), (GLsizei) curr.size());
+      all.insert(all.end(), curr.begin(), curr.end());
+    }
+
+  // through the VAO, so that it keeps the buffer bound
+  glBindVertexArray(mVAO);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mEBO);
+  uploadIndices(all);
+  glBindVertexArray(0);
+  drawCount = mLODs[0].second;
+  expectNoErrors("Upload LOD indices");
+}
+
 void dmp::Object::sortByMaterial(std::vector<Object *> & objs)
 {
   std::sort(objs.begin(), objs.end(), [](const Object * lhs, const Object * rhs)
@@ -158,12 +251,23 @@ dmp::ObjectConstants dmp::Object::getObjectConstants() const
     {
       retVal.WB[i] = mBindingMats[i];
     }
+  std::copy(mBindingDQs.begin(), mBindingDQs.end(), retVal.DQ());
 
   return retVal;
 }
 
+size_t dmp::Object::askConstantsSize() const
+{
+  if (mDualQuaternion)
+    {
+      return ObjectConstants::std140DualQuaternionSize(mBindingDQs.size() / 2);
+    }
+  return ObjectConstants::std140Size(mBindingMats.size());
+}
+
 void dmp::Object::tellBindingMats(const std::vector<glm::mat4> & mats)
 {
+  expect("palette fits in ObjectConstants", mats.size() <= maxPaletteBones);
   clearBindingMats();
 
   mBindingMats.reserve(mats.size());
@@ -180,18 +284,41 @@ void dmp::Object::clearBindingMats()
 {
   mBindingMats.clear();
   mBindingMats.resize(0);
+  mBindingDQs.clear();
+  mDualQuaternion = false;
+}
+
+void dmp::Object::tellBindingDualQuats(const std::vector<glm::vec4> & dqs)
+{
+  expect("dual quaternions fit in ObjectConstants",
+         dqs.size() <= 2 * maxPaletteBones);
+  clearBindingMats();
+  mBindingDQs = dqs;
+  mDualQuaternion = true;
+  mDirty = true;
 }
 
-void dmp::Object::draw() const
+void dmp::Object::draw(size_t lod) const
 {
   expect("Object valid", mValid);
   if (!mVisible) return;
   if (mHasIndices)
     {
+      // the offset into the bound index buffer, in bytes
+      size_t first = 0;
+      auto count = drawCount;
+      if (!mLODs.empty())
+        {
+          const auto & level = mLODs[std::min(lod, mLODs.size() - 1)];
+          first = level.first;
+          count = level.second;
+        }
+      auto size = (mIndexType == GL_UNSIGNED_SHORT) ? sizeof(GLushort)
+        : sizeof(GLuint);
       glDrawElements(mPrimFormat,
-                     drawCount,
-                     GL_UNSIGNED_INT,
-                     0); // TODO: whats up with this parameter? (its a pointer)
+                     count,
+                     mIndexType,
+                     (GLvoid *) (first * size));
     }
   else
     {
@@ -203,6 +330,67 @@ void dmp::Object::draw() const
   expectNoErrors("Draw object");
 }
 
+void dmp::Object::skinToCache()
+{
+  expect("Object valid", mValid);
+  if (mCacheVAO == 0) initSkinCache();
+  if (!mVisible) return;
+
+  glBindVertexArray(mVAO);
+  glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, mCacheVBO);
+  glBeginTransformFeedback(GL_POINTS);
+  glDrawArrays(GL_POINTS, 0, (GLsizei) mNumVerts);
+  glEndTransformFeedback();
+  glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+  expectNoErrors("Skin object to cache");
+}
+
+void dmp::Object::initSkinCache()
+{
+  glGenVertexArrays(1, &mCacheVAO);
+  glGenBuffers(1, &mCacheVBO);
+  glBindVertexArray(mCacheVAO);
+
+  // written and read by the gpu alone
+  glBindBuffer(GL_ARRAY_BUFFER, mCacheVBO);
+  glBufferData(GL_ARRAY_BUFFER,
+               mNumVerts * sizeof(SkinnedVertex),
+               nullptr,
+               GL_DYNAMIC_COPY);
+
+  glEnableVertexAttribArray(0);
+  glVertexAttribPointer(0,
+                        3,
+                        GL_FLOAT,
+                        GL_FALSE,
+                        sizeof(SkinnedVertex),
+                        (GLvoid *) offsetof(SkinnedVertex, position));
+
+  glEnableVertexAttribArray(1);
+  glVertexAttribPointer(1,
+                        3,
+                        GL_FLOAT,
+                        GL_FALSE,
+                        sizeof(SkinnedVertex),
+                        (GLvoid *) offsetof(SkinnedVertex, normal));
+
+  // the texcoords as ever; the weights and bones have done their job
+  glBindBuffer(GL_ARRAY_BUFFER, mStaticVBO);
+  glEnableVertexAttribArray(2);
+  glVertexAttribPointer(2,
+                        2,
+                        GL_HALF_FLOAT,
+                        GL_FALSE,
+                        sizeof(StaticVertex),
+                        (GLvoid *) offsetof(StaticVertex, texCoords));
+
+  if (mHasIndices) glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mEBO);
+
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  glBindVertexArray(0);
+  expectNoErrors("Init object skinning cache");
+}
+
 // -----------------------------------------------------------------------------
 // Primitive shape constructor
 // -----------------------------------------------------------------------------
@@ -326,18 +514,18 @@ dmp::Object::Object(Shape shape, glm::vec4 min, glm::vec4 max,
     }
 }
 
-void dmp::Object::updateVertices(std::function<void(ObjectVertex * data,
+void dmp::Object::updateVertices(std::function<void(DynamicVertex * data,
                                                     size_t numElems)> updateFn)
 {
   glBindBuffer(GL_ARRAY_BUFFER, mVBO);
   auto buf = glMapBufferRange(GL_ARRAY_BUFFER,
                               0,
-                              mNumVerts * sizeof(ObjectVertex),
+                              mNumVerts * sizeof(DynamicVertex),
                               GL_MAP_READ_BIT | GL_MAP_WRITE_BIT);
   expectNoErrors("Map the VBO");
   expect("buffer not null", buf);
 
-  updateFn((ObjectVertex *) buf, mNumVerts);
+  updateFn((DynamicVertex *) buf, mNumVerts);
   expectNoErrors("call updateFn on buf");
 
   glUnmapBuffer(GL_ARRAY_BUFFER);
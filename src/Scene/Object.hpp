@@ -2,8 +2,10 @@
 #define DMP_SCENE_OBJECT_HPP
 
 #include <vector>
+#include <cstdint>
 #include <GL/glew.h>
 #include <glm/glm.hpp>
+#include <glm/gtc/packing.hpp>
 #include "Types.hpp"
 #include "../util.hpp"
 #include "../Renderer/UniformBuffer.hpp"
@@ -19,6 +21,8 @@ namespace dmp
       Cube
     };
 
+  // A vertex as Object's constructors take it. On the GPU it's split into
+  // the two compact streams below, half the size
   struct ObjectVertex
   {
     glm::vec3 position;
@@ -26,7 +30,45 @@ namespace dmp
     glm::vec2 texCoords;
 
     glm::vec4 weights;
-    glm::ivec4 idxs;
+    glm::ivec4 idxs; // -1 where there is no bone
+  };
+
+  // The attributes that change after upload, in their own buffer so that
+  // updateVertices rewrites nothing else. The normal is snorm 10:10:10:2
+  struct DynamicVertex
+  {
+    glm::vec3 position;
+    uint32_t normal;
+
+    void tellNormal(const glm::vec3 & n)
+    {
+      normal = glm::packSnorm3x10_1x2(glm::vec4(n, 0.0f));
+    }
+    glm::vec3 askNormal() const
+    {
+      return glm::vec3(glm::unpackSnorm3x10_1x2(normal));
+    }
+  };
+
+  // bones an object's palette holds. Skins that bind more are split into
+  // objects that each use at most this many
+  const size_t maxPaletteBones = 128;
+
+  // The attributes that never change: texcoords as half floats, weights
+  // as unorm16 and bone indices as uint16, the same width SkinWeight
+  // keeps them in. No bone is index 0 with weight 0
+  struct StaticVertex
+  {
+    uint32_t texCoords;
+    uint16_t weights[4];
+    uint16_t idxs[4];
+  };
+
+  // A vertex as the skinning pre-pass writes it: skinned, in model space
+  struct SkinnedVertex
+  {
+    glm::vec3 position;
+    glm::vec3 normal;
   };
 
   struct ObjectConstants
@@ -34,11 +76,34 @@ namespace dmp
     glm::mat4 M;
     glm::mat4 normalM;
 
-    glm::mat4 WB[128];
+    glm::mat4 WB[maxPaletteBones];
 
     static size_t std140Size()
     {
-      return dmp::std140PadStruct((std140MatSize<float, 4, 4>() * (2 + 128)));
+      return dmp::std140PadStruct((std140MatSize<float, 4, 4>()
+                                   * (2 + maxPaletteBones)));
+    }
+
+    // The dual quaternion shader reads WB's place as vec4 DQ[256], two per
+    // bone, the real part then the dual part, each (x, y, z, w). Only this
+    // much of the struct needs to reach it
+    glm::vec4 * DQ() {return (glm::vec4 *) WB;}
+    static size_t std140DualQuaternionSize()
+    {
+      return std140DualQuaternionSize(maxPaletteBones);
+    }
+
+    // The same for only the first numBones bones, all a shader reads when
+    // the palette is that long
+    static size_t std140Size(size_t numBones)
+    {
+      return dmp::std140PadStruct(std140MatSize<float, 4, 4>()
+                                  * (2 + numBones));
+    }
+    static size_t std140DualQuaternionSize(size_t numBones)
+    {
+      return dmp::std140PadStruct(std140MatSize<float, 4, 4>() * 2
+                                  + std140VecSize<float, 4>() * 2 * numBones);
     }
 
     operator GLvoid *() {return (GLvoid *) this;}
@@ -59,7 +124,14 @@ namespace dmp
 
       glDeleteVertexArrays(1, &mVAO);
       glDeleteBuffers(1, &mVBO);
+      glDeleteBuffers(1, &mStaticVBO);
       if (mHasIndices) glDeleteBuffers(1, &mEBO);
+      if (mCacheVAO != 0)
+        {
+          glDeleteVertexArrays(1, &mCacheVAO);
+          glDeleteBuffers(1, &mCacheVBO);
+          mCacheVAO = 0;
+        }
 
       mValid = false;
     }
@@ -100,14 +172,68 @@ namespace dmp
       expectNoErrors("Bind object");
     }
 
-    void draw() const;
+    // Binds the skinning cache in place of the vertices, for draws after
+    // skinToCache with the unskinned shader
+    void bindCache() const
+    {
+      expect("Object valid", mValid);
+      expect("skinning cache made", mCacheVAO != 0);
+      glBindVertexArray(mCacheVAO);
+      expectNoErrors("Bind object cache");
+    }
+
+    // Draws level lod of the index buffer, or the coarsest there is
+    void draw(size_t lod = 0) const;
+
+    // Replaces the indices with levels of detail, levels[0] the full mesh
+    // and each after it coarser, all indexing the same vertices. Needs
+    // the object indexed
+    void tellLODs(const std::vector<std::vector<GLuint>> & levels);
+    size_t askNumLODs() const {return mLODs.empty() ? 1 : mLODs.size();}
+
+    // A model space sphere around the vertices, for picking a level
+    void tellBounds(const glm::vec3 & center, float radius)
+    {
+      mBoundsCenter = center;
+      mBoundsRadius = radius;
+    }
+    const glm::vec3 & askBoundsCenter() const {return mBoundsCenter;}
+    float askBoundsRadius() const {return mBoundsRadius;}
+
+    // Where the object is in the world this frame, as a box, for objects
+    // that move their vertices themselves, e.g. skins. Empty when unknown
+    void tellWorldBounds(const AABB & box) {mWorldBounds = box;}
+    const AABB & askWorldBounds() const {return mWorldBounds;}
+
+    // Skins every vertex into the object's skinning cache, made on first
+    // call. The bound program must capture SkinnedVertex by transform
+    // feedback, with the rasterizer discarding. Hidden objects keep what
+    // they had
+    void skinToCache();
 
     ObjectConstants getObjectConstants() const;
+
+    // How much of getObjectConstants() the shader reads: the matrices and
+    // as much of the palette as the object was told
+    size_t askConstantsSize() const;
     void tellBindingMats(const std::vector<glm::mat4> & mats);
     void clearBindingMats();
 
+    // A dual quaternion palette instead of matrices, laid out as
+    // ObjectConstants::DQ(). Until the next tellBindingMats, the object
+    // draws with the dual quaternion shader
+    void tellBindingDualQuats(const std::vector<glm::vec4> & dqs);
+    bool isDualQuaternion() const {return mDualQuaternion;}
+
     glm::mat4 getM() const {return mM;}
 
+    // Whether any vertex is bound to a bone. Skinned objects draw with the
+    // skinning shader, and their binding matrices take them to model space
+    bool isSkinned() const {return mSkinned;}
+
+    // Overrides the above, e.g. for vertices already skinned on the CPU
+    void tellSkinned(bool skinned) {mSkinned = skinned;}
+
     size_t materialIndex() const {return mMaterialIdx;}
     size_t textureIndex() const {return mTextureIdx;}
 
@@ -125,26 +251,33 @@ namespace dmp
       mVisible = false;
     }
 
-    // memory maps the VBO, calls updateFn and then unmaps the VBO
+    // memory maps the dynamic VBO, calls updateFn and then unmaps the VBO
     // - data is a pointer to the data buffer
     // - numElems is the number of elements in the mapped buffer
     // CONTRACT: drawType must be dynamic draw
-    void updateVertices(std::function<void(ObjectVertex * data,
+    void updateVertices(std::function<void(DynamicVertex * data,
                                            size_t numElems)> updateFn);
 
   private:
     void initObject(std::vector<ObjectVertex> * verts,
                     std::vector<GLuint> * idxs);
+    void initSkinCache();
+    void uploadIndices(const std::vector<GLuint> & idxs);
 
     GLuint mVAO = 0;
-    GLuint mVBO = 0;
+    GLuint mVBO = 0; // DynamicVertex, in mDrawMode
+    GLuint mStaticVBO = 0; // StaticVertex
     GLuint mEBO = 0;
+    GLuint mCacheVAO = 0; // draws mCacheVBO with mStaticVBO and mEBO
+    GLuint mCacheVBO = 0; // SkinnedVertex, from skinToCache
+    GLenum mIndexType = GL_UNSIGNED_INT; // short when the vertices allow
 
     bool mDirty = true;
     glm::mat4 mM;
     bool mHasIndices;
     GLenum mPrimFormat;
     bool mValid = false;
+    bool mSkinned = false;
     size_t mMaterialIdx;
     size_t mTextureIdx;
     size_t mNumVerts;
@@ -152,7 +285,15 @@ namespace dmp
     GLsizei drawCount;
     bool mVisible = true;
 
+    // each level's first index and count in mEBO; empty for one level
+    std::vector<std::pair<size_t, GLsizei>> mLODs;
+    glm::vec3 mBoundsCenter;
+    float mBoundsRadius = 0.0f;
+    AABB mWorldBounds;
+
     std::vector<glm::mat4> mBindingMats;
+    std::vector<glm::vec4> mBindingDQs;
+    bool mDualQuaternion = false;
 
     GLenum mDrawMode = GL_STATIC_DRAW;
   };
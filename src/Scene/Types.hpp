@@ -1,6 +1,7 @@
 #ifndef DMP_TYPES_HPP
 #define DMP_TYPES_HPP
 
+#include <limits>
 #include <glm/glm.hpp>
 #include "../Renderer/UniformBuffer.hpp"
 
@@ -28,6 +29,65 @@ namespace dmp
     glm::vec4 dir;
     glm::mat4 M;
   };
+
+  // An axis aligned box, empty until something is added to it
+  struct AABB
+  {
+    glm::vec3 lo = glm::vec3(std::numeric_limits<float>::max());
+    glm::vec3 hi = glm::vec3(-std::numeric_limits<float>::max());
+
+    bool isEmpty() const {return lo.x > hi.x;}
+    glm::vec3 askCenter() const {return 0.5f * (lo + hi);}
+    glm::vec3 askExtent() const {return 0.5f * (hi - lo);}
+
+    void add(const glm::vec3 & p)
+    {
+      lo = glm::min(lo, p);
+      hi = glm::max(hi, p);
+    }
+    void add(const AABB & box)
+    {
+      lo = glm::min(lo, box.lo);
+      hi = glm::max(hi, box.hi);
+    }
+
+    // The box around this one moved by the affine M
+    AABB transformed(const glm::mat4 & M) const
+    {
+      if (isEmpty()) return *this;
+
+      // each of M's axes adds its reach along every world axis
+      auto e = askExtent();
+      auto center = glm::vec3(M * glm::vec4(askCenter(), 1.0f));
+      auto extent = glm::abs(glm::vec3(M[0])) * e.x
+        + glm::abs(glm::vec3(M[1])) * e.y
+        + glm::abs(glm::vec3(M[2])) * e.z;
+      return {center - extent, center + extent};
+    }
+
+    // Whether the box is wholly outside one of the planes of the clip
+    // space of PV. A box that isn't may still be out of view. An empty
+    // box hasn't been given any points yet, so it is never outside
+    bool isOutside(const glm::mat4 & PV) const
+    {
+      if (isEmpty()) return false;
+
+      // the planes, from the rows of PV: w + x, w - x, and so on
+      auto r = glm::transpose(PV);
+      glm::vec4 planes[6] = {r[3] + r[0], r[3] - r[0],
+                             r[3] + r[1], r[3] - r[1],
+                             r[3] + r[2], r[3] - r[2]};
+      for (const auto & p : planes)
+        {
+          // the corner furthest along the plane's normal
+          glm::vec3 corner = {p.x >= 0.0f ? hi.x : lo.x,
+                              p.y >= 0.0f ? hi.y : lo.y,
+                              p.z >= 0.0f ? hi.z : lo.z};
+          if (glm::dot(glm::vec3(p), corner) + p.w < 0.0f) return true;
+        }
+      return false;
+    }
+  };
 }
 
 #endif
@@ -4,6 +4,12 @@
 #include "Program.hpp"
 #include "util.hpp"
 #include "CommandLine.hpp"
+#include "Scene/Model/MotionMatching.hpp"
+#include "Scene/Model/CPUSkinning.hpp"
+#include "Scene/Model/IK.hpp"
+#include "Scene/Model/AnimationMixer.hpp"
+#include "Scene/Model/Ragdoll.hpp"
+#include "Scene/Model/Skin.hpp"
 
 #include <glm/glm.hpp>
 
@@ -18,6 +24,146 @@ static void libsFinalize()
   glfwTerminate();
 }
 
+// how far, in radians and units, a mixer playing one clip may put a joint
+// from the clip's own pose, from the round trip through quaternions
+static const float mixerAgreeAngle = 1e-3f;
+static const float mixerAgreeOffset = 1e-5f;
+
+// Motion matching query latency versus database size, for queries near the
+// data and queries well off it, a mixer playing the clip alone and in
+// layers, the skin's vertex cache efficiency, levels of detail and a check
+// of its palette split into the smallest parts, CPU skinning time on one
+// thread and on pools of 2, 4 and every hardware thread, IK batches of
+// every limb of many copies of the skeleton, with and without a budget,
+// and a pile of its ragdolls falling and going to sleep. Needs no window
+static void runBench(const dmp::CommandLine & cmd)
+{
+  using namespace dmp;
+
+  expect("bench has a skeleton", cmd.hasSkel());
+  expect("bench has an animation or a skin", cmd.hasAnim() || cmd.hasSkin());
+
+  auto rig = Rig::load(cmd.skelPath);
+
+  if (cmd.hasAnim())
+    {
+      Animation anim(cmd.animPath);
+      std::vector<size_t> sizes = {1000, 4000, 16000, 64000, 256000};
+
+      for (auto noise : {0.02f, 0.1f})
+        {
+          std::cout << "motion search, queries " << noise
+                    << " off the data:" << std::endl
+                    << "frames\tk-d tree us\tlinear us\tagree" << std::endl;
+          for (const auto & t : benchmarkMotionSearch(rig, anim, sizes,
+                                                      1000, noise))
+            {
+              std::cout << t.frames << "\t"
+                        << t.treeMicroseconds << "\t"
+                        << t.linearMicroseconds << "\t"
+                        << (t.agree ? "yes" : "NO") << std::endl;
+            }
+        }
+
+      // a mixer playing one clip must give back that clip's pose
+      auto t = benchmarkMixer(rig, anim, 10000);
+      std::cout << "mixer " << cmd.animPath << ":" << std::endl
+                << "joints\tclip us\t1 clip us\t3 layers us\tmax angle"
+                << "\tmax offset\tagree" << std::endl
+                << t.joints << "\t" << t.clipMicroseconds << "\t"
+                << t.singleMicroseconds << "\t" << t.layeredMicroseconds
+                << "\t" << t.maxAngle << "\t" << t.maxOffset << "\t"
+                << (t.maxAngle < mixerAgreeAngle
+                    && t.maxOffset < mixerAgreeOffset ? "yes" : "NO")
+                << std::endl;
+    }
+
+  if (cmd.hasSkin())
+    {
+      Skin skin(cmd.skinPath);
+      std::cout << "mesh " << cmd.skinPath << ": ACMR "
+                << skin.askMeshStats().acmrBefore << " in file order, "
+                << skin.askMeshStats().acmrAfter << " optimized" << std::endl;
+
+      skin.buildLODs();
+      for (size_t i = 0; i < skin.askNumParts(); ++i)
+        {
+          const auto & part = skin.askPart(i);
+          std::cout << "mesh " << cmd.skinPath << ": part " << i
+                    << " LOD triangles " << part.idxs.size() / 3;
+          for (const auto & curr : part.lods)
+            {
+              std::cout << ", " << curr.size() / 3;
+            }
+          std::cout << std::endl;
+        }
+
+      // the smallest parts a triangle allows, unless told, so that vertex
+      // copies and morph remapping get exercised on skins that fit whole
+      auto bones = cmd.hasMaxBones() ? cmd.maxBones : 3 * maxSkinInfluences;
+      auto split = checkPaletteSplit(cmd.skinPath, bones);
+      std::cout << "palette split " << cmd.skinPath << ", at most " << bones
+                << " bones a part:" << std::endl
+                << "parts\tmost bones\tverts\tcopies\tmorphed\tagree"
+                << std::endl
+                << split.parts << "\t" << split.mostBones << "\t"
+                << split.verts << "\t" << split.copies << "\t"
+                << split.morphed << "\t" << (split.agree ? "yes" : "NO")
+                << std::endl;
+
+      // 0 workers last, one per hardware thread
+      std::cout << "cpu skinning " << cmd.skinPath << ":" << std::endl
+                << "verts\tthreads\t1 thread us\tpool us" << std::endl;
+      for (auto workers : {1, 3, 0})
+        {
+          auto t = benchmarkCPUSkinning(skin, *rig, 1000, (size_t) workers);
+          std::cout << t.verts << "\t" << t.threads << "\t"
+                    << t.singleMicroseconds << "\t"
+                    << t.jobsMicroseconds << std::endl;
+        }
+    }
+
+  // the tight budget skips chains, which start from their last solution
+  // next batch
+  std::cout << "ik " << cmd.skelPath << ", 1000 characters:" << std::endl
+            << "method	budget us	threads	chains	converged	iterations"
+            << "	skipped	batch us" << std::endl;
+  for (auto method : {IKMethod::CCD, IKMethod::FABRIK})
+    {
+      for (auto budget : {1e6f, 1000.0f})
+        {
+          for (auto workers : {1, 0})
+            {
+              auto t = benchmarkIK(*rig, method, 1000, 100, budget,
+                                   (size_t) workers);
+              std::cout << (method == IKMethod::CCD ? "ccd" : "fabrik")
+                        << "	" << budget << "	" << t.threads << "	"
+                        << t.problems << "	" << t.converged << "	"
+                        << t.iterations << "	" << t.skipped << "	"
+                        << t.microseconds << std::endl;
+            }
+        }
+    }
+
+  // settled ragdolls sleep, and the ones still awake start each substep
+  // from the last one's impulses
+  std::cout << "ragdolls " << cmd.skelPath << ", 5 s:" << std::endl
+            << "ragdolls	threads	falling us	settled us	contacts"
+            << "	asleep" << std::endl;
+  for (auto count : {100, 400})
+    {
+      for (auto workers : {1, 0})
+        {
+          auto t = benchmarkRagdoll(rig, (size_t) count, 5.0f,
+                                    (size_t) workers);
+          std::cout << t.ragdolls << "\t" << t.threads << "\t"
+                    << t.fallingMicroseconds << "\t"
+                    << t.settledMicroseconds << "\t"
+                    << t.contacts << "\t" << t.asleep << std::endl;
+        }
+    }
+}
+
 int main(int argc, char ** argv)
 {
   using namespace dmp;
@@ -29,6 +175,21 @@ int main(int argc, char ** argv)
 
   int exitCode = EXIT_SUCCESS;
 
+  if (cmd.bench)
+    {
+      try
+        {
+          runBench(cmd);
+        }
+      catch (dmp::InvariantViolation & e)
+        {
+          std::cerr << "Invariant Violation!" << std::endl
+                    << e.what() << std::endl;
+          exitCode = EXIT_FAILURE;
+        }
+      return exitCode;
+    }
+
   try
     {
       libsInit();